@@ -22,6 +22,8 @@
 // GA SLAM
 #include "ga_slam/TypeDefs.h"
 #include "ga_slam/processing/CloudProcessing.h"
+#include "ga_slam/processing/CloudQueue.h"
+#include "ga_slam/processing/LatencyCounter.h"
 
 // Eigen
 #include <Eigen/Geometry>
@@ -32,16 +34,27 @@
 
 // STL
 #include <vector>
+#include <utility>
 #include <mutex>
-#include <future>
+#include <thread>
+#include <string>
+#include <memory>
+#include <algorithm>
+#include <cmath>
 
 namespace ga_slam {
 
 GaSlam::GaSlam(void)
-        : poseEstimation_(),
-          poseCorrection_(),
+        : threadPool_(),
+          poseEstimation_(&threadPool_),
+          poseCorrection_(&threadPool_),
           dataRegistration_(),
-          poseInitialized_(false) {
+          poseInitialized_(false),
+          useElevationLikelihood_(false) {
+    scanToMapMatchingThread_.start([this] {
+        matchLocalMapToRawCloud(matchedRawCloud_);
+    });
+    mapToMapMatchingThread_.start([this] { matchLocalMapToGlobalMap(); });
 }
 
 void GaSlam::configure(
@@ -54,23 +67,54 @@ void GaSlam::configure(
         double traversedDistanceThreshold, double minSlopeThreshold,
         double slopeSumThresholdMultiplier, double matchAcceptanceThreshold,
         bool matchYaw, double matchYawRange, double matchYawStep,
-        double globalMapLength, double globalMapResolution) {
+        double globalMapLength, double globalMapResolution,
+        bool useElevationLikelihood,
+        int numThreads,
+        double resampleThreshold,
+        int minNumParticles,
+        int cloudQueueSize,
+        CloudQueuePolicy cloudQueuePolicy,
+        int matchPyramidLevels,
+        int matchNumCandidates,
+        double matchSearchRadius,
+        bool matchYawFourierMellin,
+        int matchMinOverlap,
+        int numMapPyramidLevels) {
+    stopRegistrationThread();
+    waitForMatchingTasks();
+
+    useElevationLikelihood_ = useElevationLikelihood;
     voxelSize_ = voxelSize;
     depthSigmaCoeff1_ = depthSigmaCoeff1;
     depthSigmaCoeff2_ = depthSigmaCoeff2;
     depthSigmaCoeff3_ = depthSigmaCoeff3;
 
+    threadPool_.configure(numThreads);
+
     poseEstimation_.configure(numParticles, resampleFrequency,
             initialSigmaX, initialSigmaY, initialSigmaYaw,
-            predictSigmaX, predictSigmaY, predictSigmaYaw);
+            predictSigmaX, predictSigmaY, predictSigmaYaw,
+            resampleThreshold, minNumParticles);
 
     poseCorrection_.configure(traversedDistanceThreshold, minSlopeThreshold,
             slopeSumThresholdMultiplier, matchAcceptanceThreshold,
             matchYaw, matchYawRange, matchYawStep,
-            globalMapLength, globalMapResolution);
+            globalMapLength, globalMapResolution,
+            matchPyramidLevels, matchNumCandidates, matchSearchRadius,
+            matchYawFourierMellin, matchMinOverlap);
+
+    const double matchingLevel = std::log2(globalMapResolution /
+            mapResolution);
+    if (matchingLevel > 0.5 &&
+            std::abs(matchingLevel - std::round(matchingLevel)) < 1e-6)
+        numMapPyramidLevels = std::max<int>(numMapPyramidLevels,
+                std::round(matchingLevel));
 
     dataRegistration_.configure(mapLength, mapResolution, minElevation,
-            maxElevation);
+            maxElevation, minSlopeThreshold, true, numMapPyramidLevels);
+
+    if (cloudQueueSize > 0)
+        startRegistrationThread(cloudQueueSize, cloudQueuePolicy);
 }
 
 void GaSlam::poseCallback(const Pose& odometryDeltaPose) {
@@ -91,24 +135,45 @@ void GaSlam::cloudCallback(
         const Pose& bodyToSensorTF) {
     if (!poseInitialized_) return;
 
-    const auto mapToSensorTF = getPose() * bodyToSensorTF;
-    const auto mapParameters = getLocalMap().getParameters();
-    Cloud::Ptr processedCloud(new Cloud);
-    std::vector<float> cloudVariances;
+    const Pose robotPose = getPose();
 
-    CloudProcessing::processCloud(cloud, processedCloud, cloudVariances,
-            getPose(), mapToSensorTF, mapParameters, voxelSize_,
-            depthSigmaCoeff1_, depthSigmaCoeff2_, depthSigmaCoeff3_);
+    std::unique_lock<std::mutex> guard(registrationMutex_);
+    const bool useCloudQueue = registrationThread_.joinable();
+    guard.unlock();
 
-    dataRegistration_.updateMap(processedCloud, cloudVariances);
+    // The queue rejects the cloud if the thread is stopped meanwhile
+    if (useCloudQueue) {
+        cloudQueue_.push(cloud, robotPose, bodyToSensorTF);
+        return;
+    }
+
+    auto buffers = borrowCallbackBuffers();
+    auto& cloudBuffers = buffers->cloudBuffers;
+    reuseCloud(cloudBuffers.processedCloud);
+
+    processCloud(cloud, robotPose, bodyToSensorTF,
+            cloudBuffers.processedCloud, cloudBuffers.cloudVariances,
+            buffers->voxelBuffers);
+    registerCloud(cloudBuffers.processedCloud, cloudBuffers.cloudVariances);
+
+    returnCallbackBuffers(std::move(buffers));
+}
+
+std::unique_ptr<GaSlam::CallbackBuffers> GaSlam::borrowCallbackBuffers(void) {
+    std::lock_guard<std::mutex> guard(callbackBuffersMutex_);
+
+    if (freeCallbackBuffers_.empty())
+        return std::unique_ptr<CallbackBuffers>(new CallbackBuffers);
 
-    if (isFutureReady(scanToMapMatchingFuture_))
-        scanToMapMatchingFuture_ = std::async(std::launch::async,
-                &GaSlam::matchLocalMapToRawCloud, this, processedCloud);
+    auto buffers = std::move(freeCallbackBuffers_.back());
+    freeCallbackBuffers_.pop_back();
 
-    if (isFutureReady(mapToMapMatchingFuture_))
-        mapToMapMatchingFuture_ = std::async(std::launch::async,
-                &GaSlam::matchLocalMapToGlobalMap, this);
+    return buffers;
+}
+
+void GaSlam::returnCallbackBuffers(std::unique_ptr<CallbackBuffers> buffers) {
+    std::lock_guard<std::mutex> guard(callbackBuffersMutex_);
+    freeCallbackBuffers_.push_back(std::move(buffers));
 }
 
 void GaSlam::createGlobalMap(
@@ -117,29 +182,152 @@ void GaSlam::createGlobalMap(
     poseCorrection_.createGlobalMap(globalCloud, globalCloudPose);
 }
 
+void GaSlam::beginGlobalMap(void) {
+    poseCorrection_.beginGlobalMap();
+}
+
+void GaSlam::addGlobalCloud(const Cloud::ConstPtr& globalCloudChunk) {
+    poseCorrection_.addGlobalCloud(globalCloudChunk);
+}
+
+void GaSlam::finishGlobalMap(const Pose& globalCloudPose) {
+    poseCorrection_.finishGlobalMap(globalCloudPose);
+}
+
+bool GaSlam::openTiledGlobalMap(
+        const std::string& filename,
+        int maxResidentTiles,
+        double searchLength) {
+    return poseCorrection_.openTiledGlobalMap(filename, maxResidentTiles,
+            searchLength);
+}
+
+void GaSlam::processCloud(
+        const Cloud::ConstPtr& cloud,
+        const Pose& robotPose,
+        const Pose& bodyToSensorTF,
+        Cloud::Ptr& processedCloud,
+        std::vector<float>& cloudVariances,
+        VoxelBuffers& buffers) {
+    const auto start = LatencyCounter::Clock::now();
+    const auto mapToSensorTF = robotPose * bodyToSensorTF;
+    const auto mapParameters = dataRegistration_.getMapParameters();
+
+    CloudProcessing::processCloud(cloud, processedCloud, cloudVariances,
+            buffers, robotPose, mapToSensorTF, mapParameters, voxelSize_,
+            depthSigmaCoeff1_, depthSigmaCoeff2_, depthSigmaCoeff3_);
+
+    preprocessingLatency_.addSince(start);
+}
+
+void GaSlam::registerCloud(
+        Cloud::Ptr& processedCloud,
+        const std::vector<float>& cloudVariances) {
+    const auto start = LatencyCounter::Clock::now();
+    dataRegistration_.updateMap(processedCloud, cloudVariances);
+    fusionLatency_.addSince(start);
+
+    scanToMapMatchingThread_.tryRun([&] {
+        std::swap(matchedRawCloud_, processedCloud);
+    });
+    mapToMapMatchingThread_.tryRun([] {});
+}
+
+void GaSlam::runRegistrationThread(void) {
+    QueuedClouds queuedClouds;
+    VoxelBuffers voxelBuffers;
+    CloudBuffers buffers[2];
+    size_t bufferIndex = 0;
+
+    while (cloudQueue_.pop(queuedClouds)) {
+        auto& current = buffers[bufferIndex];
+        bufferIndex = 1 - bufferIndex;
+        reuseCloud(current.processedCloud);
+        reuseCloud(current.scanCloud);
+
+        const auto& firstCloud = queuedClouds.front();
+        processCloud(firstCloud.cloud, firstCloud.robotPose,
+                firstCloud.bodyToSensorTF, current.processedCloud,
+                current.cloudVariances, voxelBuffers);
+
+        for (size_t i = 1; i < queuedClouds.size(); ++i) {
+            const auto& queuedCloud = queuedClouds[i];
+            processCloud(queuedCloud.cloud, queuedCloud.robotPose,
+                    queuedCloud.bodyToSensorTF, current.scanCloud,
+                    current.scanVariances, voxelBuffers);
+
+            *current.processedCloud += *current.scanCloud;
+            current.cloudVariances.insert(current.cloudVariances.end(),
+                    current.scanVariances.begin(),
+                    current.scanVariances.end());
+        }
+
+        fusionThread_.run([&] { fusedBuffers_ = &current; });
+    }
+
+    fusionThread_.wait();
+}
+
+void GaSlam::startRegistrationThread(
+        int cloudQueueSize,
+        CloudQueuePolicy cloudQueuePolicy) {
+    std::lock_guard<std::mutex> guard(registrationMutex_);
+
+    cloudQueue_.configure(cloudQueueSize, cloudQueuePolicy);
+    fusionThread_.start([this] {
+        registerCloud(fusedBuffers_->processedCloud,
+                fusedBuffers_->cloudVariances);
+    });
+    registrationThread_ = std::thread(&GaSlam::runRegistrationThread, this);
+}
+
+void GaSlam::stopRegistrationThread(void) {
+    std::lock_guard<std::mutex> guard(registrationMutex_);
+
+    if (!registrationThread_.joinable()) return;
+
+    cloudQueue_.close();
+    registrationThread_.join();
+    fusionThread_.stop();
+}
+
+void GaSlam::waitForMatchingTasks(void) {
+    scanToMapMatchingThread_.wait();
+    mapToMapMatchingThread_.wait();
+}
+
 void GaSlam::matchLocalMapToRawCloud(const Cloud::ConstPtr& rawCloud) {
-    Cloud::Ptr mapCloud(new Cloud);
+    const auto mapSnapshot = getLocalMapSnapshot();
+    if (!mapSnapshot) return;
 
-    std::unique_lock<std::mutex> guard(getLocalMapMutex());
-    const auto& map = getLocalMap();
-    CloudProcessing::convertMapToCloud(map, mapCloud);
-    guard.unlock();
+    if (useElevationLikelihood_) {
+        poseEstimation_.filterPose(rawCloud, *mapSnapshot);
+        return;
+    }
 
-    poseEstimation_.filterPose(rawCloud, mapCloud);
+    auto& localMapCloud = localMapClouds_[localMapCloudIndex_];
+    localMapCloudIndex_ = 1 - localMapCloudIndex_;
+    reuseCloud(localMapCloud);
+    CloudProcessing::convertMapToCloud(*mapSnapshot, localMapCloud);
+
+    poseEstimation_.filterPose(rawCloud, localMapCloud);
 }
 
 void GaSlam::matchLocalMapToGlobalMap(void) {
     const auto currentPose = getPose();
     if (!poseCorrection_.distanceCriterionFulfilled(currentPose)) return;
 
-    std::unique_lock<std::mutex> guard(getLocalMapMutex());
-    const auto& map = getLocalMap();
-    if (!poseCorrection_.featureCriterionFulfilled(map)) return;
+    const double slopeSum = dataRegistration_.getSlopeSum();
+    const double resolution = dataRegistration_.getMapParameters().resolution;
+    if (!poseCorrection_.featureCriterionFulfilled(slopeSum, resolution))
+        return;
+
+    const auto mapSnapshot = getLocalMapSnapshot();
+    if (!mapSnapshot) return;
 
     Pose correctionDeltaPose;
-    const bool matchFound = poseCorrection_.matchMaps(map, currentPose,
-            correctionDeltaPose);
-    guard.unlock();
+    const bool matchFound = poseCorrection_.matchMaps(*mapSnapshot,
+            currentPose, correctionDeltaPose);
 
     if (matchFound) poseEstimation_.predictPose(correctionDeltaPose);
 }
@@ -25,6 +25,11 @@
 #include "ga_slam/mapping/DataRegistration.h"
 #include "ga_slam/localization/PoseEstimation.h"
 #include "ga_slam/localization/PoseCorrection.h"
+#include "ga_slam/processing/ThreadPool.h"
+#include "ga_slam/processing/TaskThread.h"
+#include "ga_slam/processing/CloudProcessing.h"
+#include "ga_slam/processing/CloudQueue.h"
+#include "ga_slam/processing/LatencyCounter.h"
 
 // Eigen
 #include <Eigen/Core>
@@ -35,10 +40,13 @@
 #include <pcl/point_cloud.h>
 
 // STL
+#include <vector>
 #include <atomic>
 #include <mutex>
-#include <chrono>
-#include <future>
+#include <thread>
+#include <string>
+#include <memory>
+#include <cstdint>
 
 namespace ga_slam {
 
@@ -53,25 +61,57 @@ class GaSlam {
     /// PoseCorrection) and mapping (DataRegistration)
     GaSlam(void);
 
+    /// Stops the registration thread (if any) and the matching threads,
+    /// whose tasks use the members declared after them
+    ~GaSlam(void) {
+        stopRegistrationThread();
+        scanToMapMatchingThread_.stop();
+        mapToMapMatchingThread_.stop();
+    }
+
     /// Delete the default copy/move constructors and operators
     GaSlam(const GaSlam&) = delete;
     GaSlam& operator=(const GaSlam&) = delete;
     GaSlam(GaSlam&&) = delete;
     GaSlam& operator=(GaSlam&&) = delete;
 
-    /// Returns the robot's estimated pose
+    /// Returns the robot's estimated pose (the call never blocks)
     Pose getPose(void) const { return poseEstimation_.getPose(); }
 
-    /// Returns the mutex protecting the pose
+    /** Returns the mutex serializing the pose updates
+      * @deprecated getPose returns a consistent pose without locking
+      */
     std::mutex& getPoseMutex(void) { return poseEstimation_.getPoseMutex(); }
 
     /// Returns the local elevation map
     const Map& getLocalMap(void) const { return dataRegistration_.getMap(); }
 
-    /// Returns the mutex protecting the local map
+    /** Returns the mutex protecting the local map
+      * @note readers should prefer getLocalMapSnapshot, which never blocks the
+      *       registration of the clouds
+      */
     std::mutex& getLocalMapMutex(void) {
         return dataRegistration_.getMapMutex(); }
 
+    /// Returns the latest immutable snapshot of the local map (the call never
+    /// blocks and the snapshot stays valid while it is held)
+    std::shared_ptr<const MapSnapshot> getLocalMapSnapshot(void) const {
+        return dataRegistration_.getSnapshot(); }
+
+    /// Returns the version of the local map, increased on every change
+    uint64_t getLocalMapVersion(void) const {
+        return dataRegistration_.getVersion(); }
+
+    /** Collects the cells of the local map that changed after a version,
+      * e.g. the version of a previously taken snapshot or change set
+      * @param[in] sinceVersion the version the caller is up to date with
+      * @param[out] changeSet the changed cells and their values
+      */
+    void getLocalMapChanges(
+            uint64_t sinceVersion,
+            MapChangeSet& changeSet) const {
+        dataRegistration_.getChanges(sinceVersion, changeSet); }
+
     /// Returns the global elevation map
     const Map& getGlobalMap(void) const {
         return poseCorrection_.getGlobalMap(); }
@@ -80,6 +120,19 @@ class GaSlam {
     std::mutex& getGlobalMapMutex(void) {
         return poseCorrection_.getGlobalMapMutex(); }
 
+    /// Returns the queue of the clouds waiting to be registered, which holds
+    /// the counters of the ingest stage
+    const CloudQueue& getCloudQueue(void) const { return cloudQueue_; }
+
+    /// Returns the latencies of the cloud preprocessing stage (downsampling,
+    /// transformation, cropping and variance calculation)
+    const LatencyCounter& getPreprocessingLatency(void) const {
+        return preprocessingLatency_; }
+
+    /// Returns the latencies of the cloud fusion stage (map update)
+    const LatencyCounter& getFusionLatency(void) const {
+        return fusionLatency_; }
+
     /// Returns the array with the particles from the particle filter
     Eigen::ArrayXXd getParticlesArray(void) const {
         return poseEstimation_.getParticlesArray(); }
@@ -98,8 +151,9 @@ class GaSlam {
       * @param[in] depthSigmaCoeff3 the third coefficient of the uncertainty
       *            equation of the depth sensor
       * @param[in] numParticles number of particles used in the particle filter
-      * @param[in] resampleFrequency number of iterations of the particle filter
-      *            before resampling
+      * @param[in] resampleFrequency maximum number of iterations of the
+      *            particle filter before resampling (non-positive to resample
+      *            only depending on the effective sample size)
       * @param[in] initialSigmaX gaussian sigma of x for particle initialization
       * @param[in] initialSigmaY gaussian sigma of y for particle initialization
       * @param[in] initialSigmaYaw gaussian sigma of yaw for particle
@@ -124,6 +178,39 @@ class GaSlam {
       *            template matching
       * @param[in] globalMapLength size of one dimension of the global map
       * @param[in] globalMapResolution resolution of the global map in meters
+      * @param[in] useElevationLikelihood whether to weight the particles using
+      *            the elevation likelihood of the raw cloud given the local
+      *            map instead of matching it to the map's point cloud
+      * @param[in] numThreads number of threads used to evaluate the particles
+      *            (a non-positive value selects the number of hardware threads)
+      * @param[in] resampleThreshold ratio of the effective sample size to the
+      *            number of particles below which the particles are resampled
+      * @param[in] minNumParticles minimum number of particles kept when the
+      *            population size is adapted using KLD-sampling (non-positive
+      *            to keep numParticles fixed)
+      * @param[in] cloudQueueSize maximum number of pending entries of the
+      *            queue drained by the registration thread (non-positive to
+      *            register the clouds on the callers' threads)
+      * @param[in] cloudQueuePolicy policy applied when a cloud is received
+      *            while the queue is full
+      * @param[in] matchPyramidLevels maximum number of pyramid levels of the
+      *            coarse-to-fine map matching (non-positive to match
+      *            exhaustively at the native resolution)
+      * @param[in] matchNumCandidates number of candidates of the coarsest
+      *            pyramid level that are refined
+      * @param[in] matchSearchRadius radius in meters around the predicted
+      *            position within which the local map is searched in the
+      *            global map (non-positive to search the whole global map)
+      * @param[in] matchYawFourierMellin whether to estimate the yaw of the
+      *            map matching from the maps' spectra instead of searching
+      *            every yaw step (ignored by the windowed matching)
+      * @param[in] matchMinOverlap minimum number of cells known in both maps
+      *            for the masked map matching, which ignores the unknown
+      *            cells (non-positive to match the zero-filled maps)
+      * @param[in] numMapPyramidLevels number of coarser levels of the local
+      *            map published with its snapshots. The level with the global
+      *            map's resolution is always kept if the resolutions differ
+      *            by a power of two, so that the matching does not resample
       */
     void configure(
             double mapLength, double mapResolution,
@@ -135,7 +222,19 @@ class GaSlam {
             double traversedDistanceThreshold, double minSlopeThreshold,
             double slopeSumThresholdMultiplier, double matchAcceptanceThreshold,
             bool matchYaw, double matchYawRange, double matchYawStep,
-            double globalMapLength, double globalMapResolution);
+            double globalMapLength, double globalMapResolution,
+            bool useElevationLikelihood = false,
+            int numThreads = 0,
+            double resampleThreshold = 0.5,
+            int minNumParticles = 0,
+            int cloudQueueSize = 0,
+            CloudQueuePolicy cloudQueuePolicy = CloudQueuePolicy::DropOldest,
+            int matchPyramidLevels = 0,
+            int matchNumCandidates = 3,
+            double matchSearchRadius = 0.,
+            bool matchYawFourierMellin = false,
+            int matchMinOverlap = 0,
+            int numMapPyramidLevels = 0);
 
     /** Handles the input delta pose data from odometry. The delta pose is
       * used to predict the robot's current pose and update the map's position
@@ -152,6 +251,8 @@ class GaSlam {
     /** Handles the input point cloud data from various sensors. The cloud is
       * processed and registered to the local map. If possible, scan-to-map and
       * map-to-map matchings are perform to improve the pose and map estimates
+      * @note if the cloud queue is enabled, the cloud is only pushed to it and
+      *       registered later by the registration thread
       * @param[in] cloud the point cloud as received from a sensor
       * @param[in] bodyToSensorTF the transformation applied to the cloud
       */
@@ -168,8 +269,128 @@ class GaSlam {
             const Cloud::ConstPtr& globalCloud,
             const Pose& globalCloudPose);
 
+    /** Starts creating the global map from a global cloud received in chunks
+      * in the respective module
+      */
+    void beginGlobalMap(void);
+
+    /** Passes a chunk of the global cloud to be registered to the global map
+      * being built to the respective module
+      * @param[in] globalCloudChunk a chunk of the cloud received from the
+      *            orbiter
+      */
+    void addGlobalCloud(const Cloud::ConstPtr& globalCloudChunk);
+
+    /** Passes the pose of the global cloud received in chunks to the
+      * respective module to finish the global map
+      * @param[in] globalCloudPose the pose of point cloud in the world
+      */
+    void finishGlobalMap(const Pose& globalCloudPose);
+
+    /** Passes the tiled global map file to be used in map matching to the
+      * respective module
+      * @param[in] filename the path of the tiled map file
+      * @param[in] maxResidentTiles the maximum number of tiles in memory
+      * @param[in] searchLength the size of the region of the global map
+      *            around the current pose searched for the local map
+      * @return true if the file is a valid tiled map
+      */
+    bool openTiledGlobalMap(
+            const std::string& filename,
+            int maxResidentTiles,
+            double searchLength);
+
   protected:
-    /** Converts the local elevation map to a point cloud and performs a
+    /// Clouds and variances reused by a processing thread, so that no memory
+    /// is allocated per cloud once they have grown to the clouds' size
+    struct CloudBuffers {
+        /// Processed cloud and its variances
+        Cloud::Ptr processedCloud;
+        std::vector<float> cloudVariances;
+
+        /// Cloud and variances of a scan merged to the processed cloud
+        Cloud::Ptr scanCloud;
+        std::vector<float> scanVariances;
+    };
+
+    /// Buffers borrowed by a callback processing its cloud directly
+    struct CallbackBuffers {
+        CloudBuffers cloudBuffers;
+        VoxelBuffers voxelBuffers;
+    };
+
+    /** Takes a free set of callback buffers, creating one only if every set
+      * is borrowed by a concurrent callback
+      * @return the borrowed buffers
+      */
+    std::unique_ptr<CallbackBuffers> borrowCallbackBuffers(void);
+
+    /** Gives back a set of callback buffers to be reused by the next callback
+      * @param[in] buffers the borrowed buffers
+      */
+    void returnCallbackBuffers(std::unique_ptr<CallbackBuffers> buffers);
+
+    /** Prepares a cloud to be overwritten, replacing it with a new one if it
+      * is missing or still shared (e.g. indexed by the particle filter)
+      * @param[in/out] cloud the cloud to be reused
+      */
+    static void reuseCloud(Cloud::Ptr& cloud) {
+        if (!cloud || cloud.use_count() > 1) cloud.reset(new Cloud);
+    }
+
+    /** Downsamples the cloud, transforms it to the map frame, crops it and
+      * calculates the variance of its points
+      * @param[in] cloud the point cloud as received from a sensor
+      * @param[in] robotPose the robot's pose when the cloud was received
+      * @param[in] bodyToSensorTF the transformation applied to the cloud
+      * @param[out] processedCloud the processed cloud
+      * @param[out] cloudVariances the variances of the processed cloud
+      * @param[in/out] buffers the buffers reused by the calling thread
+      */
+    void processCloud(
+            const Cloud::ConstPtr& cloud,
+            const Pose& robotPose,
+            const Pose& bodyToSensorTF,
+            Cloud::Ptr& processedCloud,
+            std::vector<float>& cloudVariances,
+            VoxelBuffers& buffers);
+
+    /** Fuses a processed cloud to the local map and starts the matching tasks
+      * if they are not already running
+      * @param[in/out] processedCloud the processed cloud, which is exchanged
+      *                with the cloud of the previous scan-to-map matching
+      *                when a new one is started
+      * @param[in] cloudVariances the variances of the processed cloud
+      */
+    void registerCloud(
+            Cloud::Ptr& processedCloud,
+            const std::vector<float>& cloudVariances);
+
+    /** Pops the entries of the cloud queue and registers their clouds (the
+      * clouds of a merged entry are fused to the map at once). The entries
+      * are pipelined, so an entry is preprocessed while the previous one is
+      * being fused to the map by the fusion thread, and the two alternate
+      * between two sets of buffers
+      */
+    void runRegistrationThread(void);
+
+    /** Configures the cloud queue and starts the registration and fusion
+      * threads
+      * @param[in] cloudQueueSize maximum number of pending entries
+      * @param[in] cloudQueuePolicy policy applied when the queue is full
+      */
+    void startRegistrationThread(
+            int cloudQueueSize,
+            CloudQueuePolicy cloudQueuePolicy);
+
+    /// Closes the cloud queue and joins the registration and fusion threads
+    void stopRegistrationThread(void);
+
+    /// Waits for the scan-to-map and map-to-map matching tasks (if any)
+    void waitForMatchingTasks(void);
+
+    /** Converts the local elevation map to a point cloud (or takes a snapshot
+      * of it if the elevation likelihood is used) and performs a
       * scan-to-map matching using the raw (sensor) point cloud for
       * each particle of the particle filter
       * @param[in] rawCloud the raw point cloud to be matched
@@ -182,31 +403,55 @@ class GaSlam {
       */
     void matchLocalMapToGlobalMap(void);
 
-    /** Checks if the future is ready to hold a new task's state
-      * @param[in] future the future to be checked
-      * @return true if ready
-      */
-    template<typename T>
-    bool isFutureReady(const std::future<T>& future) const {
-        if (!future.valid()) return true;
-        return (future.wait_for(std::chrono::milliseconds(0)) ==
-                std::future_status::ready);
-    }
-
   protected:
+    /// Pool of worker threads shared by the submodules (declared first so it
+    /// outlives them)
+    ThreadPool threadPool_;
+
     /// Instances of the main submodules for localization and mapping
     PoseEstimation poseEstimation_;
     PoseCorrection poseCorrection_;
     DataRegistration dataRegistration_;
 
-    /// Futures to hold the state of the scan-to-map and map-to-map matching
-    /// asynchronous tasks
-    std::future<void> scanToMapMatchingFuture_;
-    std::future<void> mapToMapMatchingFuture_;
+    /// Threads running the scan-to-map and map-to-map matching tasks and the
+    /// raw cloud handed over to the scan-to-map matching
+    TaskThread scanToMapMatchingThread_;
+    TaskThread mapToMapMatchingThread_;
+    Cloud::Ptr matchedRawCloud_;
+
+    /// Queue of the received clouds and thread registering them to the map
+    CloudQueue cloudQueue_;
+    std::thread registrationThread_;
+
+    /// Thread fusing the preprocessed clouds of the registration thread to
+    /// the map and the buffers holding the cloud being fused
+    TaskThread fusionThread_;
+    CloudBuffers* fusedBuffers_ = nullptr;
+
+    /// Mutex protecting the state of the registration thread (only held to
+    /// check it by the callbacks, which push to the queue without it)
+    std::mutex registrationMutex_;
+
+    /// Free buffers of the callbacks processing their clouds directly (one
+    /// set per concurrent callback) and mutex protecting them
+    std::vector<std::unique_ptr<CallbackBuffers>> freeCallbackBuffers_;
+    std::mutex callbackBuffersMutex_;
+
+    /// Latency counters of the preprocessing and fusion stages
+    LatencyCounter preprocessingLatency_;
+    LatencyCounter fusionLatency_;
+
+    /// Clouds converted from the local map for the scan-to-map matching, which
+    /// alternate so that the one indexed by the particle filter is not reused
+    Cloud::Ptr localMapClouds_[2];
+    size_t localMapCloudIndex_ = 0;
 
     /// Whether a pose has been received yet
     std::atomic<bool> poseInitialized_;
 
+    /// Whether to weight the particles using the elevation likelihood
+    bool useElevationLikelihood_;
+
     /// Voxel size of the downsampled point cloud after it it processed
     double voxelSize_;
 
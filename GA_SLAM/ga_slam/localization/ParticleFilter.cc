@@ -22,6 +22,7 @@
 // GA SLAM
 #include "ga_slam/TypeDefs.h"
 #include "ga_slam/processing/CloudProcessing.h"
+#include "ga_slam/processing/CloudGrid.h"
 
 // Eigen
 #include <Eigen/Core>
@@ -30,23 +31,32 @@
 // PCL
 #include <pcl/point_types.h>
 #include <pcl/point_cloud.h>
-#include <pcl/common/transforms.h>
 
 // STL
 #include <vector>
 #include <algorithm>
-#include <iterator>
+#include <utility>
 #include <random>
 #include <mutex>
 #include <limits>
+#include <cmath>
 
 namespace ga_slam {
 
 void ParticleFilter::configure(
         int numParticles,
         double initialSigmaX, double initialSigmaY, double initialSigmaYaw,
-        double predictSigmaX, double predictSigmaY, double predictSigmaYaw) {
+        double predictSigmaX, double predictSigmaY, double predictSigmaYaw,
+        double resampleThreshold,
+        int minNumParticles,
+        double kldBinSizeXY,
+        double kldBinSizeYaw) {
     numParticles_ = numParticles;
+    minNumParticles_ = (minNumParticles > 0) ?
+            std::min(minNumParticles, numParticles) : numParticles;
+    resampleThreshold_ = resampleThreshold;
+    kldBinSizeXY_ = kldBinSizeXY;
+    kldBinSizeYaw_ = kldBinSizeYaw;
     initialSigmaX_ = initialSigmaX;
     initialSigmaY_ = initialSigmaY;
     initialSigmaYaw_ = initialSigmaYaw;
@@ -55,7 +65,6 @@ void ParticleFilter::configure(
     predictSigmaYaw_ = predictSigmaYaw;
 
     std::lock_guard<std::mutex> guard(particlesMutex_);
-    particles_.clear();
     particles_.resize(numParticles_);
 }
 
@@ -65,11 +74,13 @@ void ParticleFilter::initialize(
         double initialYaw) {
     std::lock_guard<std::mutex> guard(particlesMutex_);
 
-    for (auto& particle : particles_) {
-        particle.x = sampleGaussian(initialX, initialSigmaX_);
-        particle.y = sampleGaussian(initialY, initialSigmaY_);
-        particle.yaw = sampleGaussian(initialYaw, initialSigmaYaw_);
-    }
+    particles_.x.setConstant(initialX);
+    particles_.y.setConstant(initialY);
+    particles_.yaw.setConstant(initialYaw);
+
+    addGaussianNoise(particles_.x, initialSigmaX_);
+    addGaussianNoise(particles_.y, initialSigmaY_);
+    addGaussianNoise(particles_.yaw, initialSigmaYaw_);
 }
 
 void ParticleFilter::predict(
@@ -87,37 +98,86 @@ void ParticleFilter::predict(
         sigmaYaw = predictSigmaYaw_;
     }
 
-    for (auto& particle : particles_) {
-        particle.x = sampleGaussian(particle.x + deltaX, sigmaX);
-        particle.y = sampleGaussian(particle.y + deltaY, sigmaY);
-        particle.yaw = sampleGaussian(particle.yaw + deltaYaw, sigmaYaw);
-    }
+    particles_.x += deltaX;
+    particles_.y += deltaY;
+    particles_.yaw += deltaYaw;
+
+    addGaussianNoise(particles_.x, sigmaX);
+    addGaussianNoise(particles_.y, sigmaY);
+    addGaussianNoise(particles_.yaw, sigmaYaw);
 }
 
 void ParticleFilter::update(
         const Pose& lastPose,
         const Cloud::ConstPtr& rawCloud,
         const Cloud::ConstPtr& mapCloud) {
-    if (mapCloud->empty()) return;
+    if (rawCloud->empty() || mapCloud->empty()) return;
 
-    std::unique_lock<std::mutex> guard(particlesMutex_);
-    std::vector<Particle> particlesCopy = particles_;
-    guard.unlock();
+    mapGrid_.setInputCloud(mapCloud);
+
+    updateWeights(lastPose, [&] (const Pose& deltaPose, int) {
+        const double score = CloudProcessing::calculateFitnessScore(
+                *rawCloud, deltaPose.inverse(), mapGrid_);
+
+        return -std::log(std::max(score, std::numeric_limits<double>::min()));
+    });
+}
 
-    for (auto& particle : particlesCopy) {
-        Cloud::Ptr particleCloud(new Cloud);
-        const auto deltaPose = getDeltaPoseFromParticle(particle, lastPose);
+void ParticleFilter::update(
+        const Pose& lastPose,
+        const Cloud::ConstPtr& rawCloud,
+        const MapSnapshot& mapSnapshot) {
+    if (rawCloud->empty() || !mapSnapshot.valid) return;
 
-        pcl::transformPointCloud(*mapCloud, *particleCloud, deltaPose);
-        double score = CloudProcessing::matchClouds(rawCloud, particleCloud);
+    updateWeights(lastPose, [&] (const Pose& deltaPose, int) {
+        return CloudProcessing::calculateElevationLogLikelihood(
+                *rawCloud, deltaPose.inverse(), mapSnapshot);
+    });
+}
 
-        if (score == 0.) score = std::numeric_limits<double>::min();
-        particle.weight = 1. / score;
+void ParticleFilter::updateWeights(
+        const Pose& lastPose,
+        const FunctionRef<double(const Pose&, int)>&
+                calculateLogLikelihood) {
+    std::unique_lock<std::mutex> guard(particlesMutex_);
+    particlesCopy_.x = particles_.x;
+    particlesCopy_.y = particles_.y;
+    particlesCopy_.yaw = particles_.yaw;
+    particlesCopy_.weight = particles_.weight;
+    guard.unlock();
+
+    const size_t numParticles = particlesCopy_.size();
+    auto& weights = particlesCopy_.weight;
+    logLikelihoods_.resize(numParticles);
+
+    const auto evaluateParticles = [&] (
+            size_t begin, size_t end, int threadIndex) {
+        for (size_t i = begin; i < end; ++i) {
+            const auto particle = particlesCopy_.get(i);
+            const auto deltaPose = getDeltaPoseFromParticle(particle, lastPose);
+            const double logLikelihood = calculateLogLikelihood(deltaPose,
+                    threadIndex);
+
+            logLikelihoods_(i) = std::isfinite(logLikelihood) ? logLikelihood :
+                    std::numeric_limits<double>::lowest();
+        }
+    };
+
+    if (threadPool_) {
+        constexpr size_t chunksPerThread = 4;
+        const size_t chunkSize = numParticles /
+                (chunksPerThread * threadPool_->getNumThreads());
+        threadPool_->parallelFor(numParticles, chunkSize, evaluateParticles);
+    } else {
+        evaluateParticles(0, numParticles, 0);
     }
 
+    weights = weights.log() + (logLikelihoods_ - logLikelihoods_.maxCoeff());
+    weights = (weights - weights.maxCoeff()).exp();
+    weights /= weights.sum();
+
     guard.lock();
-    for (auto i = 0; i < numParticles_; i++)
-        particles_[i].weight = particlesCopy[i].weight;
+    if (particles_.size() == numParticles) particles_.weight = weights;
     guard.unlock();
 
     weightsUpdated_ = true;
@@ -126,21 +186,55 @@ void ParticleFilter::update(
 void ParticleFilter::resample(void) {
     std::lock_guard<std::mutex> guard(particlesMutex_);
 
-    std::vector<Particle> newParticles;
-    std::vector<double> weights;
+    if (!particles_.size()) return;
+
+    size_t numSamples = numParticles_;
+
+    if (minNumParticles_ < numParticles_) {
+        sampleSystematically(numParticles_);
+        const size_t kldSampleSize = calculateKldSampleSize(
+                countOccupiedBins());
 
-    std::transform(
-            particles_.begin(), particles_.end(), std::back_inserter(weights),
-            [] (Particle particle) -> double { return particle.weight; });
+        numSamples = std::min(std::max(kldSampleSize,
+                static_cast<size_t>(minNumParticles_)), numSamples);
+    }
+
+    sampleSystematically(numSamples);
 
-    std::discrete_distribution<> distribution(weights.begin(), weights.end());
+    Eigen::Index maxIndex;
+    particles_.weight.maxCoeff(&maxIndex);
+    const size_t bestIndex = maxIndex;
+    const auto bestSample = std::lower_bound(sampledIndices_.begin(),
+            sampledIndices_.end(), bestIndex);
+    if (bestSample != sampledIndices_.end() && *bestSample == bestIndex)
+        std::iter_swap(sampledIndices_.begin(), bestSample);
 
-    for (auto i = 0; i < numParticles_; i++) {
-        const auto& newParticle = particles_[distribution(generator_)];
-        newParticles.push_back(newParticle);
+    resampledParticles_.resize(numSamples);
+
+    for (size_t i = 0; i < numSamples; i++) {
+        const size_t index = sampledIndices_[i];
+        resampledParticles_.x(i) = particles_.x(index);
+        resampledParticles_.y(i) = particles_.y(index);
+        resampledParticles_.yaw(i) = particles_.yaw(index);
     }
 
-    particles_ = newParticles;
+    resampledParticles_.weight.setConstant(1. / numSamples);
+
+    std::swap(particles_, resampledParticles_);
+}
+
+double ParticleFilter::getEffectiveSampleSize(void) const {
+    std::lock_guard<std::mutex> guard(particlesMutex_);
+
+    const double weightSum = particles_.weight.sum();
+    const double squaredWeightSum = particles_.weight.square().sum();
+    if (!(squaredWeightSum > 0.)) return 0.;
+
+    return weightSum * weightSum / squaredWeightSum;
+}
+
+bool ParticleFilter::needsResampling(void) const {
+    return getEffectiveSampleSize() < resampleThreshold_ * getNumParticles();
 }
 
 void ParticleFilter::getEstimate(
@@ -157,18 +251,109 @@ void ParticleFilter::getEstimate(
 }
 
 Particle ParticleFilter::getBestParticle(void) const {
-    auto bestParticle = particles_[0];
+    Eigen::Index bestIndex;
+    particles_.weight.maxCoeff(&bestIndex);
 
-    for (const auto& particle : particles_)
-        if (particle.weight > bestParticle.weight) bestParticle = particle;
+    return particles_.get(bestIndex);
+}
+
+void ParticleFilter::sampleGaussian(Eigen::ArrayXd& samples, double sigma) {
+    const Eigen::Index size = samples.size();
+    const Eigen::Index halfSize = (size + 1) / 2;
+
+    uniformSamples1_.resize(halfSize);
+    uniformSamples2_.resize(halfSize);
+
+    for (Eigen::Index i = 0; i < halfSize; ++i) {
+        uniformSamples1_(i) = sampleUniform();
+        uniformSamples2_(i) = sampleUniform();
+    }
+
+    uniformSamples1_ = sigma * (-2. * uniformSamples1_.log()).sqrt();
+    uniformSamples2_ *= 2. * M_PI;
+
+    samples.head(halfSize) = uniformSamples1_ * uniformSamples2_.cos();
+    samples.tail(size - halfSize) = uniformSamples1_.head(size - halfSize) *
+            uniformSamples2_.head(size - halfSize).sin();
+}
 
-    return bestParticle;
+void ParticleFilter::addGaussianNoise(Eigen::ArrayXd& values, double sigma) {
+    if (sigma == 0.) return;
+
+    noiseSamples_.resize(values.size());
+    sampleGaussian(noiseSamples_, sigma);
+    values += noiseSamples_;
 }
 
-double ParticleFilter::sampleGaussian(double mean, double sigma) {
-    std::normal_distribution<> distribution(mean, sigma);
+void ParticleFilter::sampleSystematically(size_t numSamples) {
+    const auto& weights = particles_.weight;
+    const size_t numParticles = particles_.size();
+    const double step = weights.sum() / numSamples;
+
+    double threshold = step * sampleUniform();
+    double cumulativeWeight = weights(0);
+    size_t index = 0;
+
+    sampledIndices_.resize(numSamples);
+
+    for (size_t i = 0; i < numSamples; ++i) {
+        while (threshold > cumulativeWeight && index + 1 < numParticles)
+            cumulativeWeight += weights(++index);
 
-    return distribution(generator_);
+        sampledIndices_[i] = index;
+        threshold += step;
+    }
+}
+
+size_t ParticleFilter::countOccupiedBins(void) {
+    constexpr uint64_t emptyBin = std::numeric_limits<uint64_t>::max();
+    constexpr uint64_t binMask = (1 << 21) - 1;
+
+    size_t tableSize = 1;
+    while (tableSize < 2 * sampledIndices_.size()) tableSize <<= 1;
+    occupiedBins_.assign(tableSize, emptyBin);
+
+    size_t numOccupiedBins = 0;
+    size_t lastIndex = std::numeric_limits<size_t>::max();
+
+    for (const auto& index : sampledIndices_) {
+        if (index == lastIndex) continue;
+        lastIndex = index;
+
+        const double yaw = std::remainder(particles_.yaw(index), 2. * M_PI);
+        const auto binX = static_cast<int64_t>(
+                std::floor(particles_.x(index) / kldBinSizeXY_));
+        const auto binY = static_cast<int64_t>(
+                std::floor(particles_.y(index) / kldBinSizeXY_));
+        const auto binYaw = static_cast<int64_t>(
+                std::floor(yaw / kldBinSizeYaw_));
+
+        const uint64_t bin = (static_cast<uint64_t>(binX) & binMask) |
+                ((static_cast<uint64_t>(binY) & binMask) << 21) |
+                ((static_cast<uint64_t>(binYaw) & binMask) << 42);
+
+        size_t slot = (bin * 0x9E3779B97F4A7C15ull) & (tableSize - 1);
+
+        while (occupiedBins_[slot] != emptyBin && occupiedBins_[slot] != bin)
+            slot = (slot + 1) & (tableSize - 1);
+
+        if (occupiedBins_[slot] == emptyBin) {
+            occupiedBins_[slot] = bin;
+            numOccupiedBins++;
+        }
+    }
+
+    return numOccupiedBins;
+}
+
+size_t ParticleFilter::calculateKldSampleSize(size_t numOccupiedBins) {
+    if (numOccupiedBins <= 1) return 1;
+
+    const double k = numOccupiedBins - 1;
+    const double a = 2. / (9. * k);
+    const double b = 1. - a + std::sqrt(a) * kldQuantile_;
+
+    return std::ceil(k / (2. * kldError_) * b * b * b);
 }
 
 Pose ParticleFilter::getDeltaPoseFromParticle(
@@ -189,16 +374,13 @@ Pose ParticleFilter::getDeltaPoseFromParticle(
 }
 
 Eigen::ArrayXXd ParticleFilter::getParticlesArray(void) const {
-    Eigen::ArrayXXd particlesArray(numParticles_, 4);
-
     std::lock_guard<std::mutex> guard(particlesMutex_);
 
-    for (auto i = 0; i < numParticles_; ++i)
-        particlesArray.row(i) << particles_[i].x, particles_[i].y,
-                particles_[i].yaw, particles_[i].weight;
+    Eigen::ArrayXXd particlesArray(particles_.size(), 4);
+    particlesArray << particles_.x, particles_.y, particles_.yaw,
+            particles_.weight;
 
     return particlesArray;
 }
 
 }  // namespace ga_slam
-
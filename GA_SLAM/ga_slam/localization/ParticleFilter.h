@@ -21,6 +21,11 @@
 
 // GA SLAM
 #include "ga_slam/TypeDefs.h"
+#include "ga_slam/mapping/Map.h"
+#include "ga_slam/processing/CloudProcessing.h"
+#include "ga_slam/processing/CloudGrid.h"
+#include "ga_slam/processing/ThreadPool.h"
+#include "ga_slam/processing/FunctionRef.h"
 
 // Eigen
 #include <Eigen/Core>
@@ -35,6 +40,7 @@
 #include <random>
 #include <mutex>
 #include <atomic>
+#include <cstdint>
 
 namespace ga_slam {
 
@@ -49,12 +55,53 @@ struct Particle {
     double weight = 0.;
 };
 
+/** Contains the particle population as a structure of arrays (one array per
+  * state variable), so that the steps of the filter can be vectorized
+  */
+struct ParticleArrays {
+    /// 2D positions of the particles and their orientations
+    Eigen::ArrayXd x;
+    Eigen::ArrayXd y;
+    Eigen::ArrayXd yaw;
+
+    /// Weights representing the likelihood of the particles
+    Eigen::ArrayXd weight;
+
+    /// Returns the number of particles
+    size_t size(void) const { return x.size(); }
+
+    /// Resizes the arrays (the weights are reset to be uniform)
+    void resize(size_t size) {
+        x.setZero(size);
+        y.setZero(size);
+        yaw.setZero(size);
+        weight.setConstant(size, size ? 1. / size : 0.);
+    }
+
+    /// Returns a copy of the particle at the specified index
+    Particle get(size_t index) const {
+        Particle particle;
+        particle.x = x(index);
+        particle.y = y(index);
+        particle.yaw = yaw(index);
+        particle.weight = weight(index);
+
+        return particle;
+    }
+};
+
 /** Implements the particle filter algorithm for estimating the 3-DoF pose
   * (x, y and yaw) of the robot in the continuous space.
   */
 class ParticleFilter {
   public:
-    ParticleFilter(void) : weightsUpdated_(true) {}
+    /** Instantiates the filter
+      * @param[in] threadPool the pool used to evaluate the particles in
+      *            parallel (the particles are evaluated serially if null)
+      */
+    explicit ParticleFilter(ThreadPool* threadPool = nullptr)
+            : weightsUpdated_(true),
+              threadPool_(threadPool) {}
 
     /// Delete the default copy/move constructors and operators
     ParticleFilter(const ParticleFilter&) = delete;
@@ -63,7 +110,8 @@ class ParticleFilter {
     ParticleFilter& operator=(ParticleFilter&&) = delete;
 
     /** Sets the parameters used in the filter
-      * @param[in] numParticles number of particles used
+      * @param[in] numParticles number of particles used (the maximum number
+      *            if the population size is adapted)
       * @param[in] initialSigmaX gaussian sigma of x for particle initalization
       * @param[in] initialSigmaY gaussian sigma of y for particle initalization
       * @param[in] initialSigmaYaw gaussian sigma of yaw for particle
@@ -71,11 +119,24 @@ class ParticleFilter {
       * @param[in] predictSigmaX gaussian sigma of x for particle prediction
       * @param[in] predictSigmaY gaussian sigma of y for particle prediction
       * @param[in] predictSigmaYaw gaussian sigma of yaw for particle prediction
+      * @param[in] resampleThreshold ratio of the effective sample size to the
+      *            number of particles below which resampling is needed
+      * @param[in] minNumParticles minimum number of particles kept when the
+      *            population size is adapted using KLD-sampling (a value not
+      *            smaller than numParticles keeps the size fixed)
+      * @param[in] kldBinSizeXY size in x and y of each bin of the state space
+      *            histogram used by KLD-sampling
+      * @param[in] kldBinSizeYaw size in yaw of each bin of the state space
+      *            histogram used by KLD-sampling
       */
     void configure(
             int numParticles,
             double initialSigmaX, double initialSigmaY, double initialSigmaYaw,
-            double predictSigmaX, double predictSigmaY, double predictSigmaYaw);
+            double predictSigmaX, double predictSigmaY, double predictSigmaYaw,
+            double resampleThreshold = 0.5,
+            int minNumParticles = 0,
+            double kldBinSizeXY = 0.1,
+            double kldBinSizeYaw = 0.05);
 
     /** Initializes each particle of the filter by adding gaussian noise to
       * an initial estimate
@@ -105,8 +166,14 @@ class ParticleFilter {
     /** Updates the weight of each particle of the filter by transforming a
       * raw point cloud (sensor scan) to the particle's pose and matching it to
       * the map point cloud (cloud converted using the map's elevation values).
+      * The map cloud is indexed once by a grid and each point of the
+      * (smaller) raw cloud is moved by the inverse delta pose of each particle
+      * instead, so that the searches need no buffers
       * @note the vector of particles is copied before the matching so the
       *       particles can still be predicted meanwhile
+      * @note the map cloud is indexed without being copied and a reference
+      *       to it is kept until the next update, so it must not be modified
+      *       while it is still held by the filter
       * @param[in] lastPose the last estimated pose of the filter
       * @param[in] rawCloud the raw point cloud (sensor scan)
       * @param[in] mapCloud the point cloud converted from the local map
@@ -116,12 +183,49 @@ class ParticleFilter {
             const Cloud::ConstPtr& rawCloud,
             const Cloud::ConstPtr& mapCloud);
 
-    /** Performs multinomial resampling to the particle population by creating
-      * a cummulative distribution of the particles' weights and then sampling
-      * from it
+    /** Updates the weight of each particle of the filter by transforming a
+      * raw point cloud (sensor scan) to the particle's pose and evaluating
+      * the likelihood of each point's elevation given the mean and variance
+      * of the map cell it falls into
+      * @note the map snapshot is read directly so no conversion of the map
+      *       to a point cloud or nearest neighbor search is needed
+      * @param[in] lastPose the last estimated pose of the filter
+      * @param[in] rawCloud the raw point cloud (sensor scan)
+      * @param[in] mapSnapshot the snapshot of the local map
+      */
+    void update(
+            const Pose& lastPose,
+            const Cloud::ConstPtr& rawCloud,
+            const MapSnapshot& mapSnapshot);
+
+    /** Performs systematic resampling to the particle population by walking
+      * the cumulative distribution of the particles' weights with equally
+      * spaced thresholds and a single random offset. If enabled, the size of
+      * the new population is adapted using KLD-sampling, depending on the
+      * number of state space bins the resampled particles occupy. The
+      * weights of the new population are uniform and a drawn copy of the best
+      * particle is placed first, so it stays the estimate until the next update
       */
     void resample(void);
 
+    /** Calculates the effective sample size of the population from the
+      * normalized weights of the particles
+      * @return the effective sample size
+      */
+    double getEffectiveSampleSize(void) const;
+
+    /** Checks if the effective sample size has dropped below the resampling
+      * threshold
+      * @return true if the population should be resampled
+      */
+    bool needsResampling(void) const;
+
+    /// Returns the current number of particles in the population
+    size_t getNumParticles(void) const {
+        std::lock_guard<std::mutex> guard(particlesMutex_);
+        return particles_.size();
+    }
+
     /** Calculates the current state estimate of the filter by choosing the
       * best particle
       * @param[out] estimateX the output estimate of x
@@ -140,17 +244,63 @@ class ParticleFilter {
     Eigen::ArrayXXd getParticlesArray(void) const;
 
   protected:
+    /** Evaluates the log-likelihood of each particle in a copy of the
+      * population, adds it to the particle's log-weight and writes the
+      * weights (normalized to sum to one) back, so that the evidence of the
+      * updates between two resampling steps is accumulated. The particles
+      * are split in chunks which are evaluated by the thread pool
+      * @param[in] lastPose the last estimated pose of the filter
+      * @param[in] calculateLogLikelihood the function returning the
+      *            log-likelihood of a particle given its delta pose from the
+      *            last pose and the index of the evaluating thread
+      */
+    void updateWeights(
+            const Pose& lastPose,
+            const FunctionRef<double(const Pose&, int)>&
+                    calculateLogLikelihood);
+
     /** Returns the particle with highest weight in the population
       * @return the best particle
       */
     Particle getBestParticle(void) const;
 
-    /** Creates a gaussian distribution and samples one value from it
-      * @param[in] mean the mean value of the distribution
+    /** Draws indices of the population using systematic sampling
+      * @param[in] numSamples the number of indices to be drawn
+      */
+    void sampleSystematically(size_t numSamples);
+
+    /** Counts the number of bins of the state space histogram occupied by the
+      * particles of the drawn indices
+      * @return the number of occupied bins
+      */
+    size_t countOccupiedBins(void);
+
+    /** Calculates the number of particles needed so that the KL divergence
+      * between the sampled and the true distribution stays below the error
+      * bound with the configured probability (Fox, 2003)
+      * @param[in] numOccupiedBins the number of occupied histogram bins
+      * @return the required number of particles
+      */
+    static size_t calculateKldSampleSize(size_t numOccupiedBins);
+
+    /// Returns a uniform sample in the open interval (0, 1)
+    double sampleUniform(void) {
+        constexpr double uniformScale = 1. / 4294967296.;  // 2^-32
+        return (generator_() + 0.5) * uniformScale;
+    }
+
+    /** Fills an array with samples of a zero-mean gaussian distribution using
+      * the Box-Muller transform on pairs of uniform samples
+      * @param[out] samples the array to be filled (its size is kept)
       * @param[in] sigma the sigma of the distribution
-      * @return the sampled value
       */
-    double sampleGaussian(double mean, double sigma);
+    void sampleGaussian(Eigen::ArrayXd& samples, double sigma);
+
+    /** Adds zero-mean gaussian noise to each value of an array
+      * @param[in/out] values the array the noise is added to
+      * @param[in] sigma the sigma of the noise (no noise is added if zero)
+      */
+    void addGaussianNoise(Eigen::ArrayXd& values, double sigma);
 
     /** Calclulates the delta pose between a particle and a specific pose
       * @param[in] particle the particle to calculate the delta pose from
@@ -163,7 +313,16 @@ class ParticleFilter {
 
   protected:
     /// Particle population
-    std::vector<Particle> particles_;
+    ParticleArrays particles_;
+
+    /// Copy of the population evaluated during the update step
+    ParticleArrays particlesCopy_;
+
+    /// Log-likelihoods of the particles evaluated during the update step
+    Eigen::ArrayXd logLikelihoods_;
+
+    /// Population drawn during the resample step
+    ParticleArrays resampledParticles_;
 
     /// Mutex protecting the particles
     mutable std::mutex particlesMutex_;
@@ -171,12 +330,48 @@ class ParticleFilter {
     /// Whether an update step was executed in the last iteration
     std::atomic<bool> weightsUpdated_;
 
+    /// Pool of threads evaluating the particles (may be null)
+    ThreadPool* threadPool_;
+
+    /// Grid indexing the latest map cloud (which it holds until the next
+    /// update), whose buffers are kept between the updates
+    CloudGrid mapGrid_;
+
     /// Random engine generator for sampling from distributions
-    std::default_random_engine generator_;
+    std::mt19937 generator_;
+
+    /// Buffers holding the gaussian noise and the uniform samples it is
+    /// generated from
+    Eigen::ArrayXd noiseSamples_;
+    Eigen::ArrayXd uniformSamples1_;
+    Eigen::ArrayXd uniformSamples2_;
+
+    /// Indices of the population drawn during the resample step
+    std::vector<size_t> sampledIndices_;
 
-    /// Number of particles in the population
+    /// Open addressing hash table holding the occupied histogram bins
+    std::vector<uint64_t> occupiedBins_;
+
+    /// Number of particles in the population (the maximum number if the
+    /// population size is adapted)
     int numParticles_;
 
+    /// Minimum number of particles if the population size is adapted
+    int minNumParticles_;
+
+    /// Ratio of the effective sample size to the number of particles below
+    /// which resampling is needed
+    double resampleThreshold_;
+
+    /// Size of each bin of the state space histogram used by KLD-sampling
+    double kldBinSizeXY_;
+    double kldBinSizeYaw_;
+
+    /// Error bound and standard normal quantile (for 99% probability) of the
+    /// KLD-sampling
+    static constexpr double kldError_ = 0.05;
+    static constexpr double kldQuantile_ = 2.326;
+
     /// Sigma of gaussian noise added to each particle during initialization
     double initialSigmaX_;
     double initialSigmaY_;
@@ -38,7 +38,11 @@
 
 // STL
 #include <mutex>
+#include <memory>
+#include <string>
 #include <cmath>
+#include <limits>
+#include <algorithm>
 #include <vector>
 
 namespace ga_slam {
@@ -52,7 +56,12 @@ void PoseCorrection::configure(
         double matchYawRange,
         double matchYawStep,
         double globalMapLength,
-        double globalMapResolution) {
+        double globalMapResolution,
+        int matchPyramidLevels,
+        int matchNumCandidates,
+        double matchSearchRadius,
+        bool matchYawFourierMellin,
+        int matchMinOverlap) {
     traversedDistanceThreshold_ = traversedDistanceThreshold;
     minSlopeThreshold_ = minSlopeThreshold;
     slopeSumThresholdMultiplier_ = slopeSumThresholdMultiplier;
@@ -60,24 +69,128 @@ void PoseCorrection::configure(
     matchYaw_ = matchYaw;
     matchYawRange_ = matchYawRange;
     matchYawStep_ = matchYawStep;
+    matchPyramidLevels_ = matchPyramidLevels;
+    matchNumCandidates_ = matchNumCandidates;
+    matchSearchRadius_ = matchSearchRadius;
+    matchYawFourierMellin_ = matchYawFourierMellin;
+    matchMinOverlap_ = matchMinOverlap;
 
-    globalDataRegistration_.configure(globalMapLength, globalMapResolution);
+    // The global map is only matched against, so it needs neither slopes,
+    // snapshots, a pyramid nor the tracking of its changes
+    constexpr double globalMinElevation = -std::numeric_limits<double>::max();
+    constexpr double globalMaxElevation = std::numeric_limits<double>::max();
+    constexpr double globalMinSlopeThreshold = 0.;
+    constexpr bool publishGlobalSnapshots = false;
+    constexpr int numGlobalPyramidLevels = 0;
+    constexpr bool trackGlobalChanges = false;
+
+    globalDataRegistration_.configure(globalMapLength, globalMapResolution,
+            globalMinElevation, globalMaxElevation, globalMinSlopeThreshold,
+            publishGlobalSnapshots, numGlobalPyramidLevels,
+            trackGlobalChanges);
 }
 
 void PoseCorrection::createGlobalMap(
             const Cloud::ConstPtr& globalCloud,
             const Pose& globalCloudPose) {
-    constexpr float globalCloudVariance = 1.f;
-    std::vector<float> globalCloudVariances;
-    globalCloudVariances.resize(globalCloud->size(), globalCloudVariance);
+    beginGlobalMap();
+    addGlobalCloud(globalCloud);
+    finishGlobalMap(globalCloudPose);
+}
 
+void PoseCorrection::beginGlobalMap(void) {
     globalDataRegistration_.clear();
     globalDataRegistration_.translateMap(Pose::Identity(), true);
-    globalDataRegistration_.updateMap(globalCloud, globalCloudVariances);
+}
+
+void PoseCorrection::addGlobalCloud(const Cloud::ConstPtr& globalCloudChunk) {
+    constexpr float globalCloudVariance = 1.f;
+    globalCloudVariances_.assign(globalCloudChunk->size(), globalCloudVariance);
+
+    globalDataRegistration_.updateMap(globalCloudChunk, globalCloudVariances_);
+}
+
+void PoseCorrection::finishGlobalMap(const Pose& globalCloudPose) {
+    tiledGlobalMap_.close();
+    std::atomic_store(&tiledMapCache_,
+            std::shared_ptr<const GlobalMapCache>());
     globalDataRegistration_.translateMap(globalCloudPose, true);
 
-    globalMapPose_ = globalCloudPose;
-    globalMapInitialized_ = true;
+    std::shared_ptr<GlobalMapCache> globalMapCache(new GlobalMapCache);
+    globalMapCache->pose = globalCloudPose;
+
+    std::unique_lock<std::mutex> guard(getGlobalMapMutex());
+    const auto& globalMap = getGlobalMap();
+    globalMapCache->resolution = globalMap.getParameters().resolution;
+    ImageProcessing::convertMapToImage(globalMap, globalMapCache->elevation);
+    guard.unlock();
+
+    buildGlobalMapCache(*globalMapCache);
+
+    globalMapCache->version = ++globalMapVersion_;
+    std::atomic_store(&globalMapCache_,
+            std::shared_ptr<const GlobalMapCache>(globalMapCache));
+}
+
+bool PoseCorrection::openTiledGlobalMap(
+        const std::string& filename,
+        int maxResidentTiles,
+        double searchLength) {
+    if (!tiledGlobalMap_.open(filename, maxResidentTiles)) return false;
+
+    tiledMapSearchLength_ = searchLength;
+    ++globalMapVersion_;
+
+    return true;
+}
+
+void PoseCorrection::buildGlobalMapCache(
+        GlobalMapCache& globalMapCache) const {
+    Image gradient;
+    ImageProcessing::calculateGradientImage(globalMapCache.elevation,
+            gradient);
+    ImageProcessing::prepareMatchingImage(gradient, globalMapCache.gradient,
+            false);
+
+    if (matchMinOverlap_ > 0)
+        ImageProcessing::prepareMaskedMatchingImage(gradient,
+                globalMapCache.maskedGradient);
+}
+
+std::shared_ptr<const GlobalMapCache> PoseCorrection::extractTiledGlobalMap(
+        const Pose& currentPose,
+        double localMapLength) {
+    const Eigen::Vector3d currentXYZ = currentPose.translation();
+    const double searchLength = tiledMapSearchLength_;
+    auto tiledMapCache = std::atomic_load(&tiledMapCache_);
+
+    if (tiledMapCache && tiledMapCache->version == globalMapVersion_) {
+        const double searchRoom = searchLength - localMapLength -
+                2. * std::max(matchSearchRadius_, 0.);
+        const double margin = std::max(searchRoom, 0.) / 4.;
+        const Eigen::Vector2d offsetXY = currentXYZ.head(2) -
+                tiledMapCache->pose.translation().head(2);
+
+        if (offsetXY.cwiseAbs().maxCoeff() <= margin) return tiledMapCache;
+    }
+
+    std::shared_ptr<GlobalMapCache> globalMapCache(new GlobalMapCache);
+    globalMapCache->version = globalMapVersion_;
+    globalMapCache->resolution = tiledGlobalMap_.getHeader().resolution;
+
+    const int size = std::ceil(searchLength /
+            globalMapCache->resolution);
+    double centerX, centerY;
+
+    tiledGlobalMap_.extractImage(currentXYZ.x(), currentXYZ.y(), size,
+            globalMapCache->elevation, centerX, centerY);
+    globalMapCache->pose = Eigen::Translation3d(centerX, centerY, 0.);
+
+    buildGlobalMapCache(*globalMapCache);
+    tiledMapCache = globalMapCache;
+    std::atomic_store(&tiledMapCache_, tiledMapCache);
+
+    return tiledMapCache;
 }
 
 bool PoseCorrection::distanceCriterionFulfilled(const Pose& pose) const {
@@ -96,45 +209,121 @@ bool PoseCorrection::featureCriterionFulfilled(const Map& localMap) const {
 
     const double slopeSum = cv::sum(image)[0];
     const double resolution = localMap.getParameters().resolution;
+
+    return featureCriterionFulfilled(slopeSum, resolution);
+}
+
+bool PoseCorrection::featureCriterionFulfilled(
+        double slopeSum,
+        double resolution) const {
     const double slopeSumThreshold = slopeSumThresholdMultiplier_ / resolution;
 
     return slopeSum >= slopeSumThreshold;
 }
 
 bool PoseCorrection::matchMaps(
-        const Map& localMap,
+        const MapSnapshot& localMap,
         const Pose& currentPose,
         Pose& correctionDeltaPose) {
-    if (!globalMapInitialized_) return false;
+    Eigen::Matrix3d correctionCovariance;
 
-    Image localImage, globalImage;
-    ImageProcessing::convertMapToImage(localMap, localImage);
-    const double localMapResolution = localMap.getParameters().resolution;
+    return matchMaps(localMap, currentPose, correctionDeltaPose,
+            correctionCovariance);
+}
 
-    std::unique_lock<std::mutex> guard(getGlobalMapMutex());
-    const auto& globalMap = getGlobalMap();
-    ImageProcessing::convertMapToImage(globalMap, globalImage);
-    const double globalMapResolution = globalMap.getParameters().resolution;
-    guard.unlock();
+bool PoseCorrection::matchMaps(
+        const MapSnapshot& localMap,
+        const Pose& currentPose,
+        Pose& correctionDeltaPose,
+        Eigen::Matrix3d& correctionCovariance) {
+    const auto globalMapCache = tiledGlobalMap_.isOpen() ?
+            extractTiledGlobalMap(currentPose, localMap.parameters.length) :
+            getGlobalMapCache();
+    if (!globalMapCache) return false;
+
+    const double globalMapResolution = globalMapCache->resolution;
+    const Image& globalImage = globalMapCache->gradient.image;
+
+    const MapSnapshot* localLevel = &localMap;
+    for (const auto& level : localMap.pyramid)
+        if (level.parameters.resolution <= globalMapResolution * (1. + 1e-6))
+            localLevel = &level;
+
+    Image localImage;
+    ImageProcessing::convertMapToImage(*localLevel, localImage);
+    const double localMapResolution = localLevel->parameters.resolution;
 
     const double resolutionRatio = localMapResolution / globalMapResolution;
-    cv::resize(localImage, localImage, cv::Size(), resolutionRatio,
-            resolutionRatio, cv::INTER_NEAREST);
+    if (std::abs(resolutionRatio - 1.) > 1e-6)
+        cv::resize(localImage, localImage, cv::Size(), resolutionRatio,
+                resolutionRatio, cv::INTER_NEAREST);
 
     cv::Point3d matchedPosition;
-    const bool matchFound = ImageProcessing::findBestMatch(globalImage,
-            localImage, matchedPosition, matchAcceptanceThreshold_,
-            matchYaw_, matchYawRange_, matchYawStep_);
+    bool matchFound;
+
+    Image localGradientImage;
+    ImageProcessing::calculateGradientImage(localImage, localGradientImage);
+
+    if (matchSearchRadius_ > 0.)
+        matchFound = matchMapsInWindow(*globalMapCache, localImage,
+                currentPose, matchedPosition);
+    else if (matchYaw_ && matchYawFourierMellin_)
+        matchFound = ImageProcessing::findBestMatchFourierMellin(globalImage,
+                localGradientImage, matchedPosition, matchAcceptanceThreshold_,
+                matchYawRange_, false);
+    else if (matchPyramidLevels_ > 0)
+        matchFound = ImageProcessing::findBestMatchPyramid(globalImage,
+                localGradientImage, matchedPosition, matchAcceptanceThreshold_,
+                matchPyramidLevels_, matchNumCandidates_, matchYaw_,
+                matchYawRange_, matchYawStep_, false, threadPool_);
+    else if (matchMinOverlap_ > 0)
+        matchFound = matchMapsMasked(*globalMapCache, localGradientImage,
+                matchedPosition);
+    else
+        matchFound = ImageProcessing::findBestMatch(globalImage,
+                localGradientImage, matchedPosition, matchAcceptanceThreshold_,
+                matchYaw_, matchYawRange_, matchYawStep_, false, true,
+                threadPool_);
 
     if (matchFound) {
+        Image localMatchingImage;
+        ImageProcessing::prepareMatchingImage(localGradientImage,
+                localMatchingImage, false);
+
+        cv::Matx33d covariance;
+        if (!ImageProcessing::refineMatch(globalImage, localMatchingImage,
+                matchedPosition, covariance, matchYaw_, matchYawStep_)) {
+            constexpr double quantizationVariance = 1. / 12.;
+            covariance = cv::Matx33d::diag(cv::Vec3d(quantizationVariance,
+                    quantizationVariance, matchYaw_ ? quantizationVariance *
+                    matchYawStep_ * matchYawStep_ : 0.));
+        }
+
+        const double resolutionSquared = globalMapResolution *
+                globalMapResolution;
+        correctionCovariance <<
+                covariance(1, 1) * resolutionSquared,
+                covariance(0, 1) * resolutionSquared, 0.,
+                covariance(0, 1) * resolutionSquared,
+                covariance(0, 0) * resolutionSquared, 0.,
+                0., 0., covariance(2, 2);
+
+        matchedPosition.x += localImage.cols / 2.;
+        matchedPosition.y += localImage.rows / 2.;
         ImageProcessing::convertPositionToMapCoordinates(matchedPosition,
                 globalImage, globalMapResolution);
 
-        const Eigen::Vector2d mapXY = globalMapPose_.translation().head(2);
+        const Eigen::Vector2d mapXY =
+                globalMapCache->pose.translation().head(2);
         const Eigen::Vector2d currentXY = currentPose.translation().head(2);
+        const double levelOffsetX = localLevel->parameters.positionX -
+                localMap.parameters.positionX;
+        const double levelOffsetY = localLevel->parameters.positionY -
+                localMap.parameters.positionY;
         correctionDeltaPose = Eigen::Translation3d(
-                mapXY.x() + matchedPosition.x - currentXY.x(),
-                mapXY.y() + matchedPosition.y - currentXY.y(), 0.);
+                mapXY.x() + matchedPosition.x - levelOffsetX - currentXY.x(),
+                mapXY.y() + matchedPosition.y - levelOffsetY - currentXY.y(),
+                0.);
 
         lastCorrectedPose_ = currentPose * correctionDeltaPose;
     }
@@ -142,5 +331,55 @@ bool PoseCorrection::matchMaps(
     return matchFound;
 }
 
-}  // namespace ga_slam
+bool PoseCorrection::matchMapsInWindow(
+        const GlobalMapCache& globalMapCache,
+        const Image& localImage,
+        const Pose& currentPose,
+        cv::Point3d& matchedPosition) const {
+    const MatchingImage& globalImage = globalMapCache.gradient;
+    const double globalMapResolution = globalMapCache.resolution;
+
+    const Eigen::Vector2d mapXY = globalMapCache.pose.translation().head(2);
+    const Eigen::Vector2d relativeXY =
+            currentPose.translation().head(2) - mapXY;
+
+    const int predictedX = std::round(std::round(globalImage.image.cols / 2.) -
+            relativeXY.y() / globalMapResolution - localImage.cols / 2.);
+    const int predictedY = std::round(std::round(globalImage.image.rows / 2.) -
+            relativeXY.x() / globalMapResolution - localImage.rows / 2.);
+    const int radius = std::ceil(matchSearchRadius_ / globalMapResolution);
+
+    const cv::Rect window(predictedX - radius, predictedY - radius,
+            2 * radius + 1, 2 * radius + 1);
+
+    return ImageProcessing::findBestMatchInWindow(globalImage, localImage,
+            window, matchedPosition, matchAcceptanceThreshold_,
+            matchYaw_, matchYawRange_, matchYawStep_, true, threadPool_);
+}
+
+bool PoseCorrection::matchMapsMasked(
+        const GlobalMapCache& globalMapCache,
+        const Image& localGradientImage,
+        cv::Point3d& matchedPosition) const {
+    double matchScore;
+    int matchOverlap;
+
+    const MaskedMatchingImage* globalImage = &globalMapCache.maskedGradient;
+    MaskedMatchingImage preparedGlobalImage;
+
+    if (globalImage->values.empty()) {
+        Image globalGradient;
+        ImageProcessing::calculateGradientImage(globalMapCache.elevation,
+                globalGradient);
+        ImageProcessing::prepareMaskedMatchingImage(globalGradient,
+                preparedGlobalImage);
+        globalImage = &preparedGlobalImage;
+    }
+
+    return ImageProcessing::findBestMatchMasked(*globalImage,
+            localGradientImage, matchedPosition, matchScore, matchOverlap,
+            matchAcceptanceThreshold_, matchMinOverlap_, matchYaw_,
+            matchYawRange_, matchYawStep_, threadPool_);
+}
 
+}  // namespace ga_slam
@@ -23,6 +23,9 @@
 #include "ga_slam/TypeDefs.h"
 #include "ga_slam/mapping/Map.h"
 #include "ga_slam/mapping/DataRegistration.h"
+#include "ga_slam/mapping/TiledMap.h"
+#include "ga_slam/processing/ThreadPool.h"
+#include "ga_slam/processing/ImageProcessing.h"
 
 // Eigen
 #include <Eigen/Geometry>
@@ -34,19 +37,55 @@
 // STL
 #include <mutex>
 #include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
 
 namespace ga_slam {
 
+/// Images of the global map cached for the map matching. They are built once
+/// per global map and are shared read-only with the matching afterwards
+struct GlobalMapCache {
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+    /// Version of the global map the images were built from
+    unsigned int version;
+
+    /// Pose corresponding to the center of the global map
+    Pose pose;
+
+    /// Resolution of the global map in meters
+    double resolution;
+
+    /// Elevation image of the global map (NaN where the map is unknown)
+    Image elevation;
+
+    /// Gradient image prepared for the masked matching (only built if the
+    /// masked matching is enabled)
+    MaskedMatchingImage maskedGradient;
+
+    /// Gradient image prepared for matching along with its squared integral.
+    /// It is the only integral kept: the local map's elevations are relative
+    /// to the robot, so the matching always correlates gradients, and the
+    /// normalized correlation needs only the norm of each window
+    MatchingImage gradient;
+};
+
 /** Module responsible for storing a pre-calculated row-resolution elevation
   * global map and using it to correct the increasing drift of the localization.
   */
 class PoseCorrection {
   public:
-    /// Instantiates the global elevation map
-    PoseCorrection(void)
-        : globalMapInitialized_(false),
-          globalMapPose_(Pose::Identity()),
-          lastCorrectedPose_(Pose::Identity()) {}
+    /** Instantiates the global elevation map
+      * @param[in] threadPool the pool used to evaluate the yaw hypotheses of
+      *            the map matching in parallel (if null, they are evaluated
+      *            serially)
+      */
+    explicit PoseCorrection(ThreadPool* threadPool = nullptr)
+        : globalMapVersion_(0),
+          lastCorrectedPose_(Pose::Identity()),
+          tiledMapSearchLength_(0.),
+          threadPool_(threadPool) {}
 
     /// Delete the default copy/move constructors and operators
     PoseCorrection(const PoseCorrection&) = delete;
@@ -62,6 +101,14 @@ class PoseCorrection {
     std::mutex& getGlobalMapMutex(void) {
         return globalDataRegistration_.getMapMutex(); };
 
+    /// Returns the version of the global map, increased on every creation
+    unsigned int getGlobalMapVersion(void) const { return globalMapVersion_; }
+
+    /// Returns the cached images of the latest global map (null if the global
+    /// map has not been created yet)
+    std::shared_ptr<const GlobalMapCache> getGlobalMapCache(void) const {
+        return std::atomic_load(&globalMapCache_); }
+
     /** Configures the global map and sets the module's parameters
       * @param[in] traversedDistanceThreshold the distance the robot must
       *            traverse before a new pose correction
@@ -81,6 +128,22 @@ class PoseCorrection {
       * @param[in] globalMapLength the size of one dimension of the global map
       * @param[in] globalMapResolution the resolution of the global map
       *            in meters
+      * @param[in] matchPyramidLevels the maximum number of pyramid levels of
+      *            the coarse-to-fine template matching (non-positive to match
+      *            exhaustively at the native resolution)
+      * @param[in] matchNumCandidates the number of candidates of the coarsest
+      *            pyramid level that are refined
+      * @param[in] matchSearchRadius the radius in meters around the predicted
+      *            position within which the local map is searched in the
+      *            global map (non-positive to search the whole global map)
+      * @param[in] matchYawFourierMellin whether to estimate the yaw from the
+      *            maps' spectra and match the translation once, instead of
+      *            searching the translation for every yaw step (ignored by
+      *            the windowed matching)
+      * @param[in] matchMinOverlap the minimum number of cells known in both
+      *            maps for the masked matching, in which the unknown cells do
+      *            not contribute to the score (non-positive to match the
+      *            zero-filled maps)
       */
     void configure(
             double traversedDistanceThreshold,
@@ -91,10 +154,17 @@ class PoseCorrection {
             double matchYawRange,
             double matchYawStep,
             double globalMapLength,
-            double globalMapResolution);
+            double globalMapResolution,
+            int matchPyramidLevels = 0,
+            int matchNumCandidates = 3,
+            double matchSearchRadius = 0.,
+            bool matchYawFourierMellin = false,
+            int matchMinOverlap = 0);
 
     /** Creates the global map by registering the global point cloud and
-      * translating it to its corresponding pose
+      * translating it to its corresponding pose. The images of the global map
+      * used by the matching are then built once and replace the cached ones.
+      * An open tiled global map is closed
       * @param[in] globalCloud the global point cloud to be registered
       * @param[in] globalCloudPose the pose corresponding to the point cloud
       */
@@ -102,6 +172,40 @@ class PoseCorrection {
             const Cloud::ConstPtr& globalCloud,
             const Pose& globalCloudPose);
 
+    /** Starts creating a global map from a global point cloud received in
+      * chunks, clearing the global map being built. The cached images are
+      * kept until the global map is finished
+      */
+    void beginGlobalMap(void);
+
+    /** Registers a chunk of the global point cloud to the global map being
+      * built, so that the chunk can be released right after
+      * @param[in] globalCloudChunk the chunk of the global point cloud
+      */
+    void addGlobalCloud(const Cloud::ConstPtr& globalCloudChunk);
+
+    /** Finishes the global map being built by translating it to the pose of
+      * the global point cloud and replacing the cached images with its own
+      * @param[in] globalCloudPose the pose corresponding to the point cloud
+      */
+    void finishGlobalMap(const Pose& globalCloudPose);
+
+    /** Opens a tiled global map file to be used instead of the created global
+      * map. Only the tiles around the current pose are mapped in memory when
+      * the maps are matched, so the memory used is bounded by the maximum
+      * number of resident tiles regardless of the size of the global map
+      * @param[in] filename the path of the tiled map file
+      * @param[in] maxResidentTiles the maximum number of mapped tiles
+      * @param[in] searchLength the size of one dimension of the square
+      *            region of the global map around the current pose, in which
+      *            the local map is searched (must exceed the local map)
+      * @return true if the file is a valid tiled map
+      */
+    bool openTiledGlobalMap(
+            const std::string& filename,
+            int maxResidentTiles,
+            double searchLength);
+
     /** Checks if the robot has traversed enough distance before a new pose
       * correction can be applied
       * @param[in] pose the current robot's pose
@@ -116,27 +220,105 @@ class PoseCorrection {
       */
     bool featureCriterionFulfilled(const Map& localMap) const;
 
+    /** Checks the feature criterion using a slope sum that is maintained
+      * together with the local map, without processing the map itself
+      * @param[in] slopeSum the sum of the slopes of the local map's cells
+      *            that are steeper than the minimum slope threshold
+      * @param[in] resolution the resolution of the local map
+      * @return true if the criterion is fulfilled
+      */
+    bool featureCriterionFulfilled(double slopeSum, double resolution) const;
+
     /** Matches the local and global maps and corrects the pose if a match
-      * is found
-      * @param[in] localMap the current robot's map to be matched
+      * is found. The coarsest pyramid level of the local map that is not
+      * coarser than the global map is matched, so that the local map only
+      * needs to be resampled if no level has the global map's resolution
+      * @param[in] localMap the snapshot of the current robot's map to be
+      *            matched
       * @param[in] currentPose the current robot's pose
       * @param[out] correctionDeltaPose the delta needed to correct the pose
       * @return true if a match was found
       */
     bool matchMaps(
-            const Map& localMap,
+            const MapSnapshot& localMap,
             const Pose& currentPose,
             Pose& correctionDeltaPose);
 
+    /** Matches the local and global maps like the overloaded function and
+      * also estimates the covariance of the correction. The match is refined
+      * to a fraction of the global map's resolution and yaw step, so that a
+      * coarse global map can be used without quantizing the correction
+      * @param[in] localMap the snapshot of the current robot's map to be
+      *            matched
+      * @param[in] currentPose the current robot's pose
+      * @param[out] correctionDeltaPose the delta needed to correct the pose
+      * @param[out] correctionCovariance the covariance of the correction in
+      *             x, y (meters) and yaw (radians)
+      * @return true if a match was found
+      */
+    bool matchMaps(
+            const MapSnapshot& localMap,
+            const Pose& currentPose,
+            Pose& correctionDeltaPose,
+            Eigen::Matrix3d& correctionCovariance);
+
+  protected:
+    /** Builds the images used by the matching from the elevation image of
+      * the global map cache
+      * @param[in,out] globalMapCache the cache with the elevation image set
+      */
+    void buildGlobalMapCache(GlobalMapCache& globalMapCache) const;
+
+    /** Extracts the region of the tiled global map around the current pose
+      * and builds its images for the matching. The last extracted region is
+      * reused while the pose stays within a margin of its center (a quarter
+      * of the room the region leaves around the searched local map) and the
+      * global map has not changed
+      * @param[in] currentPose the current robot's pose
+      * @param[in] localMapLength the size of one dimension of the local map
+      * @return the cached images of the region
+      */
+    std::shared_ptr<const GlobalMapCache> extractTiledGlobalMap(
+            const Pose& currentPose,
+            double localMapLength);
+
+    /** Matches the local map's image within a window of the prepared global
+      * image around the position predicted by the current pose
+      * @param[in] globalMapCache the cached images of the global map
+      * @param[in] localImage the image of the local map resized to the
+      *            resolution of the global map
+      * @param[in] currentPose the current robot's pose
+      * @param[out] matchedPosition the matched position in the global image
+      * @return true if a match was found
+      */
+    bool matchMapsInWindow(
+            const GlobalMapCache& globalMapCache,
+            const Image& localImage,
+            const Pose& currentPose,
+            cv::Point3d& matchedPosition) const;
+
+    /** Matches the local map's gradient image with the global one using only
+      * the cells that are known in both maps
+      * @param[in] globalMapCache the cached images of the global map
+      * @param[in] localGradientImage the gradient image of the local map
+      *            resized to the resolution of the global map
+      * @param[out] matchedPosition the matched position in the global image
+      * @return true if a match was found
+      */
+    bool matchMapsMasked(
+            const GlobalMapCache& globalMapCache,
+            const Image& localGradientImage,
+            cv::Point3d& matchedPosition) const;
+
   protected:
     /// Data registration instance to hold and manipulate the global map
     DataRegistration globalDataRegistration_;
 
-    /// Whether the global map has been initialized
-    std::atomic<bool> globalMapInitialized_;
+    /// Version of the global map, increased on every creation
+    std::atomic<unsigned int> globalMapVersion_;
 
-    /// Pose corresponding to the center of the global map
-    Pose globalMapPose_;
+    /// Variances of the points of the latest global cloud chunk
+    std::vector<float> globalCloudVariances_;
 
     /// Last pose when a correction happened
     Pose lastCorrectedPose_;
@@ -162,6 +344,38 @@ class PoseCorrection {
 
     /// Scan step of yaw angle in radians for the template matching
     double matchYawStep_;
+
+    /// Maximum number of pyramid levels of the template matching
+    int matchPyramidLevels_;
+
+    /// Number of coarse candidates refined by the template matching
+    int matchNumCandidates_;
+
+    /// Radius in meters of the searched window around the predicted position
+    double matchSearchRadius_;
+
+    /// Whether to estimate the yaw from the spectra of the maps
+    bool matchYawFourierMellin_;
+
+    /// Minimum number of cells known in both maps for the masked matching
+    int matchMinOverlap_;
+
+    /// Cached images of the global map (replaced atomically as a whole when
+    /// a new global map is created, so matching never locks the global map)
+    std::shared_ptr<const GlobalMapCache> globalMapCache_;
+
+    /// Tiled global map used instead of the created one while open
+    TiledMap tiledGlobalMap_;
+
+    /// Size of the region of the tiled global map searched for the local map
+    std::atomic<double> tiledMapSearchLength_;
+
+    /// Cached images of the last region extracted from the tiled global map
+    /// (replaced atomically, as it is reset when a new global map is created)
+    std::shared_ptr<const GlobalMapCache> tiledMapCache_;
+
+    /// Pool of threads used to evaluate the yaw hypotheses (not owned)
+    ThreadPool* threadPool_;
 };
 
 }  // namespace ga_slam
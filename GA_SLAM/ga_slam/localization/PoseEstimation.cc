@@ -21,6 +21,7 @@
 
 // GA SLAM
 #include "ga_slam/TypeDefs.h"
+#include "ga_slam/mapping/Map.h"
 #include "ga_slam/processing/CloudProcessing.h"
 
 // Eigen
@@ -40,9 +41,11 @@ namespace ga_slam {
 
 void PoseEstimation::configure(int numParticles, int resampleFrequency,
         double initialSigmaX, double initialSigmaY, double initialSigmaYaw,
-        double predictSigmaX, double predictSigmaY, double predictSigmaYaw) {
+        double predictSigmaX, double predictSigmaY, double predictSigmaYaw,
+        double resampleThreshold, int minNumParticles) {
     particleFilter_.configure(numParticles, initialSigmaX, initialSigmaY,
-            initialSigmaYaw, predictSigmaX, predictSigmaY, predictSigmaYaw);
+            initialSigmaYaw, predictSigmaX, predictSigmaY, predictSigmaYaw,
+            resampleThreshold, minNumParticles);
     particleFilter_.initialize();
 
     resampleFrequency_ = resampleFrequency;
@@ -65,7 +68,7 @@ void PoseEstimation::predictPose(const Pose& deltaPose) {
     const Pose finalPoseEstimate = createPose(translation, angles);
 
     std::lock_guard<std::mutex> guard(poseMutex_);
-    pose_ = finalPoseEstimate;
+    pose_.store(finalPoseEstimate);
 }
 
 void PoseEstimation::fuseImuOrientation(const Pose& imuOrientation) {
@@ -74,7 +77,7 @@ void PoseEstimation::fuseImuOrientation(const Pose& imuOrientation) {
     const Pose newPoseEstimate = createPose(translation, angles);
 
     std::lock_guard<std::mutex> guard(poseMutex_);
-    pose_ = newPoseEstimate;
+    pose_.store(newPoseEstimate);
 }
 
 void PoseEstimation::filterPose(
@@ -83,8 +86,24 @@ void PoseEstimation::filterPose(
     const Pose lastPose = getPose();
     particleFilter_.update(lastPose, rawCloud, mapCloud);
 
+    resampleParticles();
+}
+
+void PoseEstimation::filterPose(
+        const Cloud::ConstPtr& rawCloud,
+        const MapSnapshot& mapSnapshot) {
+    const Pose lastPose = getPose();
+    particleFilter_.update(lastPose, rawCloud, mapSnapshot);
+
+    resampleParticles();
+}
+
+void PoseEstimation::resampleParticles(void) {
     resampleCounter_++;
-    if (resampleCounter_ != resampleFrequency_) return;
+
+    const bool counterExpired = resampleFrequency_ > 0 &&
+            resampleCounter_ >= resampleFrequency_;
+    if (!counterExpired && !particleFilter_.needsResampling()) return;
 
     particleFilter_.resample();
     resampleCounter_ = 0;
@@ -21,7 +21,10 @@
 
 // GA SLAM
 #include "ga_slam/TypeDefs.h"
+#include "ga_slam/mapping/Map.h"
 #include "ga_slam/localization/ParticleFilter.h"
+#include "ga_slam/processing/ThreadPool.h"
+#include "ga_slam/processing/SeqLock.h"
 
 // Eigen
 #include <Eigen/Core>
@@ -44,11 +47,14 @@ namespace ga_slam {
   */
 class PoseEstimation {
   public:
-    /// Instantiates the particle filter
-    PoseEstimation(void)
+    /** Instantiates the particle filter
+      * @param[in] threadPool the pool used by the particle filter to evaluate
+      *            the particles in parallel (may be null)
+      */
+    explicit PoseEstimation(ThreadPool* threadPool = nullptr)
             : pose_(Pose::Identity()),
               resampleCounter_(0),
-              particleFilter_() {}
+              particleFilter_(threadPool) {}
 
     /// Delete the default copy/move constructors and operators
     PoseEstimation(const PoseEstimation&) = delete;
@@ -56,23 +62,26 @@ class PoseEstimation {
     PoseEstimation(PoseEstimation&&) = delete;
     PoseEstimation& operator=(PoseEstimation&&) = delete;
 
-    /// Returns the robot's estimated pose in the ground frame
-    Pose getPose(void) const {
-        std::lock_guard<std::mutex> guard(poseMutex_);
-        return pose_;
-    }
+    /// Returns the robot's estimated pose in the ground frame without
+    /// blocking the pose updates
+    Pose getPose(void) const { return pose_.load(); }
 
     /// Returns the array with the particles from the particle filter
     Eigen::ArrayXXd getParticlesArray(void) const {
         return particleFilter_.getParticlesArray(); }
 
-    /// Returns the mutex protecting the pose
+    /** Returns the mutex serializing the pose updates
+      * @deprecated the pose can be read consistently using getPose without
+      *             locking this mutex
+      */
     std::mutex& getPoseMutex(void) { return poseMutex_; }
 
     /** Configures the particle filter by passing the parameters
-      * @param[in] numParticles number of particles used
-      * @param[in] resampleFrequency number of iterations of the particle filter
-      *            before resampling
+      * @param[in] numParticles number of particles used (the maximum number
+      *            if the population size is adapted)
+      * @param[in] resampleFrequency maximum number of iterations of the
+      *            particle filter before resampling (non-positive to resample
+      *            only depending on the effective sample size)
       * @param[in] initialSigmaX gaussian sigma of x for particle initialization
       * @param[in] initialSigmaY gaussian sigma of y for particle initialization
       * @param[in] initialSigmaYaw gaussian sigma of yaw for particle
@@ -80,10 +89,15 @@ class PoseEstimation {
       * @param[in] predictSigmaX gaussian sigma of x for particle prediction
       * @param[in] predictSigmaY gaussian sigma of y for particle prediction
       * @param[in] predictSigmaYaw gaussian sigma of yaw for particle prediction
+      * @param[in] resampleThreshold ratio of the effective sample size to the
+      *            number of particles below which the particles are resampled
+      * @param[in] minNumParticles minimum number of particles kept when the
+      *            population size is adapted (non-positive to keep it fixed)
       */
     void configure(int numParticles, int resampleFrequency,
             double initialSigmaX, double initialSigmaY, double initialSigmaYaw,
-            double predictSigmaX, double predictSigmaY, double predictSigmaYaw);
+            double predictSigmaX, double predictSigmaY, double predictSigmaYaw,
+            double resampleThreshold = 0.5, int minNumParticles = 0);
 
     /** Passes the input delta pose to the particle filter to predict the
       * particles' state and then constructs the new estimate
@@ -92,6 +106,8 @@ class PoseEstimation {
     void predictPose(const Pose& deltaPose);
 
     /** Calls the update and resample steps of the particle filter
+      * @note the filter holds the map cloud until the next update, so it must
+      *       not be modified meanwhile
       * @param[in] rawCloud the raw point cloud used in the update step
       * @param[in] mapCloud the map point cloud used in the update step
       */
@@ -99,6 +115,16 @@ class PoseEstimation {
             const Cloud::ConstPtr& rawCloud,
             const Cloud::ConstPtr& mapCloud);
 
+    /** Calls the update step of the particle filter using the elevation
+      * likelihood of the raw cloud and then the resample step
+      * @param[in] rawCloud the raw point cloud used in the update step
+      * @param[in] mapSnapshot the snapshot of the local map used in the
+      *            update step
+      */
+    void filterPose(
+            const Cloud::ConstPtr& rawCloud,
+            const MapSnapshot& mapSnapshot);
+
     /** Fuses the IMU pose with the current pose estimate by copying the
       * roll and pitch values as they are and performing gaussian fusion
       * to update the yaw value
@@ -122,17 +148,22 @@ class PoseEstimation {
       */
     static Eigen::Vector3d getAnglesFromPose(const Pose& pose);
 
+    /// Resamples the particles if the effective sample size is too low or
+    /// the maximum number of update steps without resampling is reached
+    void resampleParticles(void);
+
   protected:
-    /// Robot's 6-DoF pose in the continuous space
-    Pose pose_;
+    /// Robot's 6-DoF pose in the continuous space, published to the readers
+    /// using a sequence lock
+    SeqLock<Pose> pose_;
 
-    /// Mutex protecting the pose
-    mutable std::mutex poseMutex_;
+    /// Mutex serializing the pose updates
+    std::mutex poseMutex_;
 
     /// Number of iterations of the particle filter without having resampled
     std::atomic<int> resampleCounter_;
 
-    /// Number of iterations of the particle filter before resampling
+    /// Maximum number of iterations of the particle filter before resampling
     int resampleFrequency_;
 
     /// Instance of the particle filter
@@ -24,6 +24,7 @@
 #include "ga_slam/mapping/Map.h"
 
 // Eigen
+#include <Eigen/Core>
 #include <Eigen/Geometry>
 
 // PCL
@@ -32,8 +33,13 @@
 
 // STL
 #include <vector>
+#include <limits>
+#include <algorithm>
+#include <cstdint>
 #include <cmath>
 #include <mutex>
+#include <memory>
+#include <atomic>
 
 namespace ga_slam {
 
@@ -41,14 +47,81 @@ void DataRegistration::configure(
         double mapLength,
         double mapResolution,
         double minElevation,
-        double maxElevation) {
+        double maxElevation,
+        double minSlopeThreshold,
+        bool publishSnapshots,
+        int numPyramidLevels,
+        bool trackChanges) {
     std::lock_guard<std::mutex> guard(mapMutex_);
     map_.setParameters(mapLength, mapResolution, minElevation, maxElevation);
+
+    minSlopeThreshold_ = minSlopeThreshold;
+    publishSnapshots_ = publishSnapshots;
+    trackChanges_ = trackChanges;
+
+    if (!trackChanges_)
+        for (auto& change : changeHistory_)
+            std::vector<int>().swap(change.cellIndices);
+
+    const int size = map_.getParameters().size;
+    const int slopesSize = trackChanges_ ? size : 0;
+    slopes_ = Matrix::Zero(slopesSize, slopesSize);
+    double slopeSum = 0.;
+    updateSlopes(0, 0, slopesSize, slopesSize, slopeSum);
+    slopeSum_ = slopeSum;
+
+    pyramid_.clear();
+    for (int levelSize = size; static_cast<int>(pyramid_.size()) <
+            numPyramidLevels && levelSize % 2 == 0; levelSize /= 2) {
+        pyramid_.emplace_back();
+        pyramid_.back().meanZ.resize(levelSize / 2, levelSize / 2);
+        pyramid_.back().varianceZ.resize(levelSize / 2, levelSize / 2);
+    }
+
+    recordFullChange();
+    updatePyramid();
+    publishSnapshot();
 }
 
 void DataRegistration::translateMap(const Pose& estimatedPose, bool moveData) {
     std::lock_guard<std::mutex> guard(mapMutex_);
-    map_.translate(estimatedPose.translation(), moveData);
+    const auto previousPosition = map_.getGridMap().getPosition();
+    map_.translate(estimatedPose.translation(), moveData, clearedRegions_);
+
+    if (map_.getGridMap().getPosition() == previousPosition) return;
+
+    double slopeSum = slopeSum_;
+
+    for (const auto& region : clearedRegions_) {
+        const auto& index = region.getStartIndex();
+        const auto& size = region.getSize();
+
+        updateSlopes(index.x() - 1, index.y() - 1, size.x() + 2, size.y() + 2,
+                slopeSum);
+    }
+
+    slopeSum_ = slopeSum;
+
+    if (moveData) {
+        recordFullChange();
+        updatePyramid();
+    } else {
+        const int mapSize = map_.getParameters().size;
+        auto& changedCells = recordChange();
+
+        for (const auto& region : clearedRegions_) {
+            const auto& index = region.getStartIndex();
+            const auto& size = region.getSize();
+
+            for (int y = index.y(); y < index.y() + size.y(); ++y)
+                for (int x = index.x(); x < index.x() + size.x(); ++x)
+                    changedCells.push_back(x + y * mapSize);
+        }
+
+        updatePyramid(changedCells);
+    }
+
+    publishSnapshot();
 }
 
 void DataRegistration::updateMap(
@@ -59,38 +132,381 @@ void DataRegistration::updateMap(
     auto& meanData = map_.getMeanZ();
     auto& varianceData = map_.getVarianceZ();
 
-    size_t cloudIndex = 0;
-    size_t mapIndex;
+    const int numCloudPoints = cloud->size();
+    if (cellIndices_.size() < numCloudPoints)
+        cellIndices_.resize(numCloudPoints);
 
-    for (const auto& point : cloud->points) {
-        cloudIndex++;
+    if (numCloudPoints)
+        map_.getIndicesFromPositions(cloud->getMatrixXfMap(2, 4, 0),
+                cellIndices_.head(numCloudPoints));
 
-        if (!map_.getIndexFromPosition(point.x, point.y, mapIndex)) continue;
+    if (cellCounts_.size() != static_cast<size_t>(meanData.size()))
+        cellCounts_.assign(meanData.size(), 0);
 
-        float& mean = meanData(mapIndex);
-        float& variance = varianceData(mapIndex);
-        const float& pointVariance = cloudVariances[cloudIndex - 1];
+    occupiedCells_.clear();
 
-        if (!std::isfinite(mean)) {
-            mean = point.z;
-            variance = pointVariance;
-        } else {
-            fuseGaussians(mean, variance, point.z, pointVariance);
-        }
+    for (int i = 0; i < numCloudPoints; ++i) {
+        const int cell = cellIndices_(i);
+        if (cell < 0) continue;
+
+        if (!cellCounts_[cell]++) occupiedCells_.push_back(cell);
+    }
+
+    uint32_t numPoints = 0;
+    for (const auto& cell : occupiedCells_) {
+        const uint32_t cellCount = cellCounts_[cell];
+        cellCounts_[cell] = numPoints;
+        numPoints += cellCount;
+    }
+
+    groupedPoints_.resize(numPoints);
+
+    for (int i = 0; i < numCloudPoints; ++i) {
+        const int cell = cellIndices_(i);
+        if (cell < 0) continue;
+
+        groupedPoints_[cellCounts_[cell]++] = i;
+    }
+
+    uint32_t pointsBegin = 0;
+    for (const auto& cell : occupiedCells_) {
+        const uint32_t pointsEnd = cellCounts_[cell];
+
+        fuseGaussians(meanData(cell), varianceData(cell), *cloud,
+                cloudVariances, groupedPoints_.data() + pointsBegin,
+                groupedPoints_.data() + pointsEnd);
+
+        cellCounts_[cell] = 0;
+        pointsBegin = pointsEnd;
     }
 
+    const int size = meanData.rows();
+    double slopeSum = slopeSum_;
+
+    for (const auto& cell : occupiedCells_)
+        updateSlopes(cell % size - 1, cell / size - 1, 3, 3, slopeSum);
+
+    slopeSum_ = slopeSum;
+
     map_.setValid(true);
     map_.setTimestamp(cloud->header.stamp);
+
+    if (!occupiedCells_.empty()) {
+        if (trackChanges_)
+            recordChange().assign(occupiedCells_.begin(), occupiedCells_.end());
+        else
+            recordFullChange();
+
+        updatePyramid(occupiedCells_);
+    }
+
+    publishSnapshot();
+}
+
+void DataRegistration::getChanges(
+        uint64_t sinceVersion,
+        MapChangeSet& changeSet) const {
+    std::lock_guard<std::mutex> guard(mapMutex_);
+
+    const auto& meanData = map_.getMeanZ();
+    const auto& varianceData = map_.getVarianceZ();
+    const auto& startIndex = map_.getGridMap().getStartIndex();
+    const int size = meanData.rows();
+
+    changeSet.version = version_;
+    changeSet.parameters = map_.getParameters();
+    changeSet.startIndexX = startIndex.x();
+    changeSet.startIndexY = startIndex.y();
+    changeSet.full = sinceVersion < changeHistoryStart_;
+    changeSet.cellIndices.clear();
+
+    if (changeSet.full) {
+        changeSet.cellIndices.resize(meanData.size());
+        for (int i = 0; i < meanData.size(); ++i) changeSet.cellIndices[i] = i;
+    } else {
+        for (size_t i = 1; i <= changeHistorySize_; ++i) {
+            const auto& change = changeHistory_[(changeHistoryNext_ +
+                    maxChangeHistory_ - i) % maxChangeHistory_];
+            if (change.version <= sinceVersion) break;
+
+            changeSet.cellIndices.insert(changeSet.cellIndices.end(),
+                    change.cellIndices.begin(), change.cellIndices.end());
+        }
+
+        std::sort(changeSet.cellIndices.begin(), changeSet.cellIndices.end());
+        changeSet.cellIndices.erase(std::unique(changeSet.cellIndices.begin(),
+                changeSet.cellIndices.end()), changeSet.cellIndices.end());
+    }
+
+    const size_t numCells = changeSet.cellIndices.size();
+    changeSet.meanZ.resize(numCells);
+    changeSet.varianceZ.resize(numCells);
+
+    int minX = size, minY = size, maxX = -1, maxY = -1;
+
+    for (size_t i = 0; i < numCells; ++i) {
+        const int cell = changeSet.cellIndices[i];
+        changeSet.meanZ[i] = meanData(cell);
+        changeSet.varianceZ[i] = varianceData(cell);
+
+        const int unwrappedX = (cell % size - startIndex.x() + size) % size;
+        const int unwrappedY = (cell / size - startIndex.y() + size) % size;
+        minX = std::min(minX, unwrappedX);
+        minY = std::min(minY, unwrappedY);
+        maxX = std::max(maxX, unwrappedX);
+        maxY = std::max(maxY, unwrappedY);
+    }
+
+    changeSet.regionIndexX = numCells ? minX : 0;
+    changeSet.regionIndexY = numCells ? minY : 0;
+    changeSet.regionSizeX = numCells ? maxX - minX + 1 : 0;
+    changeSet.regionSizeY = numCells ? maxY - minY + 1 : 0;
+}
+
+std::vector<int>& DataRegistration::recordChange(void) {
+    if (!trackChanges_) {
+        recordFullChange();
+        untrackedCells_.clear();
+
+        return untrackedCells_;
+    }
+
+    auto& change = changeHistory_[changeHistoryNext_];
+
+    if (changeHistorySize_ == maxChangeHistory_)
+        changeHistoryStart_ = change.version;
+    else
+        changeHistorySize_++;
+
+    changeHistoryNext_ = (changeHistoryNext_ + 1) % maxChangeHistory_;
+    change.version = ++version_;
+    change.cellIndices.clear();
+
+    return change.cellIndices;
+}
+
+void DataRegistration::recordFullChange(void) {
+    changeHistorySize_ = 0;
+    changeHistoryStart_ = ++version_;
+}
+
+void DataRegistration::publishSnapshot(void) {
+    if (!publishSnapshots_) return;
+
+    // The reference count is read relaxed, so the fence orders the reuse
+    // after the reads of the last reader that released the spare snapshot
+    std::shared_ptr<MapSnapshot> snapshot;
+    if (spareSnapshot_ && spareSnapshot_.use_count() == 1) {
+        std::atomic_thread_fence(std::memory_order_acquire);
+        snapshot = std::move(spareSnapshot_);
+    } else {
+        snapshot = std::make_shared<MapSnapshot>();
+    }
+
+    map_.getSnapshot(*snapshot);
+    snapshot->version = version_;
+    snapshot->pyramid = pyramid_;
+
+    for (auto& level : snapshot->pyramid) {
+        level.valid = snapshot->valid;
+        level.timestamp = snapshot->timestamp;
+        level.version = snapshot->version;
+    }
+
+    spareSnapshot_ = std::move(publishedSnapshot_);
+    publishedSnapshot_ = snapshot;
+    std::atomic_store(&snapshot_,
+            std::shared_ptr<const MapSnapshot>(std::move(snapshot)));
+}
+
+void DataRegistration::updatePyramid(const std::vector<int>& changedCells) {
+    if (pyramid_.empty()) return;
+
+    updatePyramidGeometry();
+    pyramidCells_.assign(changedCells.begin(), changedCells.end());
+    int previousSize = map_.getParameters().size;
+
+    for (size_t level = 0; level < pyramid_.size(); ++level) {
+        const int size = pyramid_[level].parameters.size;
+
+        nextPyramidCells_.clear();
+        for (const auto& cell : pyramidCells_)
+            nextPyramidCells_.push_back(cell % previousSize / 2 +
+                    cell / previousSize / 2 * size);
+
+        std::sort(nextPyramidCells_.begin(), nextPyramidCells_.end());
+        nextPyramidCells_.erase(std::unique(nextPyramidCells_.begin(),
+                nextPyramidCells_.end()), nextPyramidCells_.end());
+
+        for (const auto& cell : nextPyramidCells_)
+            fusePyramidCell(level, cell);
+
+        std::swap(pyramidCells_, nextPyramidCells_);
+        previousSize = size;
+    }
+}
+
+void DataRegistration::updatePyramid(void) {
+    if (pyramid_.empty()) return;
+
+    updatePyramidGeometry();
+
+    for (size_t level = 0; level < pyramid_.size(); ++level)
+        for (int cell = 0; cell < pyramid_[level].meanZ.size(); ++cell)
+            fusePyramidCell(level, cell);
+}
+
+void DataRegistration::updatePyramidGeometry(void) {
+    const auto parameters = map_.getParameters();
+    const auto& startIndex = map_.getGridMap().getStartIndex();
+
+    for (size_t level = 0; level < pyramid_.size(); ++level) {
+        const int scale = 2 << level;
+        auto& pyramidLevel = pyramid_[level];
+
+        pyramidLevel.parameters = parameters;
+        pyramidLevel.parameters.size = parameters.size / scale;
+        pyramidLevel.parameters.resolution = parameters.resolution * scale;
+        pyramidLevel.parameters.positionX = parameters.positionX +
+                startIndex.x() % scale * parameters.resolution;
+        pyramidLevel.parameters.positionY = parameters.positionY +
+                startIndex.y() % scale * parameters.resolution;
+        pyramidLevel.startIndexX = startIndex.x() / scale;
+        pyramidLevel.startIndexY = startIndex.y() / scale;
+    }
+}
+
+void DataRegistration::fusePyramidCell(size_t level, int cell) {
+    constexpr double minVariance = std::numeric_limits<float>::min();
+    constexpr float unknownValue = std::numeric_limits<float>::quiet_NaN();
+
+    const auto& previousMeanData = level ? pyramid_[level - 1].meanZ :
+            map_.getMeanZ();
+    const auto& previousVarianceData = level ?
+            pyramid_[level - 1].varianceZ : map_.getVarianceZ();
+    const int previousStartX = level ? pyramid_[level - 1].startIndexX :
+            map_.getGridMap().getStartIndex().x();
+    const int previousStartY = level ? pyramid_[level - 1].startIndexY :
+            map_.getGridMap().getStartIndex().y();
+
+    auto& pyramidLevel = pyramid_[level];
+    const int size = pyramidLevel.parameters.size;
+    const int indexX = cell % size;
+    const int indexY = cell / size;
+
+    double precision = 0.;
+    double weightedMean = 0.;
+
+    for (int x = 2 * indexX; x < 2 * indexX + 2; ++x) {
+        if (previousStartX % 2 && x == previousStartX - 1) continue;
+
+        for (int y = 2 * indexY; y < 2 * indexY + 2; ++y) {
+            if (previousStartY % 2 && y == previousStartY - 1) continue;
+            if (!std::isfinite(previousMeanData(x, y))) continue;
+
+            const double cellPrecision = 1. / std::max<double>(
+                    previousVarianceData(x, y), minVariance);
+
+            precision += cellPrecision;
+            weightedMean += previousMeanData(x, y) * cellPrecision;
+        }
+    }
+
+    pyramidLevel.meanZ(cell) = precision > 0. ? weightedMean / precision :
+            unknownValue;
+    pyramidLevel.varianceZ(cell) = precision > 0. ? 1. / precision :
+            unknownValue;
+}
+
+float DataRegistration::calculateSlope(int indexX, int indexY) const {
+    const auto& meanData = map_.getMeanZ();
+    const auto& startIndex = map_.getGridMap().getStartIndex();
+    const int size = meanData.rows();
+
+    const int unwrappedX = (indexX - startIndex.x() + size) % size;
+    const int unwrappedY = (indexY - startIndex.y() + size) % size;
+    if (unwrappedX == 0 || unwrappedX == size - 1 ||
+            unwrappedY == 0 || unwrappedY == size - 1)
+        return 0.f;
+
+    const int previousX = (indexX + size - 1) % size;
+    const int nextX = (indexX + 1) % size;
+    const int previousY = (indexY + size - 1) % size;
+    const int nextY = (indexY + 1) % size;
+
+    const float gradientX =
+            meanData(previousX, nextY) + 2.f * meanData(indexX, nextY) +
+            meanData(nextX, nextY) - meanData(previousX, previousY) -
+            2.f * meanData(indexX, previousY) - meanData(nextX, previousY);
+    const float gradientY =
+            meanData(nextX, previousY) + 2.f * meanData(nextX, indexY) +
+            meanData(nextX, nextY) - meanData(previousX, previousY) -
+            2.f * meanData(previousX, indexY) - meanData(previousX, nextY);
+
+    const float slope = std::sqrt(gradientX * gradientX +
+            gradientY * gradientY);
+
+    if (!std::isfinite(slope) || !std::isfinite(meanData(indexX, indexY)) ||
+            slope <= minSlopeThreshold_)
+        return 0.f;
+
+    return slope;
+}
+
+void DataRegistration::updateSlopes(
+        int startIndexX,
+        int startIndexY,
+        int sizeX,
+        int sizeY,
+        double& slopeSum) {
+    const int size = slopes_.rows();
+    if (!size) return;
+
+    if (sizeX >= size) startIndexX = 0;
+    if (sizeY >= size) startIndexY = 0;
+    sizeX = std::min(sizeX, size);
+    sizeY = std::min(sizeY, size);
+
+    for (int j = 0; j < sizeY; ++j) {
+        const int indexY = (startIndexY + j + size) % size;
+
+        for (int i = 0; i < sizeX; ++i) {
+            const int indexX = (startIndexX + i + size) % size;
+            float& slope = slopes_(indexX, indexY);
+
+            slopeSum -= slope;
+            slope = calculateSlope(indexX, indexY);
+            slopeSum += slope;
+        }
+    }
 }
 
 void DataRegistration::fuseGaussians(
-        float& mean1, float& variance1,
-        const float& mean2, const float& variance2) {
-    const double innovation = mean2 - mean1;
-    const double gain = variance1 / (variance1 + variance2);
+        float& mean, float& variance,
+        const Cloud& cloud,
+        const std::vector<float>& cloudVariances,
+        const uint32_t* pointsBegin,
+        const uint32_t* pointsEnd) {
+    constexpr double minVariance = std::numeric_limits<float>::min();
+
+    double precision = 0.;
+    double weightedMean = 0.;
+
+    if (std::isfinite(mean)) {
+        precision = 1. / std::max<double>(variance, minVariance);
+        weightedMean = mean * precision;
+    }
+
+    for (auto point = pointsBegin; point != pointsEnd; ++point) {
+        const double pointPrecision = 1. /
+                std::max<double>(cloudVariances[*point], minVariance);
+
+        precision += pointPrecision;
+        weightedMean += cloud.points[*point].z * pointPrecision;
+    }
 
-    mean1 = mean1 + (gain * innovation);
-    variance1 = variance1 * (1. - gain);
+    mean = weightedMean / precision;
+    variance = 1. / precision;
 }
 
 }  // namespace ga_slam
@@ -24,6 +24,7 @@
 #include "ga_slam/mapping/Map.h"
 
 // Eigen
+#include <Eigen/Core>
 #include <Eigen/Geometry>
 
 // PCL
@@ -33,6 +34,9 @@
 // STL
 #include <vector>
 #include <mutex>
+#include <atomic>
+#include <memory>
+#include <cstdint>
 
 namespace ga_slam {
 
@@ -42,7 +46,17 @@ namespace ga_slam {
 class DataRegistration {
   public:
     /// Instantiates the local elevation map
-    DataRegistration(void) : map_() {}
+    DataRegistration(void)
+        : map_(),
+          minSlopeThreshold_(0.),
+          slopeSum_(0.),
+          publishSnapshots_(false),
+          trackChanges_(true),
+          version_(0),
+          changeHistory_(maxChangeHistory_),
+          changeHistoryNext_(0),
+          changeHistorySize_(0),
+          changeHistoryStart_(0) {}
 
     /// Delete the default copy/move constructors and operators
     DataRegistration(const DataRegistration&) = delete;
@@ -56,17 +70,52 @@ class DataRegistration {
     /// Returns the mutex protecting the map
     std::mutex& getMapMutex(void) { return mapMutex_; }
 
+    /// Returns the latest immutable snapshot of the map, which is published
+    /// after every change of the map (null if snapshots are not published)
+    std::shared_ptr<const MapSnapshot> getSnapshot(void) const {
+        return std::atomic_load(&snapshot_); }
+
+    /// Returns the version of the map, increased on every change of the map
+    uint64_t getVersion(void) const { return version_; }
+
+    /** Collects the cells of the map that changed after a given version.
+      * The changes of the latest updates and translations are tracked per
+      * cell, so only the changed cells are visited. If the changes after the
+      * version are no longer tracked, all cells are returned
+      * @param[in] sinceVersion the version the consumer is up to date with
+      * @param[out] changeSet the changed cells and their values
+      */
+    void getChanges(uint64_t sinceVersion, MapChangeSet& changeSet) const;
+
+    /// Returns the sum of the slopes of the map's cells that are steeper than
+    /// the minimum slope threshold, which is kept up to date with the map
+    double getSlopeSum(void) const { return slopeSum_; }
+
     /** Configures the map by passing the parameters
       * @param[in] mapLength the size of one dimension of the map in meters
       * @param[in] mapResolution the resolution of the map in meters
       * @param[in] minElevation the minimum elevation value the map can hold
       * @param[in] maxElevation the maximum elevation value the map can hold
+      * @param[in] minSlopeThreshold the minimum slope a cell needs to have to
+      *            contribute to the slope sum
+      * @param[in] publishSnapshots whether to publish a snapshot of the map
+      *            after every change, so that readers never lock the map
+      * @param[in] numPyramidLevels the number of coarser levels of the map
+      *            published with its snapshots, which are limited so that the
+      *            map's size is divisible by the size of each level
+      * @param[in] trackChanges whether to track the changed cells and the
+      *            slope sum of the map (if not, every change is reported as a
+      *            change of all cells and the slope sum stays zero)
       */
     void configure(
             double mapLength,
             double mapResolution,
             double minElevation = -std::numeric_limits<double>::max(),
-            double maxElevation = std::numeric_limits<double>::max());
+            double maxElevation = std::numeric_limits<double>::max(),
+            double minSlopeThreshold = 0.,
+            bool publishSnapshots = false,
+            int numPyramidLevels = 0,
+            bool trackChanges = true);
 
     /// Returns the structure containing the map's parameters
     MapParameters getMapParameters(void) const {
@@ -75,7 +124,15 @@ class DataRegistration {
     }
 
     /// Clears the values of the map
-    void clear(void) { map_.clear(); }
+    void clear(void) {
+        std::lock_guard<std::mutex> guard(mapMutex_);
+        map_.clear();
+        slopes_.setZero();
+        slopeSum_ = 0.;
+        recordFullChange();
+        updatePyramid();
+        publishSnapshot();
+    }
 
     /** Translates the map to a new position
       * @param[in] estimatedPose the robot's new pose estimate
@@ -87,7 +144,9 @@ class DataRegistration {
     /** Registers a point cloud to the map by fusing each point of the cloud
       * to corresponding cell of the map. Each cell of the map and each point
       * of the input cloud are represented as gaussians (mean and variance),
-      * so a gaussian fusion is performed.
+      * so a gaussian fusion is performed. The cells of all points are found
+      * at once and the points are grouped by cell, so that each cell is
+      * fused with all of its points in closed form and written only once.
       * @note the position of the cloud's points and the map's position should
       *       correspond to the same reference frame.
       * @param[in] cloud the point cloud to be registered
@@ -99,23 +158,183 @@ class DataRegistration {
             const std::vector<float>& cloudVariances);
 
   protected:
-    /** Performs a fusion of two gaussians and stores the result in the first
-      * @note the order of the gaussians does not matter
-      * @param[in/out] mean1 the mean value of the first gaussian
-      * @param[in/out] variance1 the variance value of the first gaussian
-      * @param[in] mean2 the mean value of the second gaussian
-      * @param[in] variance2 the variance value of the second gaussian
+    /// Cells changed by an update or a translation of the map
+    struct MapChange {
+        /// Version of the map after the change
+        uint64_t version;
+
+        /// Linear indices of the changed cells
+        std::vector<int> cellIndices;
+    };
+
+    /** Increases the version of the map and starts recording the cells of a
+      * change, overwriting the oldest tracked change if the history is full.
+      * If the changes are not tracked, a change of every cell is recorded
+      * instead and the returned cells are only used by the pyramid
+      * @note the map's mutex must be locked by the caller
+      * @return the cell indices of the new change to be filled
+      */
+    std::vector<int>& recordChange(void);
+
+    /** Increases the version of the map after a change of every cell and
+      * discards the tracked changes
+      * @note the map's mutex must be locked by the caller
+      */
+    void recordFullChange(void);
+
+    /** Updates the pyramid levels over the cells of the map that changed.
+      * A cell of a level is the variance-weighted mean of the (up to four)
+      * cells of the previous level it covers, and its variance is that of
+      * the weighted mean, so the levels only need the changed cells
+      * @note the map's mutex must be locked by the caller
+      * @param[in] changedCells the linear indices of the changed cells
+      */
+    void updatePyramid(const std::vector<int>& changedCells);
+
+    /** Updates all the cells of the pyramid levels
+      * @note the map's mutex must be locked by the caller
+      */
+    void updatePyramid(void);
+
+    /** Updates the parameters and the start indices of the pyramid levels
+      * after a translation of the map. The levels' cells stay aligned to the
+      * world, so the cells of a level's circular buffer that cover the start
+      * of the map's buffer are only fused from the cells after it
+      * @note the map's mutex must be locked by the caller
+      */
+    void updatePyramidGeometry(void);
+
+    /** Fuses a cell of a pyramid level from the cells it covers in the
+      * previous level
+      * @param[in] level the index of the level in the pyramid
+      * @param[in] cell the linear index of the cell in the level
+      */
+    void fusePyramidCell(size_t level, int cell);
+
+    /** Copies the map to a snapshot and publishes it, replacing the previous
+      * one. The buffers of a snapshot no longer used by any reader are reused
+      * @note the map's mutex must be locked by the caller
+      */
+    void publishSnapshot(void);
+
+    /** Calculates the slope of a cell as the magnitude of the Sobel gradient
+      * of the mean elevation, the same way it is calculated for an image of
+      * the map. Cells at the edges of the map or with an unknown neighbor
+      * have no slope
+      * @param[in] indexX the x index of the cell in the circular buffer
+      * @param[in] indexY the y index of the cell in the circular buffer
+      * @return the slope of the cell or 0 if it is not steeper than the
+      *         minimum slope threshold
+      */
+    float calculateSlope(int indexX, int indexY) const;
+
+    /** Recalculates the slopes of the cells of a region of the circular
+      * buffer and updates the slope sum accordingly
+      * @param[in] startIndexX the first x index of the region (may be
+      *            outside the buffer, in which case it is wrapped)
+      * @param[in] startIndexY the first y index of the region
+      * @param[in] sizeX the number of cells of the region in x
+      * @param[in] sizeY the number of cells of the region in y
+      * @param[in/out] slopeSum the slope sum to be updated
+      */
+    void updateSlopes(
+            int startIndexX,
+            int startIndexY,
+            int sizeX,
+            int sizeY,
+            double& slopeSum);
+
+    /** Fuses the gaussian of a cell with the gaussians of multiple points in
+      * closed form, as the normalized product of all the gaussians
+      * @param[in/out] mean the mean value of the cell (not finite if empty)
+      * @param[in/out] variance the variance value of the cell
+      * @param[in] cloud the point cloud containing the points
+      * @param[in] cloudVariances the variances of the cloud's points
+      * @param[in] pointsBegin the first of the indices of the points
+      * @param[in] pointsEnd the end of the indices of the points
       */
     static void fuseGaussians(
-            float& mean1, float& variance1,
-            const float& mean2, const float& variance2);
+            float& mean, float& variance,
+            const Cloud& cloud,
+            const std::vector<float>& cloudVariances,
+            const uint32_t* pointsBegin,
+            const uint32_t* pointsEnd);
 
   protected:
     /// Local (robot-centric) elevation map with mean and variance values
     Map map_;
 
-    /// Mutex protecting the map
+    /// Mutex protecting the map and the buffers used for its update
     mutable std::mutex mapMutex_;
+
+    /// Linear index of the cell of each point of the registered cloud (only
+    /// grown, so that its storage is reused by smaller clouds)
+    Eigen::ArrayXi cellIndices_;
+
+    /// Number of points of each cell, which is used as the write position of
+    /// the cell's points while grouping them and is reset after the update
+    std::vector<uint32_t> cellCounts_;
+
+    /// Cells containing points, in order of their first point
+    std::vector<int> occupiedCells_;
+
+    /// Indices of the points grouped by cell
+    std::vector<uint32_t> groupedPoints_;
+
+    /// Minimum slope a cell needs to have to contribute to the slope sum
+    double minSlopeThreshold_;
+
+    /// Slope of each cell of the map that contributes to the slope sum
+    /// (empty if the changes are not tracked)
+    Matrix slopes_;
+
+    /// Running sum of the slopes, updated only around the cells that change
+    std::atomic<double> slopeSum_;
+
+    /// Regions of the map emptied by its last translation
+    std::vector<grid_map::BufferRegion> clearedRegions_;
+
+    /// Whether a snapshot is published after every change of the map
+    bool publishSnapshots_;
+
+    /// Coarser levels of the map, each with half the resolution of the
+    /// previous one
+    std::vector<MapSnapshot> pyramid_;
+
+    /// Changed cells of the current and the next pyramid level while the
+    /// levels are updated
+    std::vector<int> pyramidCells_;
+    std::vector<int> nextPyramidCells_;
+
+    /// Whether the changed cells and the slope sum of the map are tracked
+    bool trackChanges_;
+
+    /// Version of the map, increased on every change of the map
+    std::atomic<uint64_t> version_;
+
+    /// Latest changes of the map in a circular buffer, whose entries (and
+    /// their cell buffers) are reused, the position of the next change, the
+    /// number of tracked changes and the version after which all changes are
+    /// tracked
+    std::vector<MapChange> changeHistory_;
+    size_t changeHistoryNext_;
+    size_t changeHistorySize_;
+    uint64_t changeHistoryStart_;
+
+    /// Cells of the latest change if the changes are not tracked
+    std::vector<int> untrackedCells_;
+
+    /// Maximum number of changes kept in the history
+    static constexpr size_t maxChangeHistory_ = 64;
+
+    /// Latest snapshot of the map shared with the readers (replaced
+    /// atomically as a whole, so readers never block the registration)
+    std::shared_ptr<const MapSnapshot> snapshot_;
+
+    /// Writable references to the latest and the previously published
+    /// snapshots, the latter of which is reused once no reader holds it
+    std::shared_ptr<MapSnapshot> publishedSnapshot_;
+    std::shared_ptr<MapSnapshot> spareSnapshot_;
 };
 
 }  // namespace ga_slam
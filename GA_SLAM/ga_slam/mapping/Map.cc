@@ -22,10 +22,17 @@
 // Grid Map
 #include "grid_map_core/TypeDefs.hpp"
 #include "grid_map_core/GridMap.hpp"
+#include "grid_map_core/GridMapMath.hpp"
 
 // Eigen
 #include <Eigen/Core>
 
+// STL
+#include <vector>
+#include <limits>
+#include <cstdlib>
+#include <algorithm>
+
 namespace ga_slam {
 
 Map::Map(void) : valid_(false) {
@@ -60,6 +67,16 @@ MapParameters Map::getParameters(void) const {
     return params;
 }
 
+void Map::getSnapshot(MapSnapshot& snapshot) const {
+    snapshot.meanZ = getMeanZ();
+    snapshot.varianceZ = getVarianceZ();
+    snapshot.parameters = getParameters();
+    snapshot.startIndexX = gridMap_.getStartIndex().x();
+    snapshot.startIndexY = gridMap_.getStartIndex().y();
+    snapshot.valid = valid_;
+    snapshot.timestamp = getTimestamp();
+}
+
 bool Map::getIndexFromPosition(
         double positionX,
         double positionY,
@@ -74,6 +91,45 @@ bool Map::getIndexFromPosition(
     return true;
 }
 
+void Map::getIndicesFromPositions(
+        const Eigen::Ref<const Eigen::MatrixXf, 0, Eigen::OuterStride<>>&
+                positions,
+        Eigen::ArrayXi& indices) const {
+    indices.resize(positions.cols());
+    getIndicesFromPositions(positions, Eigen::Ref<Eigen::ArrayXi>(indices));
+}
+
+void Map::getIndicesFromPositions(
+        const Eigen::Ref<const Eigen::MatrixXf, 0, Eigen::OuterStride<>>&
+                positions,
+        Eigen::Ref<Eigen::ArrayXi> indices) const {
+    const double length = gridMap_.getLength().x();
+    const double resolution = gridMap_.getResolution();
+    const int size = gridMap_.getSize().x();
+    const int startIndexX = gridMap_.getStartIndex().x();
+    const int startIndexY = gridMap_.getStartIndex().y();
+    const double cornerX = gridMap_.getPosition().x() + length / 2.;
+    const double cornerY = gridMap_.getPosition().y() + length / 2.;
+
+    const auto offsetsX = cornerX -
+            positions.row(0).transpose().array().cast<double>();
+    const auto offsetsY = cornerY -
+            positions.row(1).transpose().array().cast<double>();
+
+    const auto indicesX = (offsetsX / resolution).cast<int>().min(size - 1) +
+            startIndexX;
+    const auto indicesY = (offsetsY / resolution).cast<int>().min(size - 1) +
+            startIndexY;
+    const auto wrappedIndicesX = (indicesX >= size).select(indicesX - size,
+            indicesX);
+    const auto wrappedIndicesY = (indicesY >= size).select(indicesY - size,
+            indicesY);
+
+    indices = (offsetsX >= 0. && offsetsX < length &&
+            offsetsY >= 0. && offsetsY < length).select(
+            wrappedIndicesX + wrappedIndicesY * size, -1);
+}
+
 void Map::getPointFromArrayIndex(
         const grid_map::Index& arrayIndex,
         const Matrix& layerData,
@@ -86,13 +142,87 @@ void Map::getPointFromArrayIndex(
 }
 
 void Map::translate(const Eigen::Vector3d& translation, bool moveData) {
+    std::vector<grid_map::BufferRegion> clearedRegions;
+    translate(translation, moveData, clearedRegions);
+}
+
+void Map::translate(
+        const Eigen::Vector3d& translation,
+        bool moveData,
+        std::vector<grid_map::BufferRegion>& clearedRegions) {
     const auto newPosition = grid_map::Position(translation.x(),
             translation.y());
 
-    if (moveData)
+    clearedRegions.clear();
+
+    if (moveData) {
         gridMap_.setPosition(newPosition);
-    else
-        gridMap_.move(newPosition);
+        return;
+    }
+
+    // Same as GridMap::move, which copies the layer names on every cleared
+    // block, but clearing the two layers of the map in place
+    const auto resolution = gridMap_.getResolution();
+    const auto& size = gridMap_.getSize();
+    grid_map::Index indexShift;
+    grid_map::Position alignedShift;
+
+    grid_map::getIndexShiftFromPositionShift(indexShift,
+            newPosition - gridMap_.getPosition(), resolution);
+    grid_map::getPositionShiftFromIndexShift(alignedShift, indexShift,
+            resolution);
+
+    for (int i = 0; i < indexShift.size(); ++i) {
+        if (!indexShift(i)) continue;
+
+        const int numCells = std::abs(indexShift(i));
+
+        if (numCells >= size(i)) {
+            clearBufferRegion(grid_map::Index(0, 0), size, clearedRegions);
+            continue;
+        }
+
+        const int sign = indexShift(i) > 0 ? 1 : -1;
+        const int startIndex = gridMap_.getStartIndex()(i) -
+                (sign < 0 ? 1 : 0);
+        int index = sign > 0 ? startIndex : startIndex - sign + indexShift(i);
+        grid_map::wrapIndexToRange(index, size(i));
+
+        const int firstNumCells = std::min(numCells, size(i) - index);
+        const int secondNumCells = numCells - firstNumCells;
+
+        grid_map::Index regionIndex(0, 0);
+        grid_map::Size regionSize = size;
+        regionIndex(i) = index;
+        regionSize(i) = firstNumCells;
+        clearBufferRegion(regionIndex, regionSize, clearedRegions);
+
+        if (secondNumCells) {
+            regionIndex(i) = 0;
+            regionSize(i) = secondNumCells;
+            clearBufferRegion(regionIndex, regionSize, clearedRegions);
+        }
+    }
+
+    grid_map::Index startIndex = gridMap_.getStartIndex() + indexShift;
+    grid_map::wrapIndexToRange(startIndex, size);
+    gridMap_.setStartIndex(startIndex);
+    gridMap_.setPosition(gridMap_.getPosition() + alignedShift);
+}
+
+void Map::clearBufferRegion(
+        const grid_map::Index& index,
+        const grid_map::Size& size,
+        std::vector<grid_map::BufferRegion>& clearedRegions) {
+    constexpr float nan = std::numeric_limits<float>::quiet_NaN();
+
+    gridMap_.get(layerMeanZ_).block(index.x(), index.y(), size.x(), size.y())
+            .setConstant(nan);
+    gridMap_.get(layerVarianceZ_).block(index.x(), index.y(), size.x(),
+            size.y()).setConstant(nan);
+
+    clearedRegions.emplace_back(index, size,
+            grid_map::BufferRegion::Quadrant::Undefined);
 }
 
 }  // namespace ga_slam
@@ -22,13 +22,17 @@
 // Grid Map
 #include "grid_map_core/TypeDefs.hpp"
 #include "grid_map_core/GridMap.hpp"
+#include "grid_map_core/BufferRegion.hpp"
 #include "grid_map_core/iterators/GridMapIterator.hpp"
 
 // Eigen
 #include <Eigen/Core>
 
 // STL
+#include <vector>
 #include <limits>
+#include <algorithm>
+#include <cstdint>
 
 namespace ga_slam {
 
@@ -56,6 +60,166 @@ struct MapParameters {
     double resolution;
 };
 
+/** Contains a copy of the map's data layers together with the geometry of
+  * the underlying circular buffer, so that the cell under a position can be
+  * found in constant time without accessing the GridMap instance.
+  */
+struct MapSnapshot {
+    /// Copies of the mean and variance elevation data layers
+    Matrix meanZ;
+    Matrix varianceZ;
+
+    /// Parameters of the map at the time the snapshot was taken
+    MapParameters parameters;
+
+    /// Start index of the map's circular buffer
+    int startIndexX = 0;
+    int startIndexY = 0;
+
+    /// Whether the map was valid at the time the snapshot was taken
+    bool valid = false;
+
+    /// Timestamp of the map at the time the snapshot was taken
+    Time timestamp = 0;
+
+    /// Version of the map at the time the snapshot was taken (0 if the map's
+    /// changes are not tracked)
+    uint64_t version = 0;
+
+    /// Coarser levels of the map, each with half the resolution of the
+    /// previous one (empty if the map's pyramid is not maintained). A level's
+    /// cells are aligned to the world, so its position differs from the
+    /// map's by less than one of its cells
+    std::vector<MapSnapshot> pyramid;
+
+    /** Finds the linear index of the cell that corresponds to a position
+      * using the same convention as Map::getIndexFromPosition
+      * @param[in] positionX the x coordinate of the position
+      * @param[in] positionY the y coordinate of the position
+      * @param[out] index the linear index matching to the position
+      * @return true if the position lies inside the map
+      */
+    bool getIndexFromPosition(
+            double positionX,
+            double positionY,
+            size_t& index) const {
+        const double halfLength = parameters.length / 2.;
+        const double offsetX = parameters.positionX + halfLength - positionX;
+        const double offsetY = parameters.positionY + halfLength - positionY;
+
+        if (offsetX < 0. || offsetX >= parameters.length ||
+                offsetY < 0. || offsetY >= parameters.length)
+            return false;
+
+        const int size = parameters.size;
+        int indexX = std::min(static_cast<int>(offsetX / parameters.resolution),
+                size - 1) + startIndexX;
+        int indexY = std::min(static_cast<int>(offsetY / parameters.resolution),
+                size - 1) + startIndexY;
+
+        if (indexX >= size) indexX -= size;
+        if (indexY >= size) indexY -= size;
+
+        index = indexX + indexY * size;
+
+        return true;
+    }
+
+    /** Finds the position of the center of a cell using the same convention
+      * as Map::getPointFromArrayIndex
+      * @param[in] indexX the x index of the cell in the circular buffer
+      * @param[in] indexY the y index of the cell in the circular buffer
+      * @param[out] positionX the x coordinate of the cell's center
+      * @param[out] positionY the y coordinate of the cell's center
+      */
+    void getPositionFromIndex(
+            int indexX,
+            int indexY,
+            double& positionX,
+            double& positionY) const {
+        const int size = parameters.size;
+        const int unwrappedX = (indexX - startIndexX + size) % size;
+        const int unwrappedY = (indexY - startIndexY + size) % size;
+        const double halfLength = parameters.length / 2.;
+
+        positionX = parameters.positionX + halfLength -
+                (unwrappedX + 0.5) * parameters.resolution;
+        positionY = parameters.positionY + halfLength -
+                (unwrappedY + 0.5) * parameters.resolution;
+    }
+};
+
+/** Compact copy of a map snapshot, e.g. to be sent to another process. The
+  * mean elevation is stored as 16-bit fixed-point values relative to an
+  * offset, the known cells as a bitmask and the variance as 8-bit values
+  * quantized logarithmically, which takes 3 instead of 8 bytes per cell.
+  */
+struct CompactMapSnapshot {
+    /// Parameters of the map at the time the snapshot was taken
+    MapParameters parameters;
+
+    /// Start index of the map's circular buffer
+    int startIndexX = 0;
+    int startIndexY = 0;
+
+    /// Whether the map was valid at the time the snapshot was taken
+    bool valid = false;
+
+    /// Timestamp and version of the map at the time the snapshot was taken
+    Time timestamp = 0;
+    uint64_t version = 0;
+
+    /// Elevation corresponding to the value 0 and elevation of one step of
+    /// the fixed-point values in meters
+    float elevationOffset = 0.f;
+    float elevationStep = 0.f;
+
+    /// Fixed-point mean elevation of each cell (0 for unknown cells)
+    std::vector<int16_t> meanZ;
+
+    /// Bitmask of the known cells, 64 cells per word
+    std::vector<uint64_t> knownCells;
+
+    /// Logarithmically quantized variance of each cell
+    std::vector<uint8_t> varianceZ;
+};
+
+/** Contains the cells of the map that changed since a given version, so that
+  * consumers can update their own copy of the map without a full-map pass.
+  * The cells are identified by their linear index in the circular buffer,
+  * which keeps pointing to the same position in the world while the map is
+  * translated, and the changed region is given in unwrapped indices (the rows
+  * and columns of the image of the map).
+  */
+struct MapChangeSet {
+    /// Version of the map the change set is up to date with
+    uint64_t version = 0;
+
+    /// Whether every cell of the map changed (e.g. the requested version is
+    /// older than the tracked changes), in which case all cells are listed
+    bool full = false;
+
+    /// Parameters of the map at the time the change set was taken
+    MapParameters parameters;
+
+    /// Start index of the map's circular buffer
+    int startIndexX = 0;
+    int startIndexY = 0;
+
+    /// Bounding box of the changed cells in unwrapped indices (empty if no
+    /// cell changed)
+    int regionIndexX = 0;
+    int regionIndexY = 0;
+    int regionSizeX = 0;
+    int regionSizeY = 0;
+
+    /// Linear indices of the changed cells in ascending order along with
+    /// their mean and variance elevation values
+    std::vector<int> cellIndices;
+    std::vector<float> meanZ;
+    std::vector<float> varianceZ;
+};
+
 /** Wrapper for the GridMap class that extends its functionality in the
   * context of the GA SLAM library.
   */
@@ -121,6 +285,11 @@ class Map {
     /// Returns the structure containing the map's parameters
     MapParameters getParameters(void) const;
 
+    /** Copies the map's data layers and geometry to a snapshot
+      * @param[out] snapshot the snapshot to be filled
+      */
+    void getSnapshot(MapSnapshot& snapshot) const;
+
     /** Finds the map's linear index that corresponds to a specific position
       * @param[in] positionX the x coordinate of the position
       * @param[in] positionY the y coordinate of the position
@@ -132,6 +301,30 @@ class Map {
             double positionY,
             size_t& index) const;
 
+    /** Finds the linear indices of the cells that correspond to multiple
+      * positions at once, using the same convention as getIndexFromPosition
+      * @param[in] positions the matrix whose columns hold the positions (only
+      *            the first two rows, x and y, are used)
+      * @param[out] indices the linear index matching to each position or -1
+      *             if the position lies outside the map
+      */
+    void getIndicesFromPositions(
+            const Eigen::Ref<const Eigen::MatrixXf, 0, Eigen::OuterStride<>>&
+                    positions,
+            Eigen::ArrayXi& indices) const;
+
+    /** Finds the linear indices of the cells that correspond to multiple
+      * positions like the overloaded function, writing them to existing
+      * storage so that no memory is allocated
+      * @param[in] positions the matrix whose columns hold the positions
+      * @param[out] indices the linear index matching to each position or -1
+      *             (must have as many elements as the positions)
+      */
+    void getIndicesFromPositions(
+            const Eigen::Ref<const Eigen::MatrixXf, 0, Eigen::OuterStride<>>&
+                    positions,
+            Eigen::Ref<Eigen::ArrayXi> indices) const;
+
     /** Finds the 3D point that corresponds to the map's array (2D) index
       * @param[in] arrayIndex the array index of the point
       * @param[in] layerData the layer's data matrix
@@ -151,7 +344,31 @@ class Map {
       */
     void translate(const Eigen::Vector3d& translation, bool moveData);
 
+    /** Translates the map like the overloaded function and returns the
+      * regions of the circular buffer that were emptied
+      * @param[in] translation the translation to be applied to the map
+      * @param[in] moveData whether to move and keep the data or empty the
+      *            cells that fall out of the map
+      * @param[out] clearedRegions the regions of the emptied cells (none if
+      *             the data were moved)
+      */
+    void translate(
+            const Eigen::Vector3d& translation,
+            bool moveData,
+            std::vector<grid_map::BufferRegion>& clearedRegions);
+
   protected:
+    /** Sets the cells of a region of the circular buffer to NaN and appends
+      * the region to the list of the emptied ones
+      * @param[in] index the first cell of the region in the buffer
+      * @param[in] size the number of rows and columns of the region
+      * @param[out] clearedRegions the list the region is appended to
+      */
+    void clearBufferRegion(
+            const grid_map::Index& index,
+            const grid_map::Size& size,
+            std::vector<grid_map::BufferRegion>& clearedRegions);
+
     /// Instance of the wrapped GridMap class
     GridMap gridMap_;
 
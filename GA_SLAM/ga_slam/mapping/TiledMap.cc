@@ -0,0 +1,253 @@
+/*
+ * This file is part of GA SLAM.
+ * Copyright (C) 2018 Dimitris Geromichalos,
+ * Planetary Robotics Lab (PRL), European Space Agency (ESA)
+ *
+ * GA SLAM is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GA SLAM is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GA SLAM. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "ga_slam/mapping/TiledMap.h"
+
+// GA SLAM
+#include "ga_slam/TypeDefs.h"
+#include "ga_slam/processing/MapCompression.h"
+
+// OpenCV
+#include <opencv2/core/core.hpp>
+
+// POSIX
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// STL
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <limits>
+#include <cstring>
+#include <cstdint>
+#include <cmath>
+#include <mutex>
+
+namespace ga_slam {
+
+bool TiledMap::open(const std::string& filename, int maxResidentTiles) {
+    close();
+
+    const int fileDescriptor = ::open(filename.c_str(), O_RDONLY);
+    if (fileDescriptor < 0) return false;
+
+    TiledMapHeader header;
+    std::vector<uint64_t> tileOffsets;
+    struct stat fileStatus;
+
+    bool valid = ::fstat(fileDescriptor, &fileStatus) == 0 &&
+            ::pread(fileDescriptor, &header, sizeof(header), 0) ==
+                    static_cast<ssize_t>(sizeof(header));
+
+    valid = valid &&
+            !std::memcmp(header.magic, tiledMapMagic, sizeof(header.magic)) &&
+            (header.version == tiledMapVersion ||
+                    header.version == compactTiledMapVersion) &&
+            header.tileSize > 0 &&
+            header.resolution > 0.;
+
+    // The cells of the map are indexed with ints while extracting an image
+    constexpr uint64_t maxNumCells = std::numeric_limits<int>::max();
+    valid = valid &&
+            static_cast<uint64_t>(header.numTilesX) * header.tileSize <=
+                    maxNumCells &&
+            static_cast<uint64_t>(header.numTilesY) * header.tileSize <=
+                    maxNumCells;
+
+    if (valid) {
+        const uint64_t fileSize = fileStatus.st_size;
+        const uint64_t numTiles = static_cast<uint64_t>(header.numTilesX) *
+                header.numTilesY;
+        const uint64_t tableSize = numTiles * sizeof(uint64_t);
+        const uint64_t tileBytes = header.getTileBytes();
+
+        valid = numTiles <= maxNumCells &&
+                tableSize <= fileSize - sizeof(header);
+
+        if (valid) {
+            tileOffsets.resize(numTiles);
+            valid = ::pread(fileDescriptor, tileOffsets.data(), tableSize,
+                    sizeof(header)) == static_cast<ssize_t>(tableSize);
+        }
+
+        for (size_t i = 0; valid && i < numTiles; ++i)
+            valid = tileBytes <= fileSize &&
+                    tileOffsets[i] <= fileSize - tileBytes &&
+                    (!header.isCompact() || tileOffsets[i] % 8 == 0);
+    }
+
+    if (!valid) {
+        ::close(fileDescriptor);
+        return false;
+    }
+
+    std::lock_guard<std::mutex> guard(mutex_);
+    fileDescriptor_ = fileDescriptor;
+    header_ = header;
+    tileOffsets_ = std::move(tileOffsets);
+    maxResidentTiles_ = std::max(1, maxResidentTiles);
+    numTileLoads_ = 0;
+
+    return true;
+}
+
+void TiledMap::close(void) {
+    std::lock_guard<std::mutex> guard(mutex_);
+    if (fileDescriptor_ < 0) return;
+
+    unmapTiles();
+    ::close(fileDescriptor_);
+    fileDescriptor_ = -1;
+    tileOffsets_.clear();
+}
+
+void TiledMap::extractImage(
+        double positionX,
+        double positionY,
+        int size,
+        Image& image,
+        double& centerX,
+        double& centerY) {
+    const int halfSize = (std::max(size, 0) + 1) / 2;
+    image = Image(2 * halfSize, 2 * halfSize, CV_32FC1,
+            cv::Scalar(std::numeric_limits<float>::quiet_NaN()));
+
+    std::lock_guard<std::mutex> guard(mutex_);
+
+    centerX = positionX;
+    centerY = positionY;
+    if (fileDescriptor_ < 0) return;
+
+    const double resolution = header_.resolution;
+    const int tileSize = header_.tileSize;
+    const int centerRow = std::round((header_.cornerX - positionX) /
+            resolution);
+    const int centerCol = std::round((header_.cornerY - positionY) /
+            resolution);
+
+    centerX = header_.cornerX - centerRow * resolution;
+    centerY = header_.cornerY - centerCol * resolution;
+
+    const int firstRow = centerRow - halfSize;
+    const int firstCol = centerCol - halfSize;
+    const int endRow = std::min<int>(firstRow + image.rows,
+            header_.numTilesX * tileSize);
+    const int endCol = std::min<int>(firstCol + image.cols,
+            header_.numTilesY * tileSize);
+    if (endRow <= 0 || endCol <= 0) return;
+
+    for (int tileX = std::max(firstRow, 0) / tileSize;
+            tileX * tileSize < endRow; ++tileX) {
+        for (int tileY = std::max(firstCol, 0) / tileSize;
+                tileY * tileSize < endCol; ++tileY) {
+            const float* tileData = getTile(tileX * header_.numTilesY + tileY);
+            if (!tileData) continue;
+
+            const int rowBegin = std::max(firstRow, tileX * tileSize);
+            const int rowEnd = std::min(endRow, (tileX + 1) * tileSize);
+            const int colBegin = std::max(firstCol, tileY * tileSize);
+            const int colEnd = std::min(endCol, (tileY + 1) * tileSize);
+
+            for (int row = rowBegin; row < rowEnd; ++row) {
+                const float* tileRowData = tileData +
+                        (row - tileX * tileSize) * tileSize +
+                        colBegin - tileY * tileSize;
+
+                std::copy(tileRowData, tileRowData + colEnd - colBegin,
+                        image.ptr<float>(row - firstRow) + colBegin - firstCol);
+            }
+        }
+    }
+}
+
+const float* TiledMap::getTile(int tileIndex) {
+    const uint64_t tileOffset = tileOffsets_[tileIndex];
+    if (!tileOffset) return nullptr;
+
+    const char* tileData = nullptr;
+    auto residentTile = residentTiles_.find(tileIndex);
+
+    if (residentTile != residentTiles_.end()) {
+        tileUsage_.splice(tileUsage_.begin(), tileUsage_,
+                residentTile->second.usage);
+        tileData = residentTile->second.data;
+    } else {
+        tileData = mapTile(tileIndex, tileOffset);
+        if (!tileData) return nullptr;
+    }
+
+    if (!header_.isCompact())
+        return reinterpret_cast<const float*>(tileData);
+
+    const size_t numCells = static_cast<size_t>(header_.tileSize) *
+            header_.tileSize;
+    tileBuffer_.resize(numCells);
+
+    const float* quantization = reinterpret_cast<const float*>(tileData);
+    const uint64_t* knownMask = reinterpret_cast<const uint64_t*>(
+            tileData + 2 * sizeof(float));
+    const int16_t* packedValues = reinterpret_cast<const int16_t*>(
+            knownMask + (numCells + 63) / 64);
+
+    MapCompression::unpackElevation(packedValues, knownMask, numCells,
+            quantization[0], quantization[1], tileBuffer_.data());
+
+    return tileBuffer_.data();
+}
+
+const char* TiledMap::mapTile(int tileIndex, uint64_t tileOffset) {
+    while (static_cast<int>(residentTiles_.size()) >= maxResidentTiles_) {
+        const int leastUsedIndex = tileUsage_.back();
+        const auto& leastUsedTile = residentTiles_[leastUsedIndex];
+
+        ::munmap(leastUsedTile.mapping, leastUsedTile.length);
+        residentTiles_.erase(leastUsedIndex);
+        tileUsage_.pop_back();
+    }
+
+    const uint64_t pageSize = ::sysconf(_SC_PAGESIZE);
+    const uint64_t mappingOffset = tileOffset - tileOffset % pageSize;
+
+    ResidentTile tile;
+    tile.length = header_.getTileBytes() + tileOffset - mappingOffset;
+    tile.mapping = ::mmap(nullptr, tile.length, PROT_READ, MAP_PRIVATE,
+            fileDescriptor_, mappingOffset);
+    if (tile.mapping == MAP_FAILED) return nullptr;
+
+    tile.data = static_cast<const char*>(tile.mapping) + tileOffset -
+            mappingOffset;
+    tile.usage = tileUsage_.insert(tileUsage_.begin(), tileIndex);
+    residentTiles_[tileIndex] = tile;
+    numTileLoads_++;
+
+    return tile.data;
+}
+
+void TiledMap::unmapTiles(void) {
+    for (const auto& residentTile : residentTiles_)
+        ::munmap(residentTile.second.mapping, residentTile.second.length);
+
+    residentTiles_.clear();
+    tileUsage_.clear();
+}
+
+}  // namespace ga_slam
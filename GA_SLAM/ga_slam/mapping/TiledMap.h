@@ -0,0 +1,226 @@
+/*
+ * This file is part of GA SLAM.
+ * Copyright (C) 2018 Dimitris Geromichalos,
+ * Planetary Robotics Lab (PRL), European Space Agency (ESA)
+ *
+ * GA SLAM is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GA SLAM is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GA SLAM. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+// GA SLAM
+#include "ga_slam/TypeDefs.h"
+
+// STL
+#include <string>
+#include <vector>
+#include <list>
+#include <unordered_map>
+#include <mutex>
+#include <cstddef>
+#include <cstdint>
+
+namespace ga_slam {
+
+/// Identifier of the tiled map file format and versions with float and
+/// compact tiles
+constexpr char tiledMapMagic[] = "GASLAMTM";
+constexpr uint32_t tiledMapVersion = 1;
+constexpr uint32_t compactTiledMapVersion = 2;
+
+/** Header of a tiled map file. It is followed by a table with the file offset
+  * of each tile (0 for the tiles without data) and by the tiles, each holding
+  * the mean elevation of its cells (NaN if unknown) row by row. The rows are
+  * ordered by decreasing x and the columns by decreasing y, like the rows and
+  * columns of the image of a map. Compact tiles instead hold the elevation
+  * offset and step of the tile (two floats), the bitmask of the known cells
+  * and the 16-bit fixed-point elevation of the cells (see MapCompression),
+  * padded to a multiple of 8 bytes.
+  */
+struct TiledMapHeader {
+    /// Identifier of the file format
+    char magic[8];
+
+    /// Version of the file format
+    uint32_t version;
+
+    /// Number of cells of one dimension of a square tile
+    uint32_t tileSize;
+
+    /// Number of tiles along the rows (x) and the columns (y)
+    uint32_t numTilesX;
+    uint32_t numTilesY;
+
+    /// Resolution of each square cell in meters
+    double resolution;
+
+    /// Position of the corner of the map with the maximum x and y
+    double cornerX;
+    double cornerY;
+
+    /// Returns whether the tiles are stored in the compact format
+    bool isCompact(void) const { return version == compactTiledMapVersion; }
+
+    /// Returns the number of bytes of a tile in the file
+    size_t getTileBytes(void) const {
+        const uint64_t numCells = static_cast<uint64_t>(tileSize) * tileSize;
+        if (!isCompact()) return numCells * sizeof(float);
+
+        const uint64_t numBytes = 2 * sizeof(float) +
+                (numCells + 63) / 64 * sizeof(uint64_t) +
+                numCells * sizeof(int16_t);
+
+        return (numBytes + 7) / 8 * 8;
+    }
+};
+
+/** Global elevation map stored on disk in fixed-size tiles, which are memory
+  * mapped lazily when a region of the map is requested. At most a maximum
+  * number of tiles are mapped at any time and the least recently used one is
+  * unmapped to make space for a new one, so that the memory used is bounded
+  * regardless of the size of the map.
+  */
+class TiledMap {
+  public:
+    /// Instantiates a closed map
+    TiledMap(void)
+        : fileDescriptor_(-1),
+          maxResidentTiles_(0),
+          numTileLoads_(0) {}
+
+    /// Unmaps the resident tiles and closes the file
+    ~TiledMap(void) { close(); }
+
+    /// Delete the default copy/move constructors and operators
+    TiledMap(const TiledMap&) = delete;
+    TiledMap& operator=(const TiledMap&) = delete;
+    TiledMap(TiledMap&&) = delete;
+    TiledMap& operator=(TiledMap&&) = delete;
+
+    /** Opens a tiled map file, reading only its header and tile table
+      * @param[in] filename the path of the file
+      * @param[in] maxResidentTiles the maximum number of mapped tiles
+      * @return true if the file is a valid tiled map
+      */
+    bool open(const std::string& filename, int maxResidentTiles);
+
+    /// Unmaps the resident tiles and closes the file
+    void close(void);
+
+    /// Returns whether a file is open
+    bool isOpen(void) const {
+        std::lock_guard<std::mutex> guard(mutex_);
+        return fileDescriptor_ >= 0;
+    }
+
+    /// Returns the header of the open file
+    TiledMapHeader getHeader(void) const {
+        std::lock_guard<std::mutex> guard(mutex_);
+        return header_;
+    }
+
+    /// Returns the number of the currently mapped tiles
+    size_t getNumResidentTiles(void) const {
+        std::lock_guard<std::mutex> guard(mutex_);
+        return residentTiles_.size();
+    }
+
+    /// Returns the number of times a tile was mapped
+    uint64_t getNumTileLoads(void) const {
+        std::lock_guard<std::mutex> guard(mutex_);
+        return numTileLoads_;
+    }
+
+    /** Extracts a square elevation image around a position, mapping the
+      * tiles it overlaps if needed. The image is aligned to the cells of the
+      * map, so its center is the corner of a cell closest to the position
+      * @param[in] positionX the x coordinate of the position
+      * @param[in] positionY the y coordinate of the position
+      * @param[in] size the number of cells of one dimension of the image
+      *            (rounded up to an even number)
+      * @param[out] image the elevation image (NaN for unknown cells and
+      *             cells outside the map)
+      * @param[out] centerX the x coordinate of the image's center
+      * @param[out] centerY the y coordinate of the image's center
+      */
+    void extractImage(
+            double positionX,
+            double positionY,
+            int size,
+            Image& image,
+            double& centerX,
+            double& centerY);
+
+  protected:
+    /** Returns the elevation of the cells of a tile, mapping it and unmapping
+      * the least recently used tile if needed. Compact tiles are decoded to
+      * a buffer that is valid until the next call
+      * @param[in] tileIndex the index of the tile in the tile table
+      * @return the elevation data of the tile or null if it has no data
+      */
+    const float* getTile(int tileIndex);
+
+    /** Maps a tile in memory, unmapping the least recently used tile if the
+      * maximum number of mapped tiles is reached
+      * @param[in] tileIndex the index of the tile in the tile table
+      * @param[in] tileOffset the file offset of the tile
+      * @return the data of the tile or null if the mapping failed
+      */
+    const char* mapTile(int tileIndex, uint64_t tileOffset);
+
+    /// Unmaps all the resident tiles
+    void unmapTiles(void);
+
+  protected:
+    /// Tile mapped in memory
+    struct ResidentTile {
+        /// Start and length of the mapping (aligned to the page size)
+        void* mapping;
+        size_t length;
+
+        /// Data of the tile within the mapping
+        const char* data;
+
+        /// Position of the tile in the least recently used list
+        std::list<int>::iterator usage;
+    };
+
+    /// File descriptor of the open file (negative if closed)
+    int fileDescriptor_;
+
+    /// Header of the open file
+    TiledMapHeader header_;
+
+    /// File offset of each tile (0 for the tiles without data)
+    std::vector<uint64_t> tileOffsets_;
+
+    /// Maximum number of mapped tiles
+    int maxResidentTiles_;
+
+    /// Mapped tiles by index and their indices from the most to the least
+    /// recently used
+    std::unordered_map<int, ResidentTile> residentTiles_;
+    std::list<int> tileUsage_;
+
+    /// Number of times a tile was mapped
+    uint64_t numTileLoads_;
+
+    /// Elevation of the last decoded compact tile
+    std::vector<float> tileBuffer_;
+
+    /// Mutex protecting the file and the resident tiles
+    mutable std::mutex mutex_;
+};
+
+}  // namespace ga_slam
@@ -0,0 +1,206 @@
+/*
+ * This file is part of GA SLAM.
+ * Copyright (C) 2018 Dimitris Geromichalos,
+ * Planetary Robotics Lab (PRL), European Space Agency (ESA)
+ *
+ * GA SLAM is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GA SLAM is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GA SLAM. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "ga_slam/mapping/TiledMapBuilder.h"
+
+// GA SLAM
+#include "ga_slam/TypeDefs.h"
+#include "ga_slam/mapping/TiledMap.h"
+#include "ga_slam/processing/MapCompression.h"
+
+// PCL
+#include <pcl/point_types.h>
+#include <pcl/point_cloud.h>
+
+// STL
+#include <string>
+#include <vector>
+#include <memory>
+#include <fstream>
+#include <algorithm>
+#include <limits>
+#include <cstring>
+#include <cstdint>
+#include <cmath>
+
+namespace ga_slam {
+
+bool TiledMapBuilder::writeCloud(
+        const std::string& filename,
+        const Cloud& cloud,
+        double resolution,
+        int tileSize,
+        double elevationStep) {
+    double minX = std::numeric_limits<double>::max();
+    double minY = std::numeric_limits<double>::max();
+    double maxX = std::numeric_limits<double>::lowest();
+    double maxY = std::numeric_limits<double>::lowest();
+
+    for (const auto& point : cloud) {
+        if (!std::isfinite(point.x) || !std::isfinite(point.y) ||
+                !std::isfinite(point.z))
+            continue;
+
+        minX = std::min<double>(minX, point.x);
+        minY = std::min<double>(minY, point.y);
+        maxX = std::max<double>(maxX, point.x);
+        maxY = std::max<double>(maxY, point.y);
+    }
+
+    if (minX > maxX) return false;
+
+    TiledMapBuilder builder;
+    builder.configure(minX, maxX, minY, maxY, resolution, tileSize,
+            elevationStep);
+    builder.addCloud(cloud);
+
+    return builder.write(filename);
+}
+
+void TiledMapBuilder::configure(
+        double minX,
+        double maxX,
+        double minY,
+        double maxY,
+        double resolution,
+        int tileSize,
+        double elevationStep) {
+    tiles_.clear();
+    if (resolution <= 0. || tileSize <= 0 || minX > maxX || minY > maxY)
+        return;
+
+    std::memcpy(header_.magic, tiledMapMagic, sizeof(header_.magic));
+    header_.version = elevationStep > 0. ? compactTiledMapVersion :
+            tiledMapVersion;
+    header_.tileSize = tileSize;
+    header_.resolution = resolution;
+    header_.cornerX = (std::floor(maxX / resolution) + 1.) * resolution;
+    header_.cornerY = (std::floor(maxY / resolution) + 1.) * resolution;
+
+    const int numRows = std::floor((header_.cornerX - minX) / resolution) + 1;
+    const int numCols = std::floor((header_.cornerY - minY) / resolution) + 1;
+    header_.numTilesX = (numRows + tileSize - 1) / tileSize;
+    header_.numTilesY = (numCols + tileSize - 1) / tileSize;
+    elevationStep_ = elevationStep;
+
+    tiles_.resize(header_.numTilesX * header_.numTilesY);
+}
+
+void TiledMapBuilder::addCloud(const Cloud& cloud) {
+    if (tiles_.empty()) return;
+
+    const double resolution = header_.resolution;
+    const int tileSize = header_.tileSize;
+    const int numRows = header_.numTilesX * tileSize;
+    const int numCols = header_.numTilesY * tileSize;
+
+    for (const auto& point : cloud) {
+        if (!std::isfinite(point.x) || !std::isfinite(point.y) ||
+                !std::isfinite(point.z))
+            continue;
+
+        const double row = std::floor((header_.cornerX - point.x) /
+                resolution);
+        const double col = std::floor((header_.cornerY - point.y) /
+                resolution);
+        if (row < 0. || row >= numRows || col < 0. || col >= numCols)
+            continue;
+
+        const int tileX = row / tileSize;
+        const int tileY = col / tileSize;
+        auto& tile = tiles_[tileX * header_.numTilesY + tileY];
+
+        if (!tile) {
+            tile.reset(new TileAccumulator);
+            tile->elevationMeans.assign(tileSize * tileSize,
+                    std::numeric_limits<float>::quiet_NaN());
+            tile->pointCounts.assign(tileSize * tileSize, 0);
+        }
+
+        const int cell = (row - tileX * tileSize) * tileSize +
+                col - tileY * tileSize;
+        auto& count = tile->pointCounts[cell];
+        auto& mean = tile->elevationMeans[cell];
+
+        if (count < std::numeric_limits<uint16_t>::max()) count++;
+
+        if (count == 1)
+            mean = point.z;
+        else
+            mean += (point.z - mean) / count;
+    }
+}
+
+bool TiledMapBuilder::write(const std::string& filename) {
+    if (tiles_.empty()) return false;
+
+    std::ofstream file(filename, std::ios::binary | std::ios::trunc);
+    if (!file) return false;
+
+    const size_t numTiles = tiles_.size();
+    const size_t numTileCells = header_.tileSize * header_.tileSize;
+    const size_t numMaskWords = (numTileCells + 63) / 64;
+    std::vector<uint64_t> tileOffsets(numTiles, 0);
+    std::vector<char> compactTileData(header_.getTileBytes(), 0);
+
+    file.write(reinterpret_cast<const char*>(&header_), sizeof(header_));
+    const auto tableOffset = file.tellp();
+    file.write(reinterpret_cast<const char*>(tileOffsets.data()),
+            numTiles * sizeof(uint64_t));
+
+    for (size_t tileIndex = 0; tileIndex < numTiles; ++tileIndex) {
+        auto& tile = tiles_[tileIndex];
+        if (!tile) continue;
+
+        const auto& tileData = tile->elevationMeans;
+        tileOffsets[tileIndex] = file.tellp();
+
+        if (header_.isCompact()) {
+            float* quantization = reinterpret_cast<float*>(
+                    compactTileData.data());
+            uint64_t* knownMask = reinterpret_cast<uint64_t*>(
+                    compactTileData.data() + 2 * sizeof(float));
+            int16_t* packedValues = reinterpret_cast<int16_t*>(
+                    knownMask + numMaskWords);
+
+            MapCompression::calculateElevationQuantization(tileData.data(),
+                    numTileCells, elevationStep_, quantization[0],
+                    quantization[1]);
+            MapCompression::packElevation(tileData.data(), numTileCells,
+                    quantization[0], quantization[1], packedValues, knownMask);
+
+            file.write(compactTileData.data(), compactTileData.size());
+        } else {
+            file.write(reinterpret_cast<const char*>(tileData.data()),
+                    numTileCells * sizeof(float));
+        }
+
+        tile.reset();
+    }
+
+    tiles_.clear();
+
+    file.seekp(tableOffset);
+    file.write(reinterpret_cast<const char*>(tileOffsets.data()),
+            numTiles * sizeof(uint64_t));
+
+    return file.good();
+}
+
+}  // namespace ga_slam
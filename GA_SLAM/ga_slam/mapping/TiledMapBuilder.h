@@ -0,0 +1,126 @@
+/*
+ * This file is part of GA SLAM.
+ * Copyright (C) 2018 Dimitris Geromichalos,
+ * Planetary Robotics Lab (PRL), European Space Agency (ESA)
+ *
+ * GA SLAM is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GA SLAM is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GA SLAM. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+// GA SLAM
+#include "ga_slam/TypeDefs.h"
+#include "ga_slam/mapping/TiledMap.h"
+
+// PCL
+#include <pcl/point_types.h>
+#include <pcl/point_cloud.h>
+
+// STL
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdint>
+
+namespace ga_slam {
+
+/** Builder of tiled map files from point clouds received in chunks. Each
+  * chunk is accumulated into the tiles it covers as it arrives, so that the
+  * whole cloud never needs to be in memory. Only the tiles that received
+  * points are allocated and each cell's elevation is the mean of its points.
+  * An allocated tile takes 6 bytes per cell until the map is written, which
+  * is 1.5 times a float tile and 3 times a compact one.
+  */
+class TiledMapBuilder {
+  public:
+    /// Instantiates an empty builder
+    TiledMapBuilder(void) = default;
+
+    /// Delete the default copy/move constructors and operators
+    TiledMapBuilder(const TiledMapBuilder&) = delete;
+    TiledMapBuilder& operator=(const TiledMapBuilder&) = delete;
+    TiledMapBuilder(TiledMapBuilder&&) = delete;
+    TiledMapBuilder& operator=(TiledMapBuilder&&) = delete;
+
+    /** Writes a point cloud to a tiled map file covering the cloud's extent
+      * @param[in] filename the path of the file to be written
+      * @param[in] cloud the point cloud to be written
+      * @param[in] resolution the resolution of the map in meters
+      * @param[in] tileSize the number of cells of one dimension of a tile
+      * @param[in] elevationStep the elevation precision of compact tiles in
+      *            meters (0 for float tiles)
+      * @return true if the file was written
+      */
+    static bool writeCloud(
+            const std::string& filename,
+            const Cloud& cloud,
+            double resolution,
+            int tileSize,
+            double elevationStep = 0.);
+
+    /** Starts a new map covering a rectangular area and discards the
+      * accumulated tiles of the previous one
+      * @param[in] minX the minimum x coordinate of the area
+      * @param[in] maxX the maximum x coordinate of the area
+      * @param[in] minY the minimum y coordinate of the area
+      * @param[in] maxY the maximum y coordinate of the area
+      * @param[in] resolution the resolution of the map in meters
+      * @param[in] tileSize the number of cells of one dimension of a tile
+      * @param[in] elevationStep the elevation precision of compact tiles in
+      *            meters (0 for float tiles), which is increased for the
+      *            tiles whose elevation range cannot be covered
+      */
+    void configure(
+            double minX,
+            double maxX,
+            double minY,
+            double maxY,
+            double resolution,
+            int tileSize,
+            double elevationStep = 0.);
+
+    /** Accumulates a chunk of the point cloud into the tiles of the map.
+      * Points outside the configured area are ignored
+      * @param[in] cloud the chunk of the point cloud
+      */
+    void addCloud(const Cloud& cloud);
+
+    /** Writes the accumulated tiles to a tiled map file and releases them,
+      * so that the builder must be configured again for a new map
+      * @param[in] filename the path of the file to be written
+      * @return true if the file was written
+      */
+    bool write(const std::string& filename);
+
+  protected:
+    /// Running means of the elevations of the points of each cell of a tile
+    /// (NaN for the cells without points) and their number, which saturates
+    /// so that the mean of a crowded cell becomes a moving average
+    struct TileAccumulator {
+        std::vector<float> elevationMeans;
+        std::vector<uint16_t> pointCounts;
+    };
+
+  protected:
+    /// Header of the map being built
+    TiledMapHeader header_;
+
+    /// Elevation precision of the compact tiles in meters
+    double elevationStep_ = 0.;
+
+    /// Accumulators of the tiles (null for the tiles without points)
+    std::vector<std::unique_ptr<TileAccumulator>> tiles_;
+};
+
+}  // namespace ga_slam
@@ -0,0 +1,191 @@
+/*
+ * This file is part of GA SLAM.
+ * Copyright (C) 2018 Dimitris Geromichalos,
+ * Planetary Robotics Lab (PRL), European Space Agency (ESA)
+ *
+ * GA SLAM is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GA SLAM is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GA SLAM. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "ga_slam/processing/CloudGrid.h"
+
+// GA SLAM
+#include "ga_slam/TypeDefs.h"
+
+// PCL
+#include <pcl/point_types.h>
+#include <pcl/point_cloud.h>
+
+// STL
+#include <vector>
+#include <algorithm>
+#include <limits>
+#include <cstdint>
+#include <cmath>
+
+namespace ga_slam {
+
+namespace {
+
+bool isFinite(const pcl::PointXYZ& point) {
+    return std::isfinite(point.x) && std::isfinite(point.y) &&
+            std::isfinite(point.z);
+}
+
+}  // namespace
+
+void CloudGrid::setInputCloud(const Cloud::ConstPtr& cloud) {
+    cloud_ = cloud;
+    numCellsX_ = 0;
+    numCellsY_ = 0;
+
+    const size_t numPoints = cloud->size();
+    float minX = std::numeric_limits<float>::max();
+    float minY = std::numeric_limits<float>::max();
+    float maxX = std::numeric_limits<float>::lowest();
+    float maxY = std::numeric_limits<float>::lowest();
+    size_t numFinitePoints = 0;
+
+    for (const auto& point : cloud->points) {
+        if (!isFinite(point)) continue;
+
+        minX = std::min(minX, point.x);
+        minY = std::min(minY, point.y);
+        maxX = std::max(maxX, point.x);
+        maxY = std::max(maxY, point.y);
+        numFinitePoints++;
+    }
+
+    if (!numFinitePoints) return;
+
+    const float width = maxX - minX;
+    const float height = maxY - minY;
+
+    cellSize_ = std::max({std::sqrt(width * height / numFinitePoints),
+            width / numFinitePoints, height / numFinitePoints});
+    if (!(cellSize_ > 0.f)) cellSize_ = 1.f;
+
+    originX_ = minX;
+    originY_ = minY;
+    numCellsX_ = static_cast<int>(width / cellSize_) + 1;
+    numCellsY_ = static_cast<int>(height / cellSize_) + 1;
+
+    const size_t numCells = static_cast<size_t>(numCellsX_) * numCellsY_;
+    cellStarts_.assign(numCells + 1, 0);
+    pointCells_.resize(numPoints);
+
+    for (size_t i = 0; i < numPoints; ++i) {
+        const auto& point = cloud->points[i];
+
+        if (!isFinite(point)) {
+            pointCells_[i] = -1;
+            continue;
+        }
+
+        const int cellX = std::min(static_cast<int>(
+                (point.x - originX_) / cellSize_), numCellsX_ - 1);
+        const int cellY = std::min(static_cast<int>(
+                (point.y - originY_) / cellSize_), numCellsY_ - 1);
+
+        pointCells_[i] = cellX + cellY * numCellsX_;
+        cellStarts_[pointCells_[i] + 1]++;
+    }
+
+    for (size_t cell = 1; cell <= numCells; ++cell)
+        cellStarts_[cell] += cellStarts_[cell - 1];
+
+    pointIndices_.resize(numFinitePoints);
+
+    for (size_t i = 0; i < numPoints; ++i)
+        if (pointCells_[i] >= 0)
+            pointIndices_[cellStarts_[pointCells_[i]]++] = i;
+
+    for (size_t cell = numCells; cell > 0; --cell)
+        cellStarts_[cell] = cellStarts_[cell - 1];
+    cellStarts_[0] = 0;
+}
+
+int CloudGrid::nearestSearch(
+        const pcl::PointXYZ& point,
+        float& squaredDistance) const {
+    if (!numCellsX_ || !isFinite(point)) return -1;
+
+    const auto clampCell = [] (float position, int numCells) {
+        if (!(position > 0.f)) return 0;
+        if (position >= numCells) return numCells - 1;
+        return static_cast<int>(position);
+    };
+
+    const int cellX = clampCell((point.x - originX_) / cellSize_, numCellsX_);
+    const int cellY = clampCell((point.y - originY_) / cellSize_, numCellsY_);
+
+    float bestSquaredDistance = std::numeric_limits<float>::max();
+    int bestIndex = -1;
+
+    const auto searchCell = [&] (int x, int y) {
+        const int cell = x + y * numCellsX_;
+
+        for (uint32_t i = cellStarts_[cell]; i < cellStarts_[cell + 1]; ++i) {
+            const auto& neighbor = cloud_->points[pointIndices_[i]];
+            const float dx = neighbor.x - point.x;
+            const float dy = neighbor.y - point.y;
+            const float dz = neighbor.z - point.z;
+            const float distance = dx * dx + dy * dy + dz * dz;
+
+            if (distance < bestSquaredDistance) {
+                bestSquaredDistance = distance;
+                bestIndex = pointIndices_[i];
+            }
+        }
+    };
+
+    for (int ring = 0; ; ++ring) {
+        const int minX = cellX - ring, maxX = cellX + ring;
+        const int minY = cellY - ring, maxY = cellY + ring;
+        const int beginX = std::max(minX, 0);
+        const int endX = std::min(maxX, numCellsX_ - 1);
+
+        for (int y = std::max(minY, 0); y <= std::min(maxY, numCellsY_ - 1);
+                ++y) {
+            if (y == minY || y == maxY) {
+                for (int x = beginX; x <= endX; ++x) searchCell(x, y);
+            } else {
+                if (minX >= 0) searchCell(minX, y);
+                if (maxX < numCellsX_) searchCell(maxX, y);
+            }
+        }
+
+        // The points left are beyond the sides of the searched block of
+        // cells that have not reached the grid's borders
+        float bound = std::numeric_limits<float>::max();
+        if (minX > 0)
+            bound = std::min(bound, point.x - (originX_ + minX * cellSize_));
+        if (maxX < numCellsX_ - 1)
+            bound = std::min(bound,
+                    originX_ + (maxX + 1) * cellSize_ - point.x);
+        if (minY > 0)
+            bound = std::min(bound, point.y - (originY_ + minY * cellSize_));
+        if (maxY < numCellsY_ - 1)
+            bound = std::min(bound,
+                    originY_ + (maxY + 1) * cellSize_ - point.y);
+
+        if (bound == std::numeric_limits<float>::max()) break;
+        if (bound > 0.f && bound * bound >= bestSquaredDistance) break;
+    }
+
+    squaredDistance = bestSquaredDistance;
+
+    return bestIndex;
+}
+
+}  // namespace ga_slam
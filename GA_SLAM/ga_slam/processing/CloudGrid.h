@@ -0,0 +1,94 @@
+/*
+ * This file is part of GA SLAM.
+ * Copyright (C) 2018 Dimitris Geromichalos,
+ * Planetary Robotics Lab (PRL), European Space Agency (ESA)
+ *
+ * GA SLAM is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GA SLAM is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GA SLAM. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+// GA SLAM
+#include "ga_slam/TypeDefs.h"
+
+// PCL
+#include <pcl/point_types.h>
+#include <pcl/point_cloud.h>
+
+// STL
+#include <vector>
+#include <cstdint>
+
+namespace ga_slam {
+
+/** Uniform grid over the x-y plane of a point cloud for exact nearest
+  * neighbor searches. The points are bucketed with a counting sort into
+  * buffers that keep their capacity between the indexed clouds, and a search
+  * visits the rings of cells around the query until no closer point can
+  * exist, so neither indexing nor searching allocates once warmed up. It
+  * suits clouds spread over a plane, such as the clouds converted from a map.
+  */
+class CloudGrid {
+  public:
+    /// Creates an empty grid
+    CloudGrid(void) = default;
+
+    /// Delete the default copy/move constructors and operators
+    CloudGrid(const CloudGrid&) = delete;
+    CloudGrid& operator=(const CloudGrid&) = delete;
+    CloudGrid(CloudGrid&&) = delete;
+    CloudGrid& operator=(CloudGrid&&) = delete;
+
+    /** Indexes the finite points of a cloud, with cells sized so that they
+      * hold about one point each
+      * @note a reference to the cloud is kept until the next one is indexed,
+      *       so it must not be modified meanwhile
+      * @param[in] cloud the point cloud to be indexed
+      */
+    void setInputCloud(const Cloud::ConstPtr& cloud);
+
+    /** Searches the nearest indexed point of a query point
+      * @param[in] point the query point
+      * @param[out] squaredDistance the squared distance to the nearest point
+      * @return the index of the nearest point in the cloud or -1 if the query
+      *         is not finite or no point is indexed
+      */
+    int nearestSearch(
+            const pcl::PointXYZ& point,
+            float& squaredDistance) const;
+
+  protected:
+    /// Indexed cloud
+    Cloud::ConstPtr cloud_;
+
+    /// Position of the grid's corner, size of its cells and number of cells
+    /// in each dimension
+    float originX_ = 0.f;
+    float originY_ = 0.f;
+    float cellSize_ = 1.f;
+    int numCellsX_ = 0;
+    int numCellsY_ = 0;
+
+    /// Offset of each cell's points in the sorted indices (one more entry
+    /// than cells, so that a cell's points end where the next cell's start)
+    std::vector<uint32_t> cellStarts_;
+
+    /// Indices of the cloud's points sorted by cell
+    std::vector<uint32_t> pointIndices_;
+
+    /// Cell of each point of the cloud (-1 if the point is not finite)
+    std::vector<int> pointCells_;
+};
+
+}  // namespace ga_slam
@@ -22,6 +22,7 @@
 // GA SLAM
 #include "ga_slam/TypeDefs.h"
 #include "ga_slam/mapping/Map.h"
+#include "ga_slam/processing/CloudGrid.h"
 
 // Eigen
 #include <Eigen/Core>
@@ -34,9 +35,13 @@
 #include <pcl/filters/voxel_grid.h>
 #include <pcl/filters/crop_box.h>
 #include <pcl/registration/icp.h>
+#include <pcl/kdtree/kdtree_flann.h>
 
 // STL
 #include <vector>
+#include <limits>
+#include <cstdint>
+#include <cmath>
 
 namespace ga_slam {
 
@@ -51,13 +56,137 @@ void CloudProcessing::processCloud(
         double depthSigmaCoeff1,
         double depthSigmaCoeff2,
         double depthSigmaCoeff3) {
-    downsampleCloud(inputCloud, outputCloud, voxelSize);
-    transformCloudToMap(outputCloud, mapToSensorTF);
-    cropCloudToMap(outputCloud, robotPose, mapParameters);
-    calculateCloudVariances(outputCloud, cloudVariances,
+    VoxelBuffers buffers;
+
+    processCloud(inputCloud, outputCloud, cloudVariances, buffers, robotPose,
+            mapToSensorTF, mapParameters, voxelSize,
             depthSigmaCoeff1, depthSigmaCoeff2, depthSigmaCoeff3);
 }
 
+void CloudProcessing::processCloud(
+        const Cloud::ConstPtr& inputCloud,
+        Cloud::Ptr& outputCloud,
+        std::vector<float>& cloudVariances,
+        VoxelBuffers& buffers,
+        const Pose& robotPose,
+        const Pose& mapToSensorTF,
+        const MapParameters& params,
+        double voxelSize,
+        double depthSigmaCoeff1,
+        double depthSigmaCoeff2,
+        double depthSigmaCoeff3) {
+    constexpr uint64_t emptyKey = std::numeric_limits<uint64_t>::max();
+    constexpr uint64_t hashMultiplier = 0x9E3779B97F4A7C15ull;
+    constexpr int keyBits = 21;
+    constexpr int64_t keyOffset = int64_t(1) << (keyBits - 1);
+    constexpr uint64_t keyMask = (uint64_t(1) << keyBits) - 1;
+
+    auto& tableKeys = buffers.tableKeys;
+    auto& tableVoxels = buffers.tableVoxels;
+
+    size_t tableSize = 16;
+    while (tableSize < 2 * inputCloud->size()) tableSize <<= 1;
+
+    if (tableKeys.size() < tableSize) {
+        tableKeys.assign(tableSize, emptyKey);
+        tableVoxels.resize(tableSize);
+    }
+
+    tableSize = tableKeys.size();
+    const uint64_t slotMask = tableSize - 1;
+    int hashShift = 64;
+    while (tableSize >>= 1) hashShift--;
+
+    buffers.voxelSlots.clear();
+    buffers.sumX.clear();
+    buffers.sumY.clear();
+    buffers.sumZ.clear();
+    buffers.counts.clear();
+
+    const Eigen::Matrix4f tf = mapToSensorTF.matrix().cast<float>();
+    const float inverseVoxelSize = 1. / voxelSize;
+
+    const double positionZ = robotPose.translation().z();
+    const float minPointX = params.positionX - params.length / 2;
+    const float minPointY = params.positionY - params.length / 2;
+    const float minElevation = positionZ + params.minElevation;
+    const float maxPointX = params.positionX + params.length / 2;
+    const float maxPointY = params.positionY + params.length / 2;
+    const float maxElevation = positionZ + params.maxElevation;
+
+    for (const auto& inputPoint : inputCloud->points) {
+        if (!std::isfinite(inputPoint.x) || !std::isfinite(inputPoint.y) ||
+                !std::isfinite(inputPoint.z))
+            continue;
+
+        const float x = tf(0, 0) * inputPoint.x + tf(0, 1) * inputPoint.y +
+                tf(0, 2) * inputPoint.z + tf(0, 3);
+        const float y = tf(1, 0) * inputPoint.x + tf(1, 1) * inputPoint.y +
+                tf(1, 2) * inputPoint.z + tf(1, 3);
+        const float z = tf(2, 0) * inputPoint.x + tf(2, 1) * inputPoint.y +
+                tf(2, 2) * inputPoint.z + tf(2, 3);
+
+        if (x < minPointX || x > maxPointX || y < minPointY ||
+                y > maxPointY || z < minElevation || z > maxElevation)
+            continue;
+
+        const uint64_t voxelX = (static_cast<int64_t>(
+                std::floor(x * inverseVoxelSize)) + keyOffset) & keyMask;
+        const uint64_t voxelY = (static_cast<int64_t>(
+                std::floor(y * inverseVoxelSize)) + keyOffset) & keyMask;
+        const uint64_t voxelZ = (static_cast<int64_t>(
+                std::floor(z * inverseVoxelSize)) + keyOffset) & keyMask;
+        const uint64_t key = voxelX | (voxelY << keyBits) |
+                (voxelZ << (2 * keyBits));
+
+        uint64_t slot = (key * hashMultiplier) >> hashShift;
+        while (tableKeys[slot] != emptyKey && tableKeys[slot] != key)
+            slot = (slot + 1) & slotMask;
+
+        if (tableKeys[slot] == emptyKey) {
+            tableKeys[slot] = key;
+            tableVoxels[slot] = buffers.counts.size();
+            buffers.voxelSlots.push_back(slot);
+            buffers.sumX.push_back(x);
+            buffers.sumY.push_back(y);
+            buffers.sumZ.push_back(z);
+            buffers.counts.push_back(1);
+        } else {
+            const uint32_t voxel = tableVoxels[slot];
+            buffers.sumX[voxel] += x;
+            buffers.sumY[voxel] += y;
+            buffers.sumZ[voxel] += z;
+            buffers.counts[voxel]++;
+        }
+    }
+
+    const size_t numVoxels = buffers.counts.size();
+
+    outputCloud->header = inputCloud->header;
+    outputCloud->points.resize(numVoxels);
+    outputCloud->width = numVoxels;
+    outputCloud->height = 1;
+    outputCloud->is_dense = true;
+    cloudVariances.resize(numVoxels);
+
+    for (size_t i = 0; i < numVoxels; ++i) {
+        const float inverseCount = 1.f / buffers.counts[i];
+        auto& point = outputCloud->points[i];
+        point.x = buffers.sumX[i] * inverseCount;
+        point.y = buffers.sumY[i] * inverseCount;
+        point.z = buffers.sumZ[i] * inverseCount;
+
+        const double depth = std::sqrt(double(point.x) * point.x +
+                double(point.y) * point.y + double(point.z) * point.z);
+        const double sigma = depthSigmaCoeff1 * (depth * depth) +
+                depthSigmaCoeff2 * depth + depthSigmaCoeff3;
+
+        cloudVariances[i] = sigma * sigma;
+
+        tableKeys[buffers.voxelSlots[i]] = emptyKey;
+    }
+}
+
 void CloudProcessing::downsampleCloud(
         const Cloud::ConstPtr& inputCloud,
         Cloud::Ptr& outputCloud,
@@ -134,6 +263,32 @@ void CloudProcessing::convertMapToCloud(const Map& map, Cloud::Ptr& cloud) {
     }
 }
 
+void CloudProcessing::convertMapToCloud(
+        const MapSnapshot& mapSnapshot,
+        Cloud::Ptr& cloud) {
+    cloud->clear();
+
+    if (!mapSnapshot.valid) return;
+
+    const int size = mapSnapshot.parameters.size;
+
+    cloud->reserve(size * size);
+    cloud->is_dense = true;
+    cloud->header.stamp = mapSnapshot.timestamp;
+
+    const auto& meanData = mapSnapshot.meanZ;
+    double positionX, positionY;
+
+    for (int indexY = 0; indexY < size; ++indexY) {
+        for (int indexX = 0; indexX < size; ++indexX) {
+            mapSnapshot.getPositionFromIndex(indexX, indexY, positionX,
+                    positionY);
+            cloud->push_back(pcl::PointXYZ(positionX, positionY,
+                    meanData(indexX, indexY)));
+        }
+    }
+}
+
 double CloudProcessing::matchClouds(
         const Cloud::ConstPtr& cloud1,
         const Cloud::ConstPtr& cloud2) {
@@ -148,5 +303,99 @@ double CloudProcessing::matchClouds(
     return icp.getFitnessScore();
 }
 
-}  // namespace ga_slam
+double CloudProcessing::calculateFitnessScore(
+        const Cloud& cloud,
+        const KdTree& targetTree) {
+    std::vector<int> neighborIndices(1);
+    std::vector<float> neighborSquaredDistances(1);
+
+    return calculateFitnessScore(cloud, targetTree, neighborIndices,
+            neighborSquaredDistances);
+}
+
+double CloudProcessing::calculateFitnessScore(
+        const Cloud& cloud,
+        const KdTree& targetTree,
+        std::vector<int>& neighborIndices,
+        std::vector<float>& neighborSquaredDistances) {
+    double fitnessScore = 0.;
+    size_t matchedPoints = 0;
+
+    for (const auto& point : cloud.points) {
+        if (!targetTree.nearestKSearch(point, 1, neighborIndices,
+                neighborSquaredDistances)) continue;
+
+        fitnessScore += neighborSquaredDistances[0];
+        matchedPoints++;
+    }
+
+    if (!matchedPoints) return std::numeric_limits<double>::max();
+
+    return fitnessScore / matchedPoints;
+}
 
+double CloudProcessing::calculateFitnessScore(
+        const Cloud& cloud,
+        const Pose& tf,
+        const CloudGrid& targetGrid) {
+    const Eigen::Affine3f tfFloat = tf.cast<float>();
+
+    double fitnessScore = 0.;
+    size_t matchedPoints = 0;
+    float squaredDistance;
+
+    for (const auto& point : cloud.points) {
+        pcl::PointXYZ transformedPoint;
+        transformedPoint.getVector3fMap() = tfFloat * point.getVector3fMap();
+
+        if (targetGrid.nearestSearch(transformedPoint, squaredDistance) < 0)
+            continue;
+
+        fitnessScore += squaredDistance;
+        matchedPoints++;
+    }
+
+    if (!matchedPoints) return std::numeric_limits<double>::max();
+
+    return fitnessScore / matchedPoints;
+}
+
+double CloudProcessing::calculateElevationLogLikelihood(
+        const Cloud& cloud,
+        const Pose& tf,
+        const MapSnapshot& mapSnapshot,
+        double outlierLogLikelihood) {
+    if (cloud.empty()) return std::numeric_limits<double>::lowest();
+
+    const Eigen::Affine3f tfFloat = tf.cast<float>();
+    const auto& meanData = mapSnapshot.meanZ;
+    const auto& varianceData = mapSnapshot.varianceZ;
+
+    double logLikelihood = 0.;
+    size_t mapIndex;
+
+    for (const auto& point : cloud.points) {
+        const Eigen::Vector3f position = tfFloat * point.getVector3fMap();
+
+        if (!mapSnapshot.getIndexFromPosition(position.x(), position.y(),
+                mapIndex)) {
+            logLikelihood += outlierLogLikelihood;
+            continue;
+        }
+
+        const float mean = meanData(mapIndex);
+        const float variance = varianceData(mapIndex);
+        if (!std::isfinite(mean) || !(variance > 0.f)) {
+            logLikelihood += outlierLogLikelihood;
+            continue;
+        }
+
+        const double residual = position.z() - mean;
+        logLikelihood -= 0.5 * (residual * residual / variance +
+                std::log(variance));
+    }
+
+    return logLikelihood / cloud.size();
+}
+
+}  // namespace ga_slam
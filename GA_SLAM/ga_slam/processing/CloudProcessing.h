@@ -22,6 +22,7 @@
 // GA SLAM
 #include "ga_slam/TypeDefs.h"
 #include "ga_slam/mapping/Map.h"
+#include "ga_slam/processing/CloudGrid.h"
 
 // Eigen
 #include <Eigen/Geometry>
@@ -29,12 +30,35 @@
 // PCL
 #include <pcl/point_types.h>
 #include <pcl/point_cloud.h>
+#include <pcl/kdtree/kdtree_flann.h>
 
 // STL
 #include <vector>
+#include <cstdint>
 
 namespace ga_slam {
 
+using KdTree = pcl::KdTreeFLANN<pcl::PointXYZ>;
+
+/** Buffers of the single-pass cloud processing, which keep their capacity
+  * between the processed clouds to avoid heap allocations
+  */
+struct VoxelBuffers {
+    /// Open-addressing hash table mapping the keys of the occupied voxels to
+    /// their indices (the size is a power of two)
+    std::vector<uint64_t> tableKeys;
+    std::vector<uint32_t> tableVoxels;
+
+    /// Slot of the hash table used by each voxel, to clear only those slots
+    std::vector<uint32_t> voxelSlots;
+
+    /// Sum of the coordinates and number of points of each voxel
+    std::vector<float> sumX;
+    std::vector<float> sumY;
+    std::vector<float> sumZ;
+    std::vector<uint32_t> counts;
+};
+
 /** Contains a collection of helper functions that are used to process a
   * PCL point cloud or convert it to different data types.
   */
@@ -47,9 +71,11 @@ class CloudProcessing {
       * The processing steps are: downsample, transformation to map reference
       * and cropping to map's dimensions. In addition, a variance value is
       * computed for each point of the cloud
+      * @note allocates new buffers and calls the single-pass overload
       * @param[in] inputCloud the point cloud to be processed
       * @param[out] outputCloud the processed point cloud
       * @param[out] cloudVariances the vector of the computed variances
+      * @param[in] robotPose the robot's pose, giving the elevation of the map
       * @param[in] sensorToMapTF the transformation to be applied to the cloud
       * @param[in] mapParameters the structure containing the map's parameters
       * @param[in] voxelSize the voxel size needed to downsample the cloud
@@ -72,6 +98,39 @@ class CloudProcessing {
             double depthSigmaCoeff2,
             double depthSigmaCoeff3);
 
+    /** Processes a point cloud in a single pass. Each point is transformed to
+      * the map reference, rejected if outside the map's dimensions and
+      * accumulated into its voxel (aligned to the map reference) using a hash
+      * table. The centroid of each voxel and its variance are then written to
+      * the output, whose capacity is reused
+      * @param[in] inputCloud the point cloud to be processed
+      * @param[out] outputCloud the processed point cloud
+      * @param[out] cloudVariances the vector of the computed variances
+      * @param[in/out] buffers the buffers reused between the calls
+      * @param[in] robotPose the robot's pose, giving the elevation of the map
+      * @param[in] sensorToMapTF the transformation to be applied to the cloud
+      * @param[in] mapParameters the structure containing the map's parameters
+      * @param[in] voxelSize the voxel size needed to downsample the cloud
+      * @param[in] depthSigmaCoeff1 the first coefficient of the uncertainty
+      *            equation of the depth sensor
+      * @param[in] depthSigmaCoeff2 the second coefficient of the uncertainty
+      *            equation of the depth sensor
+      * @param[in] depthSigmaCoeff3 the third coefficient of the uncertainty
+      *            equation of the depth sensor
+      */
+    static void processCloud(
+            const Cloud::ConstPtr& inputCloud,
+            Cloud::Ptr& outputCloud,
+            std::vector<float>& cloudVariances,
+            VoxelBuffers& buffers,
+            const Pose& robotPose,
+            const Pose& sensorToMapTF,
+            const MapParameters& mapParameters,
+            double voxelSize,
+            double depthSigmaCoeff1,
+            double depthSigmaCoeff2,
+            double depthSigmaCoeff3);
+
     /** Downsamples a point cloud using a voxel grid to the specified resolution
       * @param[in] inputCloud the point cloud to be downsampled
       * @param[out] outputCloud the downsampled point cloud
@@ -123,6 +182,15 @@ class CloudProcessing {
       */
     static void convertMapToCloud(const Map& map, Cloud::Ptr& cloud);
 
+    /** Converts a snapshot of an elevation map to a non-organized dense point
+      * cloud, the same way as the map itself
+      * @param[in] mapSnapshot the snapshot of the map to be converted
+      * @param[out] cloud the converted point cloud
+      */
+    static void convertMapToCloud(
+            const MapSnapshot& mapSnapshot,
+            Cloud::Ptr& cloud);
+
     /** Matches two clouds by aligning them and measuring the mean square error
       * of their points using one iteration of ICP
       * @param[in] cloud1 the first point cloud
@@ -132,6 +200,65 @@ class CloudProcessing {
     static double matchClouds(
             const Cloud::ConstPtr& cloud1,
             const Cloud::ConstPtr& cloud2);
+
+    /** Measures the mean square error between the points of a cloud and their
+      * nearest neighbors in a cloud that has already been indexed by a
+      * KD-tree, so that the same tree can be reused for multiple matchings
+      * @param[in] cloud the point cloud to be matched
+      * @param[in] targetTree the KD-tree built over the target point cloud
+      * @return the fitness score of the match (zero score means perfect match)
+      */
+    static double calculateFitnessScore(
+            const Cloud& cloud,
+            const KdTree& targetTree);
+
+    /** Measures the fitness score like the overloaded function, using the
+      * caller's buffers for the results of the nearest neighbor searches
+      * @param[in] cloud the point cloud to be matched
+      * @param[in] targetTree the KD-tree built over the target point cloud
+      * @param[out] neighborIndices the buffer of the neighbor indices
+      * @param[out] neighborSquaredDistances the buffer of the neighbor
+      *             squared distances
+      * @return the fitness score of the match (zero score means perfect match)
+      */
+    static double calculateFitnessScore(
+            const Cloud& cloud,
+            const KdTree& targetTree,
+            std::vector<int>& neighborIndices,
+            std::vector<float>& neighborSquaredDistances);
+
+    /** Measures the mean square error between the points of a cloud,
+      * transformed on the fly, and their nearest neighbors in a cloud indexed
+      * by a grid, so that no buffer is needed for the searches
+      * @param[in] cloud the point cloud to be matched
+      * @param[in] tf the transformation to be applied to each point
+      * @param[in] targetGrid the grid built over the target point cloud
+      * @return the fitness score of the match (zero score means perfect match)
+      */
+    static double calculateFitnessScore(
+            const Cloud& cloud,
+            const Pose& tf,
+            const CloudGrid& targetGrid);
+
+    /** Calculates the mean log-likelihood of the elevation of a cloud's points
+      * given the gaussian (mean and variance) of the map cell each transformed
+      * point falls into. Points falling outside the map or into empty cells
+      * are given a fixed outlier log-likelihood, so that a transformation
+      * losing the overlap with the map is penalized
+      * @param[in] cloud the point cloud to be evaluated
+      * @param[in] tf the transformation to be applied to each point
+      * @param[in] mapSnapshot the snapshot of the elevation map
+      * @param[in] outlierLogLikelihood the log-likelihood of a point that
+      *            cannot be evaluated (by default that of a residual of three
+      *            sigmas given a unit variance)
+      * @return the mean log-likelihood of the points or the lowest value
+      *         if the cloud is empty
+      */
+    static double calculateElevationLogLikelihood(
+            const Cloud& cloud,
+            const Pose& tf,
+            const MapSnapshot& mapSnapshot,
+            double outlierLogLikelihood = -4.5);
 };
 
 }  // namespace ga_slam
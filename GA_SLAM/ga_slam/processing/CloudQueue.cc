@@ -0,0 +1,136 @@
+/*
+ * This file is part of GA SLAM.
+ * Copyright (C) 2018 Dimitris Geromichalos,
+ * Planetary Robotics Lab (PRL), European Space Agency (ESA)
+ *
+ * GA SLAM is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GA SLAM is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GA SLAM. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "ga_slam/processing/CloudQueue.h"
+
+// GA SLAM
+#include "ga_slam/TypeDefs.h"
+
+// PCL
+#include <pcl/point_types.h>
+#include <pcl/point_cloud.h>
+
+// STL
+#include <vector>
+#include <string>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+
+namespace ga_slam {
+
+void CloudQueue::configure(int capacity, CloudQueuePolicy policy) {
+    std::lock_guard<std::mutex> guard(mutex_);
+
+    slots_.clear();
+    slots_.resize(std::max(capacity, 1));
+    head_ = 0;
+    size_ = 0;
+    policy_ = policy;
+    closed_ = false;
+    numDropped_ = 0;
+    numMerged_ = 0;
+}
+
+bool CloudQueue::push(
+        const Cloud::ConstPtr& cloud,
+        const Pose& robotPose,
+        const Pose& bodyToSensorTF) {
+    std::unique_lock<std::mutex> guard(mutex_);
+
+    const size_t capacity = slots_.size();
+
+    if (size_ == capacity && !closed_) {
+        if (policy_ == CloudQueuePolicy::Block) {
+            notFull_.wait(guard, [&] { return size_ < capacity || closed_; });
+        } else if (policy_ == CloudQueuePolicy::Merge) {
+            const size_t slot = findNewestEntry(cloud->header.frame_id);
+
+            if (slot < capacity) {
+                slots_[slot].push_back({cloud, robotPose, bodyToSensorTF});
+                numMerged_++;
+                return true;
+            }
+
+            dropOldestEntry();
+        } else {
+            dropOldestEntry();
+        }
+    }
+
+    if (closed_) return false;
+
+    auto& entry = slots_[(head_ + size_) % capacity];
+    entry.clear();
+    entry.push_back({cloud, robotPose, bodyToSensorTF});
+    size_++;
+
+    guard.unlock();
+    notEmpty_.notify_one();
+
+    return true;
+}
+
+bool CloudQueue::pop(QueuedClouds& clouds) {
+    std::unique_lock<std::mutex> guard(mutex_);
+
+    notEmpty_.wait(guard, [&] { return size_ > 0 || closed_; });
+    if (!size_) return false;
+
+    clouds.clear();
+    clouds.swap(slots_[head_]);
+    head_ = (head_ + 1) % slots_.size();
+    size_--;
+
+    guard.unlock();
+    notFull_.notify_one();
+
+    return true;
+}
+
+void CloudQueue::close(void) {
+    std::unique_lock<std::mutex> guard(mutex_);
+    closed_ = true;
+    guard.unlock();
+
+    notEmpty_.notify_all();
+    notFull_.notify_all();
+}
+
+size_t CloudQueue::findNewestEntry(const std::string& frameId) const {
+    const size_t capacity = slots_.size();
+
+    for (size_t i = size_; i > 0; --i) {
+        const size_t slot = (head_ + i - 1) % capacity;
+        if (slots_[slot].front().cloud->header.frame_id == frameId)
+            return slot;
+    }
+
+    return capacity;
+}
+
+void CloudQueue::dropOldestEntry(void) {
+    numDropped_ += slots_[head_].size();
+    slots_[head_].clear();
+    head_ = (head_ + 1) % slots_.size();
+    size_--;
+}
+
+}  // namespace ga_slam
+
@@ -0,0 +1,167 @@
+/*
+ * This file is part of GA SLAM.
+ * Copyright (C) 2018 Dimitris Geromichalos,
+ * Planetary Robotics Lab (PRL), European Space Agency (ESA)
+ *
+ * GA SLAM is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GA SLAM is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GA SLAM. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+// GA SLAM
+#include "ga_slam/TypeDefs.h"
+
+// Eigen
+#include <Eigen/Geometry>
+#include <Eigen/StdVector>
+
+// PCL
+#include <pcl/point_types.h>
+#include <pcl/point_cloud.h>
+
+// STL
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <string>
+#include <cstdint>
+
+namespace ga_slam {
+
+/// Policy applied when a cloud is pushed to a full queue
+enum class CloudQueuePolicy {
+    DropOldest,  ///< the oldest pending entry is discarded
+    Merge,       ///< the cloud is appended to the newest pending entry of the
+                 ///< same sensor (or the oldest entry is discarded if none)
+    Block,       ///< the caller waits until an entry is popped
+};
+
+/// Point cloud waiting to be registered, along with the poses that were
+/// current when it was received
+struct QueuedCloud {
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+    /// Cloud as received from the sensor (the header holds its timestamp
+    /// and sensor frame)
+    Cloud::ConstPtr cloud;
+
+    /// Robot's pose estimate when the cloud was received
+    Pose robotPose;
+
+    /// Transformation from the robot's body to the sensor
+    Pose bodyToSensorTF;
+};
+
+/// Entry of the queue holding one or more clouds of the same sensor
+using QueuedClouds = std::vector<QueuedCloud,
+        Eigen::aligned_allocator<QueuedCloud>>;
+
+/** Bounded queue decoupling the sensor callbacks (multiple producers) from the
+  * registration of the clouds to the map (single consumer). Pushing only moves
+  * pointers and poses under a short lock, so the callbacks return quickly,
+  * while the configured policy determines how an overload is handled.
+  */
+class CloudQueue {
+  public:
+    /// Creates a queue of a single entry that drops the oldest entry
+    CloudQueue(void) { configure(1, CloudQueuePolicy::DropOldest); }
+
+    /// Delete the default copy/move constructors and operators
+    CloudQueue(const CloudQueue&) = delete;
+    CloudQueue& operator=(const CloudQueue&) = delete;
+    CloudQueue(CloudQueue&&) = delete;
+    CloudQueue& operator=(CloudQueue&&) = delete;
+
+    /** Clears and reopens the queue and resets its counters
+      * @param[in] capacity the maximum number of pending entries
+      * @param[in] policy the policy applied when the queue is full
+      */
+    void configure(int capacity, CloudQueuePolicy policy);
+
+    /** Pushes a cloud to the queue, applying the overload policy if full
+      * @param[in] cloud the point cloud as received from a sensor
+      * @param[in] robotPose the robot's pose when the cloud was received
+      * @param[in] bodyToSensorTF the transformation applied to the cloud
+      * @return false if the queue is closed
+      */
+    bool push(
+            const Cloud::ConstPtr& cloud,
+            const Pose& robotPose,
+            const Pose& bodyToSensorTF);
+
+    /** Waits for the oldest entry and pops it
+      * @param[out] clouds the clouds of the popped entry (the previous
+      *             contents are discarded, but the capacity is reused)
+      * @return false if the queue is closed and empty
+      */
+    bool pop(QueuedClouds& clouds);
+
+    /// Closes the queue, waking up the waiting producers and consumer
+    void close(void);
+
+    /// Returns the number of pending entries
+    size_t getDepth(void) const {
+        std::lock_guard<std::mutex> guard(mutex_);
+        return size_;
+    }
+
+    /// Returns the number of clouds discarded due to an overload
+    uint64_t getNumDropped(void) const {
+        std::lock_guard<std::mutex> guard(mutex_);
+        return numDropped_;
+    }
+
+    /// Returns the number of clouds appended to a pending entry
+    uint64_t getNumMerged(void) const {
+        std::lock_guard<std::mutex> guard(mutex_);
+        return numMerged_;
+    }
+
+  protected:
+    /** Searches the pending entries from the newest to the oldest for one
+      * containing clouds of a sensor
+      * @param[in] frameId the frame of the sensor
+      * @return the slot of the entry or the capacity if none was found
+      */
+    size_t findNewestEntry(const std::string& frameId) const;
+
+    /// Discards the oldest pending entry
+    void dropOldestEntry(void);
+
+  protected:
+    /// Ring buffer of entries, whose vectors are reused to avoid allocations
+    std::vector<QueuedClouds> slots_;
+
+    /// Slot of the oldest pending entry and number of pending entries
+    size_t head_ = 0;
+    size_t size_ = 0;
+
+    /// Policy applied when the queue is full
+    CloudQueuePolicy policy_;
+
+    /// Whether the queue is closed
+    bool closed_ = false;
+
+    /// Counters of the discarded and merged clouds
+    uint64_t numDropped_ = 0;
+    uint64_t numMerged_ = 0;
+
+    /// Mutex and conditions protecting the queue
+    mutable std::mutex mutex_;
+    std::condition_variable notEmpty_;
+    std::condition_variable notFull_;
+};
+
+}  // namespace ga_slam
+
@@ -0,0 +1,65 @@
+/*
+ * This file is part of GA SLAM.
+ * Copyright (C) 2018 Dimitris Geromichalos,
+ * Planetary Robotics Lab (PRL), European Space Agency (ESA)
+ *
+ * GA SLAM is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GA SLAM is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GA SLAM. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+// STL
+#include <type_traits>
+#include <utility>
+
+namespace ga_slam {
+
+template<typename Signature>
+class FunctionRef;
+
+/** Non-owning reference to a callable object. Unlike std::function, it never
+  * allocates or copies the object, so it can be passed to a function called
+  * every frame. The object must outlive the reference.
+  */
+template<typename Result, typename... Args>
+class FunctionRef<Result(Args...)> {
+  public:
+    /// Refers to a callable object
+    template<typename Function, typename = typename std::enable_if<
+            !std::is_same<typename std::decay<Function>::type,
+            FunctionRef>::value>::type>
+    FunctionRef(const Function& function)
+        : object_(&function),
+          call_(&call<Function>) {}
+
+    /// Calls the referenced object
+    Result operator()(Args... args) const {
+        return call_(object_, std::forward<Args>(args)...);
+    }
+
+  protected:
+    /// Calls an object of a specific type through a type-erased pointer
+    template<typename Function>
+    static Result call(const void* object, Args... args) {
+        return (*static_cast<const Function*>(object))(
+                std::forward<Args>(args)...);
+    }
+
+  protected:
+    /// Referenced object and the function calling it
+    const void* object_;
+    Result (*call_)(const void*, Args...);
+};
+
+}  // namespace ga_slam
@@ -22,6 +22,7 @@
 // GA SLAM
 #include "ga_slam/TypeDefs.h"
 #include "ga_slam/mapping/Map.h"
+#include "ga_slam/processing/ThreadPool.h"
 
 // Eigen
 #include <Eigen/Core>
@@ -33,6 +34,9 @@
 
 // STL
 #include <string>
+#include <vector>
+#include <limits>
+#include <algorithm>
 #include <cmath>
 
 namespace ga_slam {
@@ -52,6 +56,25 @@ void ImageProcessing::convertMapToImage(const Map& map, Image& image) {
     }
 }
 
+void ImageProcessing::convertMapToImage(
+        const MapSnapshot& mapSnapshot,
+        Image& image) {
+    const int size = mapSnapshot.parameters.size;
+    const auto& meanData = mapSnapshot.meanZ;
+
+    image.create(size, size, CV_32F);
+
+    for (int row = 0; row < size; ++row) {
+        const int indexX = (row + mapSnapshot.startIndexX) % size;
+        float* imageRow = image.ptr<float>(row);
+
+        for (int col = 0; col < size; ++col) {
+            const int indexY = (col + mapSnapshot.startIndexY) % size;
+            imageRow[col] = meanData(indexX, indexY);
+        }
+    }
+}
+
 void ImageProcessing::displayImage(
         const Image& image,
         const std::string& windowName,
@@ -102,6 +125,10 @@ void ImageProcessing::calculateGradientImage(
     }
 }
 
+void ImageProcessing::calculateValidMask(const Image& inputImage, Image& mask) {
+    cv::compare(inputImage, inputImage, mask, cv::CMP_EQ);
+}
+
 void ImageProcessing::calculateLaplacianImage(
         const Image& inputImage,
         Image& outputImage,
@@ -127,7 +154,83 @@ bool ImageProcessing::findBestMatch(
         double matchYawRange,
         double matchYawStep,
         bool matchImageGradients,
-        bool displayMatch) {
+        bool displayMatch,
+        ThreadPool* threadPool) {
+    Image sourceInput, templateInput;
+    prepareMatchingImage(sourceImage, sourceInput, matchImageGradients);
+    prepareMatchingImage(templateImage, templateInput, matchImageGradients);
+
+    constexpr int method = CV_TM_CCORR_NORMED;
+
+    const int numYaws = getNumYaws(matchYaw, matchYawRange, matchYawStep);
+    const auto getYaw = [&](int yawIndex) {
+        return matchYaw ? - matchYawRange / 2. + yawIndex * matchYawStep : 0.;
+    };
+
+    std::vector<double> maxValues(numYaws,
+            -std::numeric_limits<double>::infinity());
+    std::vector<cv::Point2i> maxPositions(numYaws);
+    std::vector<Image> resultMatrices(displayMatch ? numYaws : 0);
+
+    const int numThreads = threadPool ? threadPool->getNumThreads() : 1;
+    std::vector<Image> warpedTemplates(numThreads);
+    std::vector<Image> threadResultMatrices(numThreads);
+
+    const auto matchYaws = [&](size_t begin, size_t end, int threadIndex) {
+        for (size_t i = begin; i < end; ++i) {
+            const Image* matchedTemplate = &templateInput;
+
+            if (matchYaw) {
+                warpImage(templateInput, warpedTemplates[threadIndex],
+                        getYaw(i));
+                matchedTemplate = &warpedTemplates[threadIndex];
+            }
+
+            Image& resultMatrix = displayMatch ? resultMatrices[i] :
+                    threadResultMatrices[threadIndex];
+
+            cv::matchTemplate(sourceInput, *matchedTemplate, resultMatrix,
+                    method);
+            cv::minMaxLoc(resultMatrix, nullptr, &maxValues[i], nullptr,
+                    &maxPositions[i]);
+        }
+    };
+
+    if (threadPool)
+        threadPool->parallelFor(numYaws, 1, matchYaws);
+    else
+        matchYaws(0, numYaws, 0);
+
+    int bestYawIndex = 0;
+    for (int i = 1; i < numYaws; ++i)
+        if (maxValues[i] > maxValues[bestYawIndex]) bestYawIndex = i;
+
+    const bool matchFound = maxValues[bestYawIndex] > matchAcceptanceThreshold;
+    if (matchFound)
+        matchedPosition = cv::Point3d(maxPositions[bestYawIndex].x,
+                maxPositions[bestYawIndex].y, getYaw(bestYawIndex));
+
+    if (displayMatch && matchFound)
+        displayMatchedPosition(sourceInput, templateInput,
+                resultMatrices[bestYawIndex],
+                cv::Point2d(matchedPosition.x, matchedPosition.y));
+
+    return matchFound;
+}
+
+bool ImageProcessing::findBestMatchMasked(
+        const Image& sourceImage,
+        const Image& templateImage,
+        cv::Point3d& matchedPosition,
+        double& matchScore,
+        int& matchOverlap,
+        double matchAcceptanceThreshold,
+        int minOverlap,
+        bool matchYaw,
+        double matchYawRange,
+        double matchYawStep,
+        bool matchImageGradients,
+        ThreadPool* threadPool) {
     Image sourceInput, templateInput;
 
     if (matchImageGradients) {
@@ -138,47 +241,781 @@ bool ImageProcessing::findBestMatch(
         templateInput = templateImage;
     }
 
-    replaceNanWithZero(sourceInput);
-    replaceNanWithZero(templateInput);
+    MaskedMatchingImage sourceMatchingImage;
+    prepareMaskedMatchingImage(sourceInput, sourceMatchingImage);
+
+    return findBestMatchMasked(sourceMatchingImage, templateInput,
+            matchedPosition, matchScore, matchOverlap,
+            matchAcceptanceThreshold, minOverlap, matchYaw, matchYawRange,
+            matchYawStep, threadPool);
+}
+
+bool ImageProcessing::findBestMatchMasked(
+        const MaskedMatchingImage& sourceImage,
+        const Image& templateImage,
+        cv::Point3d& matchedPosition,
+        double& matchScore,
+        int& matchOverlap,
+        double matchAcceptanceThreshold,
+        int minOverlap,
+        bool matchYaw,
+        double matchYawRange,
+        double matchYawStep,
+        ThreadPool* threadPool) {
+    if (templateImage.cols > sourceImage.values.cols ||
+            templateImage.rows > sourceImage.values.rows)
+        return false;
+
+    const int numYaws = getNumYaws(matchYaw, matchYawRange, matchYawStep);
+    const auto getYaw = [&](int yawIndex) {
+        return matchYaw ? - matchYawRange / 2. + yawIndex * matchYawStep : 0.;
+    };
+
+    std::vector<double> maxValues(numYaws,
+            -std::numeric_limits<double>::infinity());
+    std::vector<cv::Point2i> maxPositions(numYaws);
+    std::vector<int> maxOverlaps(numYaws, 0);
+
+    const int numThreads = threadPool ? threadPool->getNumThreads() : 1;
+    std::vector<Image> warpedTemplates(numThreads);
+    std::vector<Image> resultMatrices(numThreads);
+    std::vector<Image> overlapMatrices(numThreads);
+
+    const auto matchYaws = [&](size_t begin, size_t end, int threadIndex) {
+        for (size_t i = begin; i < end; ++i) {
+            const Image* matchedTemplate = &templateImage;
+
+            if (matchYaw) {
+                warpImage(templateImage, warpedTemplates[threadIndex],
+                        getYaw(i), std::numeric_limits<double>::quiet_NaN());
+                matchedTemplate = &warpedTemplates[threadIndex];
+            }
+
+            auto& resultMatrix = resultMatrices[threadIndex];
+            auto& overlapMatrix = overlapMatrices[threadIndex];
+
+            matchTemplateMasked(sourceImage, *matchedTemplate, resultMatrix,
+                    overlapMatrix, minOverlap);
+            cv::minMaxLoc(resultMatrix, nullptr, &maxValues[i], nullptr,
+                    &maxPositions[i]);
+            maxOverlaps[i] = cvRound(overlapMatrix.at<float>(maxPositions[i]));
+        }
+    };
+
+    if (threadPool)
+        threadPool->parallelFor(numYaws, 1, matchYaws);
+    else
+        matchYaws(0, numYaws, 0);
+
+    int bestYawIndex = 0;
+    for (int i = 1; i < numYaws; ++i)
+        if (maxValues[i] > maxValues[bestYawIndex]) bestYawIndex = i;
+
+    matchScore = maxValues[bestYawIndex];
+    matchOverlap = maxOverlaps[bestYawIndex];
+
+    const bool matchFound = matchScore > matchAcceptanceThreshold &&
+            matchOverlap >= minOverlap;
+    if (matchFound)
+        matchedPosition = cv::Point3d(maxPositions[bestYawIndex].x,
+                maxPositions[bestYawIndex].y, getYaw(bestYawIndex));
+
+    return matchFound;
+}
+
+void ImageProcessing::prepareMaskedMatchingImage(
+        const Image& inputImage,
+        MaskedMatchingImage& matchingImage) {
+    calculateValidMask(inputImage, matchingImage.mask);
+    matchingImage.mask.convertTo(matchingImage.mask, CV_32F, 1. / 255.);
+
+    matchingImage.values = inputImage.clone();
+    replaceNanWithZero(matchingImage.values);
+    cv::multiply(matchingImage.values, matchingImage.values,
+            matchingImage.squaredValues);
+}
+
+void ImageProcessing::matchTemplateMasked(
+        const Image& sourceImage,
+        const Image& templateImage,
+        Image& resultMatrix,
+        Image& overlapMatrix,
+        int minOverlap) {
+    MaskedMatchingImage sourceMatchingImage;
+    prepareMaskedMatchingImage(sourceImage, sourceMatchingImage);
+
+    matchTemplateMasked(sourceMatchingImage, templateImage, resultMatrix,
+            overlapMatrix, minOverlap);
+}
+
+void ImageProcessing::matchTemplateMasked(
+        const MaskedMatchingImage& sourceImage,
+        const Image& templateImage,
+        Image& resultMatrix,
+        Image& overlapMatrix,
+        int minOverlap) {
+    constexpr int method = CV_TM_CCORR;
+    constexpr double minEnergy = 1e-12;
+
+    const cv::Size resultSize(sourceImage.values.cols - templateImage.cols + 1,
+            sourceImage.values.rows - templateImage.rows + 1);
+
+    Image templateMask, templatePoints;
+    calculateValidMask(templateImage, templateMask);
+
+    if (cv::countNonZero(templateMask) < std::max(minOverlap, 1)) {
+        resultMatrix = Image::zeros(resultSize, CV_32F);
+        overlapMatrix = Image::zeros(resultSize, CV_32F);
+        return;
+    }
+
+    cv::findNonZero(templateMask, templatePoints);
+    const cv::Rect knownRect = cv::boundingRect(templatePoints);
+
+    Image templateValues;
+    templateMask(knownRect).convertTo(templateMask, CV_32F, 1. / 255.);
+    templateValues = templateImage(knownRect).clone();
+    replaceNanWithZero(templateValues);
+
+    Image crossCorrelation, sourceEnergy, templateEnergy;
+    cv::matchTemplate(sourceImage.values, templateValues, crossCorrelation,
+            method);
+    cv::matchTemplate(sourceImage.squaredValues, templateMask, sourceEnergy,
+            method);
+    cv::matchTemplate(sourceImage.mask, templateValues.mul(templateValues),
+            templateEnergy, method);
+    cv::matchTemplate(sourceImage.mask, templateMask, overlapMatrix, method);
+
+    const cv::Rect resultRect(knownRect.tl(), resultSize);
+    overlapMatrix = overlapMatrix(resultRect).clone();
+
+    Image denominator;
+    cv::multiply(sourceEnergy(resultRect), templateEnergy(resultRect),
+            denominator);
+    cv::sqrt(cv::max(denominator, minEnergy), denominator);
+    cv::divide(crossCorrelation(resultRect), denominator, resultMatrix);
 
+    resultMatrix.setTo(0., denominator <= std::sqrt(minEnergy));
+    resultMatrix.setTo(0., overlapMatrix < minOverlap - 0.5);
+}
+
+bool ImageProcessing::findBestMatchPyramid(
+        const Image& sourceImage,
+        const Image& templateImage,
+        cv::Point3d& matchedPosition,
+        double matchAcceptanceThreshold,
+        int numLevels,
+        int numCandidates,
+        bool matchYaw,
+        double matchYawRange,
+        double matchYawStep,
+        bool matchImageGradients,
+        ThreadPool* threadPool) {
     constexpr int method = CV_TM_CCORR_NORMED;
+    constexpr int minTemplateSize = 8;
+    constexpr int refinementRadius = 2;
 
-    Image warpedTemplate, resultMatrix, bestResultMatrix;
-    cv::Point3d bestPosition;
-    cv::Point2i maxPosition;
-    double maxValue;
-    double bestValue = 0.;
+    Image sourceInput, templateInput;
+    prepareMatchingImage(sourceImage, sourceInput, matchImageGradients);
+    prepareMatchingImage(templateImage, templateInput, matchImageGradients);
+
+    if (templateInput.cols > sourceInput.cols ||
+            templateInput.rows > sourceInput.rows)
+        return false;
 
-    if (matchYaw) {
-        for (double yaw = - matchYawRange / 2.; yaw <= matchYawRange / 2;
-                yaw += matchYawStep) {
-            warpImage(templateInput, warpedTemplate, yaw);
+    int topLevel = 0;
+    int templateSize = std::min(templateInput.cols, templateInput.rows);
+    while (topLevel < numLevels && templateSize / 2 >= minTemplateSize) {
+        templateSize /= 2;
+        topLevel++;
+    }
+
+    std::vector<Image> sourcePyramid, templatePyramid;
+    cv::buildPyramid(sourceInput, sourcePyramid, topLevel);
+    cv::buildPyramid(templateInput, templatePyramid, topLevel);
+
+    const int numYaws = getNumYaws(matchYaw, matchYawRange, matchYawStep);
+    const auto getYaw = [&](int yawIndex) {
+        return matchYaw ? - matchYawRange / 2. + yawIndex * matchYawStep : 0.;
+    };
+
+    numCandidates = std::max(numCandidates, 1);
+    const int numThreads = threadPool ? threadPool->getNumThreads() : 1;
+    std::vector<Image> warpedTemplates(numThreads);
+    std::vector<Image> resultMatrices(numThreads);
+    std::vector<MatchCandidate> yawCandidates(numYaws * numCandidates);
+
+    const Image& coarseSource = sourcePyramid[topLevel];
+    const Image& coarseTemplate = templatePyramid[topLevel];
+    const int suppressionRadius = std::max(1, templateSize / 4);
 
-            cv::matchTemplate(sourceInput, warpedTemplate, resultMatrix,
+    const auto searchYaws = [&](size_t begin, size_t end, int threadIndex) {
+        for (size_t i = begin; i < end; ++i) {
+            const Image* matchedTemplate = &coarseTemplate;
+
+            if (matchYaw) {
+                warpImage(coarseTemplate, warpedTemplates[threadIndex],
+                        getYaw(i));
+                matchedTemplate = &warpedTemplates[threadIndex];
+            }
+
+            auto& resultMatrix = resultMatrices[threadIndex];
+            cv::matchTemplate(coarseSource, *matchedTemplate, resultMatrix,
                     method);
-            cv::minMaxLoc(resultMatrix, nullptr, &maxValue, nullptr,
-                    &maxPosition);
 
-            if (maxValue > bestValue) {
-                bestPosition = cv::Point3d(maxPosition.x, maxPosition.y, yaw);
-                bestResultMatrix = resultMatrix;
+            for (int j = 0; j < numCandidates; ++j) {
+                auto& candidate = yawCandidates[i * numCandidates + j];
+                candidate.yawIndex = i;
+                cv::minMaxLoc(resultMatrix, nullptr, &candidate.score, nullptr,
+                        &candidate.position);
+
+                const cv::Rect suppressedRect(
+                        candidate.position.x - suppressionRadius,
+                        candidate.position.y - suppressionRadius,
+                        2 * suppressionRadius + 1, 2 * suppressionRadius + 1);
+                resultMatrix(suppressedRect & cv::Rect(0, 0,
+                        resultMatrix.cols, resultMatrix.rows)).setTo(
+                        -std::numeric_limits<float>::infinity());
+            }
+        }
+    };
+
+    if (threadPool)
+        threadPool->parallelFor(numYaws, 1, searchYaws);
+    else
+        searchYaws(0, numYaws, 0);
+
+    const auto isBetter = [](const MatchCandidate& a, const MatchCandidate& b) {
+        if (a.score != b.score) return a.score > b.score;
+        if (a.yawIndex != b.yawIndex) return a.yawIndex < b.yawIndex;
+        if (a.position.y != b.position.y) return a.position.y < b.position.y;
+        return a.position.x < b.position.x;
+    };
+
+    numCandidates = std::min<int>(numCandidates, yawCandidates.size());
+    std::partial_sort(yawCandidates.begin(),
+            yawCandidates.begin() + numCandidates, yawCandidates.end(),
+            isBetter);
+    yawCandidates.resize(numCandidates);
+    auto& candidates = yawCandidates;
+
+    const auto refineCandidates = [&](size_t begin, size_t end,
+            int threadIndex) {
+        for (size_t i = begin; i < end; ++i) {
+            auto& candidate = candidates[i];
+
+            for (int level = topLevel - 1; level >= 0; --level) {
+                candidate.position *= 2;
+                refineCandidate(sourcePyramid[level], templatePyramid[level],
+                        getYaw(candidate.yawIndex), matchYaw, refinementRadius,
+                        candidate, warpedTemplates[threadIndex],
+                        resultMatrices[threadIndex]);
+            }
+        }
+    };
+
+    if (threadPool)
+        threadPool->parallelFor(numCandidates, 1, refineCandidates);
+    else
+        refineCandidates(0, numCandidates, 0);
+
+    MatchCandidate bestCandidate = candidates.front();
+    for (const auto& candidate : candidates)
+        if (isBetter(candidate, bestCandidate)) bestCandidate = candidate;
+
+    if (bestCandidate.score <= matchAcceptanceThreshold) return false;
+
+    Image warpedTemplate, windowResult;
+    const cv::Point2i windowOrigin = refineCandidate(sourceInput,
+            templateInput, getYaw(bestCandidate.yawIndex), matchYaw, 1,
+            bestCandidate, warpedTemplate, windowResult);
+
+    const cv::Point2d subPixelPosition = refinePeakSubPixel(windowResult,
+            bestCandidate.position - windowOrigin);
+
+    matchedPosition = cv::Point3d(windowOrigin.x + subPixelPosition.x,
+            windowOrigin.y + subPixelPosition.y,
+            getYaw(bestCandidate.yawIndex));
+
+    return true;
+}
+
+bool ImageProcessing::findBestMatchFourierMellin(
+        const Image& sourceImage,
+        const Image& templateImage,
+        cv::Point3d& matchedPosition,
+        double matchAcceptanceThreshold,
+        double matchYawRange,
+        bool matchImageGradients) {
+    constexpr int method = CV_TM_CCORR_NORMED;
+
+    Image sourceInput, templateInput;
+    prepareMatchingImage(sourceImage, sourceInput, matchImageGradients);
+    prepareMatchingImage(templateImage, templateInput, matchImageGradients);
+
+    if (templateInput.cols > sourceInput.cols ||
+            templateInput.rows > sourceInput.rows)
+        return false;
+
+    Image resultMatrix;
+    cv::Point2i position;
+    cv::matchTemplate(sourceInput, templateInput, resultMatrix, method);
+    cv::minMaxLoc(resultMatrix, nullptr, nullptr, nullptr, &position);
+
+    const cv::Rect overlap(position, templateInput.size());
+    const double yaw = std::max(- matchYawRange / 2., std::min(
+            matchYawRange / 2., estimateRotation(sourceInput(overlap),
+            templateInput)));
+
+    Image warpedTemplate;
+    double score;
+    warpImage(templateInput, warpedTemplate, yaw);
+    cv::matchTemplate(sourceInput, warpedTemplate, resultMatrix, method);
+    cv::minMaxLoc(resultMatrix, nullptr, &score, nullptr, &position);
+
+    if (score <= matchAcceptanceThreshold) return false;
+
+    const cv::Point2d subPixelPosition = refinePeakSubPixel(resultMatrix,
+            position);
+    matchedPosition = cv::Point3d(subPixelPosition.x, subPixelPosition.y, yaw);
+
+    return true;
+}
+
+double ImageProcessing::estimateRotation(
+        const Image& sourceImage,
+        const Image& templateImage) {
+    constexpr int numAngles = 360;
+
+    const int size = cv::getOptimalDFTSize(
+            std::max(sourceImage.rows, sourceImage.cols));
+
+    Image sourcePolar, templatePolar;
+    calculatePolarSpectrum(sourceImage, sourcePolar, size, numAngles);
+    calculatePolarSpectrum(templateImage, templatePolar, size, numAngles);
+
+    Image sourceRows, templateRows;
+    cv::transpose(sourcePolar, sourceRows);
+    cv::transpose(templatePolar, templateRows);
+
+    for (int row = 0; row < sourceRows.rows; ++row) {
+        sourceRows.row(row) -= cv::mean(sourceRows.row(row));
+        templateRows.row(row) -= cv::mean(templateRows.row(row));
+    }
+
+    Image sourceSpectrum, templateSpectrum, crossSpectrum, correlation;
+    cv::dft(sourceRows, sourceSpectrum, cv::DFT_ROWS | cv::DFT_COMPLEX_OUTPUT);
+    cv::dft(templateRows, templateSpectrum,
+            cv::DFT_ROWS | cv::DFT_COMPLEX_OUTPUT);
+    cv::mulSpectrums(sourceSpectrum, templateSpectrum, crossSpectrum,
+            cv::DFT_ROWS, true);
+    cv::reduce(crossSpectrum, crossSpectrum, 0, CV_REDUCE_SUM);
+    cv::idft(crossSpectrum, correlation, cv::DFT_REAL_OUTPUT);
+
+    cv::Point2i peak;
+    cv::minMaxLoc(correlation, nullptr, nullptr, nullptr, &peak);
+
+    const float previous = correlation.at<float>(
+            0, (peak.x + numAngles - 1) % numAngles);
+    const float next = correlation.at<float>(0, (peak.x + 1) % numAngles);
+    const float denominator = previous - 2.f * correlation.at<float>(peak) +
+            next;
+
+    double angleShift = peak.x;
+    if (denominator < 0.f)
+        angleShift += 0.5 * (previous - next) / denominator;
+    if (angleShift >= numAngles / 2.) angleShift -= numAngles;
+
+    return - angleShift * M_PI / numAngles;
+}
+
+void ImageProcessing::calculatePolarSpectrum(
+        const Image& inputImage,
+        Image& polarSpectrum,
+        int size,
+        int numAngles) {
+    const double windowRadius = std::min(inputImage.rows, inputImage.cols) / 2.;
+    const double centerX = (inputImage.cols - 1) / 2.;
+    const double centerY = (inputImage.rows - 1) / 2.;
+
+    Image paddedImage = Image::zeros(size, size, CV_32F);
+
+    for (int row = 0; row < inputImage.rows; ++row) {
+        for (int col = 0; col < inputImage.cols; ++col) {
+            const double radius = std::hypot(col - centerX, row - centerY);
+            if (radius >= windowRadius) continue;
+
+            paddedImage.at<float>(row, col) = inputImage.at<float>(row, col) *
+                    0.5 * (1. + std::cos(M_PI * radius / windowRadius));
+        }
+    }
+
+    Image spectrum;
+    cv::dft(paddedImage, spectrum, cv::DFT_COMPLEX_OUTPUT);
+
+    Image channels[2], magnitude;
+    cv::split(spectrum, channels);
+    cv::magnitude(channels[0], channels[1], magnitude);
+
+    for (int row = 0; row < size; ++row) {
+        const double frequencyY = std::cos(M_PI * (row <= size / 2 ?
+                row : row - size) / size);
+
+        for (int col = 0; col < size; ++col) {
+            const double frequencyX = std::cos(M_PI * (col <= size / 2 ?
+                    col : col - size) / size);
+            const double product = frequencyX * frequencyY;
+
+            magnitude.at<float>(row, col) *= (1. - product) * (2. - product);
+        }
+    }
+
+    cv::log(magnitude + 1., magnitude);
+
+    const int minRadius = size / 8;
+    const int numRadii = size / 2 - minRadius;
+    Image mapX(numAngles, numRadii, CV_32F), mapY(numAngles, numRadii, CV_32F);
+
+    for (int i = 0; i < numAngles; ++i) {
+        const double angle = i * M_PI / numAngles;
+
+        for (int j = 0; j < numRadii; ++j) {
+            mapX.at<float>(i, j) = (minRadius + j) * std::cos(angle);
+            mapY.at<float>(i, j) = (minRadius + j) * std::sin(angle);
+        }
+    }
+
+    cv::remap(magnitude, polarSpectrum, mapX, mapY, cv::INTER_LINEAR,
+            cv::BORDER_WRAP);
+}
+
+void ImageProcessing::prepareMatchingImage(
+        const Image& inputImage,
+        MatchingImage& matchingImage,
+        bool useGradient) {
+    prepareMatchingImage(inputImage, matchingImage.image, useGradient);
+
+    Image sum;
+    cv::integral(matchingImage.image, sum, matchingImage.squaredSum, CV_64F);
+}
+
+bool ImageProcessing::findBestMatchInWindow(
+        const MatchingImage& sourceImage,
+        const Image& templateImage,
+        const cv::Rect& window,
+        cv::Point3d& matchedPosition,
+        double matchAcceptanceThreshold,
+        bool matchYaw,
+        double matchYawRange,
+        double matchYawStep,
+        bool matchImageGradients,
+        ThreadPool* threadPool) {
+    Image templateInput;
+    prepareMatchingImage(templateImage, templateInput, matchImageGradients);
+
+    const cv::Rect validWindow = window & cv::Rect(0, 0,
+            sourceImage.image.cols - templateInput.cols + 1,
+            sourceImage.image.rows - templateInput.rows + 1);
+    if (validWindow.area() <= 0) return false;
+
+    const int numYaws = getNumYaws(matchYaw, matchYawRange, matchYawStep);
+    const auto getYaw = [&](int yawIndex) {
+        return matchYaw ? - matchYawRange / 2. + yawIndex * matchYawStep : 0.;
+    };
+
+    std::vector<double> maxValues(numYaws,
+            -std::numeric_limits<double>::infinity());
+    std::vector<cv::Point2i> maxPositions(numYaws);
+    std::vector<Image> resultMatrices(numYaws);
+
+    const int numThreads = threadPool ? threadPool->getNumThreads() : 1;
+    std::vector<Image> warpedTemplates(numThreads);
+
+    const auto matchYaws = [&](size_t begin, size_t end, int threadIndex) {
+        for (size_t i = begin; i < end; ++i) {
+            const Image* matchedTemplate = &templateInput;
+
+            if (matchYaw) {
+                warpImage(templateInput, warpedTemplates[threadIndex],
+                        getYaw(i));
+                matchedTemplate = &warpedTemplates[threadIndex];
             }
+
+            matchTemplateInWindow(sourceImage, validWindow, *matchedTemplate,
+                    resultMatrices[i]);
+            cv::minMaxLoc(resultMatrices[i], nullptr, &maxValues[i], nullptr,
+                    &maxPositions[i]);
+        }
+    };
+
+    if (threadPool)
+        threadPool->parallelFor(numYaws, 1, matchYaws);
+    else
+        matchYaws(0, numYaws, 0);
+
+    int bestYawIndex = 0;
+    for (int i = 1; i < numYaws; ++i)
+        if (maxValues[i] > maxValues[bestYawIndex]) bestYawIndex = i;
+
+    if (maxValues[bestYawIndex] <= matchAcceptanceThreshold) return false;
+
+    const cv::Point2d subPixelPosition = refinePeakSubPixel(
+            resultMatrices[bestYawIndex], maxPositions[bestYawIndex]);
+
+    matchedPosition = cv::Point3d(validWindow.x + subPixelPosition.x,
+            validWindow.y + subPixelPosition.y, getYaw(bestYawIndex));
+
+    return true;
+}
+
+void ImageProcessing::matchTemplateInWindow(
+        const MatchingImage& sourceImage,
+        const cv::Rect& window,
+        const Image& templateImage,
+        Image& resultMatrix) {
+    const int templateCols = templateImage.cols;
+    const int templateRows = templateImage.rows;
+    const cv::Rect region(window.x, window.y,
+            window.width + templateCols - 1, window.height + templateRows - 1);
+
+    cv::matchTemplate(sourceImage.image(region), templateImage, resultMatrix,
+            CV_TM_CCORR);
+
+    const double templateNorm = cv::norm(templateImage);
+    const Image& squaredSum = sourceImage.squaredSum;
+
+    for (int row = 0; row < resultMatrix.rows; ++row) {
+        const int y = window.y + row;
+        const double* top = squaredSum.ptr<double>(y);
+        const double* bottom = squaredSum.ptr<double>(y + templateRows);
+        float* result = resultMatrix.ptr<float>(row);
+
+        for (int col = 0; col < resultMatrix.cols; ++col) {
+            const int x = window.x + col;
+            const double windowSquaredSum = bottom[x + templateCols] -
+                    bottom[x] - top[x + templateCols] + top[x];
+            const double norm = std::sqrt(std::max(windowSquaredSum, 0.)) *
+                    templateNorm;
+
+            result[col] = norm > std::numeric_limits<float>::epsilon() ?
+                    result[col] / norm : 0.f;
+        }
+    }
+}
+
+cv::Point2i ImageProcessing::refineCandidate(
+        const Image& sourceImage,
+        const Image& templateImage,
+        double yaw,
+        bool warpTemplate,
+        int radius,
+        MatchCandidate& candidate,
+        Image& warpedTemplate,
+        Image& resultMatrix) {
+    const Image* matchedTemplate = &templateImage;
+
+    if (warpTemplate) {
+        warpImage(templateImage, warpedTemplate, yaw);
+        matchedTemplate = &warpedTemplate;
+    }
+
+    const int maxX = sourceImage.cols - templateImage.cols;
+    const int maxY = sourceImage.rows - templateImage.rows;
+    const int beginX = std::min(std::max(candidate.position.x - radius, 0),
+            maxX);
+    const int beginY = std::min(std::max(candidate.position.y - radius, 0),
+            maxY);
+    const int endX = std::max(std::min(candidate.position.x + radius, maxX),
+            beginX);
+    const int endY = std::max(std::min(candidate.position.y + radius, maxY),
+            beginY);
+
+    const cv::Rect window(beginX, beginY,
+            endX - beginX + templateImage.cols,
+            endY - beginY + templateImage.rows);
+
+    cv::matchTemplate(sourceImage(window), *matchedTemplate, resultMatrix,
+            CV_TM_CCORR_NORMED);
+
+    cv::Point2i maxPosition;
+    cv::minMaxLoc(resultMatrix, nullptr, &candidate.score, nullptr,
+            &maxPosition);
+
+    const cv::Point2i windowOrigin(beginX, beginY);
+    candidate.position = windowOrigin + maxPosition;
+
+    return windowOrigin;
+}
+
+cv::Point2d ImageProcessing::refinePeakSubPixel(
+        const Image& resultImage,
+        const cv::Point2i& peak) {
+    const auto fitParabola = [](float previous, float center, float next) {
+        const double curvature = previous - 2. * center + next;
+        if (curvature >= 0.) return 0.;
+
+        const double offset = 0.5 * (previous - next) / curvature;
+        return std::min(std::max(offset, -0.5), 0.5);
+    };
+
+    cv::Point2d refinedPeak(peak.x, peak.y);
+    const float center = resultImage.at<float>(peak.y, peak.x);
+
+    if (peak.x > 0 && peak.x < resultImage.cols - 1)
+        refinedPeak.x += fitParabola(
+                resultImage.at<float>(peak.y, peak.x - 1), center,
+                resultImage.at<float>(peak.y, peak.x + 1));
+
+    if (peak.y > 0 && peak.y < resultImage.rows - 1)
+        refinedPeak.y += fitParabola(
+                resultImage.at<float>(peak.y - 1, peak.x), center,
+                resultImage.at<float>(peak.y + 1, peak.x));
+
+    return refinedPeak;
+}
+
+void ImageProcessing::prepareMatchingImage(
+        const Image& inputImage,
+        Image& outputImage,
+        bool useGradient) {
+    if (useGradient)
+        calculateGradientImage(inputImage, outputImage);
+    else
+        outputImage = inputImage.clone();
+
+    replaceNanWithZero(outputImage);
+}
+
+int ImageProcessing::getNumYaws(
+        bool matchYaw,
+        double matchYawRange,
+        double matchYawStep) {
+    if (!matchYaw || matchYawStep <= 0.) return 1;
+
+    return static_cast<int>(std::floor(matchYawRange / matchYawStep + 1e-6)) +
+            1;
+}
+
+bool ImageProcessing::fitPeakQuadratic(
+        const Image& resultImage,
+        const cv::Point2i& peak,
+        cv::Point2d& offset,
+        cv::Matx22d& hessian) {
+    cv::Mat_<double> design(9, 6), scores(9, 1), coefficients;
+
+    for (int j = -1; j <= 1; ++j) {
+        for (int i = -1; i <= 1; ++i) {
+            const int row = (j + 1) * 3 + i + 1;
+
+            design(row, 0) = 1.;
+            design(row, 1) = i;
+            design(row, 2) = j;
+            design(row, 3) = i * i;
+            design(row, 4) = i * j;
+            design(row, 5) = j * j;
+            scores(row) = resultImage.at<float>(peak.y + j, peak.x + i);
         }
+    }
+
+    cv::solve(design, scores, coefficients, cv::DECOMP_QR);
+
+    hessian = cv::Matx22d(
+            2. * coefficients(3), coefficients(4),
+            coefficients(4), 2. * coefficients(5));
+
+    const double determinant = cv::determinant(hessian);
+    if (hessian(0, 0) >= 0. || determinant <= 0.) return false;
+
+    const cv::Vec2d solution = - (hessian.inv() *
+            cv::Vec2d(coefficients(1), coefficients(2)));
+
+    offset.x = std::min(std::max(solution[0], -0.5), 0.5);
+    offset.y = std::min(std::max(solution[1], -0.5), 0.5);
+
+    return true;
+}
+
+bool ImageProcessing::refineMatch(
+        const Image& sourceImage,
+        const Image& templateImage,
+        cv::Point3d& matchedPosition,
+        cv::Matx33d& covariance,
+        bool matchYaw,
+        double matchYawStep) {
+    constexpr int method = CV_TM_CCORR_NORMED;
+    constexpr double minScoreDeficit = 1e-3;
+    constexpr double quantizationVariance = 1. / 12.;
+
+    const cv::Point2i center(cvRound(matchedPosition.x),
+            cvRound(matchedPosition.y));
+    const cv::Rect region(center.x - 1, center.y - 1,
+            templateImage.cols + 2, templateImage.rows + 2);
+
+    if ((region & cv::Rect(0, 0, sourceImage.cols, sourceImage.rows)) !=
+            region)
+        return false;
+
+    matchYaw = matchYaw && matchYawStep > 0.;
+    const int numYaws = matchYaw ? 3 : 1;
+
+    Image warpedTemplate, resultMatrices[3];
+    double peakScores[3];
+
+    for (int i = 0; i < numYaws; ++i) {
+        const Image* matchedTemplate = &templateImage;
+
+        if (matchYaw) {
+            warpImage(templateImage, warpedTemplate, matchedPosition.z +
+                    (i - 1) * matchYawStep);
+            matchedTemplate = &warpedTemplate;
+        }
+
+        cv::matchTemplate(sourceImage(region), *matchedTemplate,
+                resultMatrices[i], method);
+        cv::minMaxLoc(resultMatrices[i], nullptr, &peakScores[i]);
+    }
+
+    const Image& resultMatrix = resultMatrices[numYaws / 2];
+    const double scoreDeficit = std::max(1. - resultMatrix.at<float>(1, 1),
+            minScoreDeficit);
+
+    covariance = cv::Matx33d::zeros();
+
+    cv::Point2d offset;
+    cv::Matx22d hessian;
+
+    if (fitPeakQuadratic(resultMatrix, cv::Point2i(1, 1), offset, hessian)) {
+        const cv::Matx22d positionCovariance = (-hessian).inv() * scoreDeficit;
+
+        covariance(0, 0) = positionCovariance(0, 0);
+        covariance(0, 1) = covariance(1, 0) = positionCovariance(0, 1);
+        covariance(1, 1) = positionCovariance(1, 1);
     } else {
-        cv::matchTemplate(sourceInput, templateInput, resultMatrix, method);
-        cv::minMaxLoc(resultMatrix, nullptr, &maxValue, nullptr, &maxPosition);
-        bestPosition = cv::Point3d(maxPosition.x, maxPosition.y, 0.);
-        bestResultMatrix = resultMatrix;
+        offset = cv::Point2d(0., 0.);
+        covariance(0, 0) = covariance(1, 1) = quantizationVariance;
     }
 
-    const bool matchFound = maxValue > matchAcceptanceThreshold;
-    if (matchFound) matchedPosition = bestPosition;
+    matchedPosition.x = center.x + offset.x;
+    matchedPosition.y = center.y + offset.y;
 
-    if (displayMatch && matchFound)
-        displayMatchedPosition(sourceInput, templateInput, bestResultMatrix,
-                cv::Point2d(matchedPosition.x, matchedPosition.y));
+    if (!matchYaw) return true;
 
-    return matchFound;
+    const double curvature = peakScores[0] - 2. * peakScores[1] +
+            peakScores[2];
+
+    if (curvature < 0.) {
+        const double yawOffset = 0.5 * (peakScores[0] - peakScores[2]) /
+                curvature;
+
+        matchedPosition.z += std::min(std::max(yawOffset, -0.5), 0.5) *
+                matchYawStep;
+        covariance(2, 2) = scoreDeficit / - curvature *
+                matchYawStep * matchYawStep;
+    } else {
+        covariance(2, 2) = quantizationVariance * matchYawStep * matchYawStep;
+    }
+
+    return true;
 }
 
 void ImageProcessing::displayMatchedPosition(
@@ -222,11 +1059,15 @@ void ImageProcessing::replaceNanWithZero(Image& image) {
 void ImageProcessing::warpImage(
         const Image& inputImage,
         Image& outputImage,
-        double angle) {
+        double angle,
+        double borderValue) {
     const cv::Point2f center(inputImage.cols / 2.f, inputImage.rows / 2.f);
-    Image rotationMatrix = cv::getRotationMatrix2D(center, angle, 1.);
+    Image rotationMatrix = cv::getRotationMatrix2D(center,
+            angle * 180. / M_PI, 1.);
 
-    cv::warpAffine(inputImage, outputImage, rotationMatrix, inputImage.size());
+    cv::warpAffine(inputImage, outputImage, rotationMatrix, inputImage.size(),
+            cv::INTER_LINEAR, cv::BORDER_CONSTANT,
+            cv::Scalar::all(borderValue));
 }
 
 }  // namespace ga_slam
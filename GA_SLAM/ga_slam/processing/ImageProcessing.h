@@ -22,6 +22,7 @@
 // GA SLAM
 #include "ga_slam/TypeDefs.h"
 #include "ga_slam/mapping/Map.h"
+#include "ga_slam/processing/ThreadPool.h"
 
 // OpenCV
 #include <opencv2/core/core.hpp>
@@ -31,6 +32,39 @@
 
 namespace ga_slam {
 
+/// Candidate position and yaw of a template matching along with its score
+struct MatchCandidate {
+    /// Score of the match
+    double score;
+
+    /// Position of the match in the image (top left corner of the template)
+    cv::Point2i position;
+
+    /// Index of the yaw hypothesis of the match
+    int yawIndex;
+};
+
+/// Image prepared for template matching along with the integral of its
+/// squared values, so that the norm under any window is found in constant time
+struct MatchingImage {
+    /// Prepared image (gradient or elevation with the NaN values replaced)
+    Image image;
+
+    /// Integral of the squared image of size (rows + 1) x (cols + 1)
+    Image squaredSum;
+};
+
+/// Source image prepared for the masked template matching, so that it is
+/// preprocessed once for all the matched templates (e.g. yaw hypotheses)
+struct MaskedMatchingImage {
+    /// Mask which is 1 where the image is known and 0 elsewhere
+    Image mask;
+
+    /// Image with the unknown cells replaced by 0 and its squared values
+    Image values;
+    Image squaredValues;
+};
+
 /** Contains a collection of helper function that are used to process an
   * OpenCV image (mat) or convert it to different data types.
   */
@@ -45,6 +79,15 @@ class ImageProcessing {
       */
     static void convertMapToImage(const Map& map, Image& image);
 
+    /** Converts a snapshot of an elevation map to an image of float type,
+      * the same way as the map itself
+      * @param[in] mapSnapshot the snapshot of the map to be converted
+      * @param[out] image the converted image
+      */
+    static void convertMapToImage(
+            const MapSnapshot& mapSnapshot,
+            Image& image);
+
     /** Converts the zoom to width and height and calls the respective
       * overloaded function
       * @param[in] image the image to be displayed
@@ -85,6 +128,12 @@ class ImageProcessing {
             int sobelKernelSize = 3,
             bool approximate = false);
 
+    /** Calculates the mask of the cells of an elevation image that are known
+      * @param[in] inputImage the input elevation image
+      * @param[out] mask the mask which is non-zero where the image is not NaN
+      */
+    static void calculateValidMask(const Image& inputImage, Image& mask);
+
     /** Calculates the laplacian of an image
       * @param[in] inputImage the input image
       * @param[out] outputImage the laplacian image
@@ -103,7 +152,9 @@ class ImageProcessing {
     /** Find the best match given an source and a template image using
       * template matching. The matching can be done using the images as they are
       * or using their gradients. The template image is rotated to maximize
-      * the match score and find a correction in yaw
+      * the match score and find a correction in yaw. The yaw hypotheses are
+      * evaluated concurrently if a thread pool is given and the best one is
+      * selected deterministically (the first of the equally scored ones)
       * @param[in] sourceImage the source image (search space)
       * @param[in] templateImage the image to be matched
       * @param[out] matchedPosition the position and orientation of the match
@@ -114,7 +165,10 @@ class ImageProcessing {
       * @param[in] matchYawStep scan step of yaw angle in radians for the
       *            template matching
       * @param[in] matchImageGradients whether to match the images' gradients
-      * @param[in] displayImage whether to display the found match
+      * @param[in] displayImage whether to display the found match (the
+      *            result matrices of all yaw hypotheses are kept only if set)
+      * @param[in] threadPool the pool used to evaluate the yaw hypotheses
+      *            (if null, they are evaluated by the calling thread)
       * @return true if a match was found
       */
     static bool findBestMatch(
@@ -126,7 +180,328 @@ class ImageProcessing {
             double matchYawRange = 0.,
             double matchYawStep = 0.,
             bool matchImageGradients = true,
-            bool displayMatch = true);
+            bool displayMatch = true,
+            ThreadPool* threadPool = nullptr);
+
+    /** Find the best match given an source and a template image using the
+      * masked normalized cross-correlation, so that unknown (NaN) cells of
+      * either image do not contribute to the score. The template is rotated
+      * like in findBestMatch to find a correction in yaw
+      * @param[in] sourceImage the source image (search space)
+      * @param[in] templateImage the image to be matched
+      * @param[out] matchedPosition the position and orientation of the match
+      * @param[out] matchScore the score of the best position
+      * @param[out] matchOverlap the number of cells known in both images at
+      *             the best position
+      * @param[in] matchAcceptanceThreshold the minimum score the matched
+      *            position must have, in order for the matching to be accepted
+      * @param[in] minOverlap the minimum number of cells known in both images
+      *            a position must have to be considered
+      * @param[in] matchYaw whether to match the yaw of the template
+      * @param[in] matchYawRange scan range of yaw angle in radians for the
+      *            template matching
+      * @param[in] matchYawStep scan step of yaw angle in radians for the
+      *            template matching
+      * @param[in] matchImageGradients whether to match the images' gradients
+      * @param[in] threadPool the pool used to evaluate the yaw hypotheses
+      *            (if null, they are evaluated by the calling thread)
+      * @return true if a match was found
+      */
+    static bool findBestMatchMasked(
+            const Image& sourceImage,
+            const Image& templateImage,
+            cv::Point3d& matchedPosition,
+            double& matchScore,
+            int& matchOverlap,
+            double matchAcceptanceThreshold,
+            int minOverlap,
+            bool matchYaw = false,
+            double matchYawRange = 0.,
+            double matchYawStep = 0.,
+            bool matchImageGradients = true,
+            ThreadPool* threadPool = nullptr);
+
+    /** Find the best match given a prepared source and a template image
+      * using the masked normalized cross-correlation (see above)
+      * @param[in] sourceImage the prepared source image (search space)
+      * @param[in] templateImage the image to be matched, with NaN for unknown
+      *            cells (it is matched as it is, so it must have been
+      *            processed like the source, e.g. to its gradient)
+      * @param[out] matchedPosition the position and orientation of the match
+      * @param[out] matchScore the score of the best position
+      * @param[out] matchOverlap the number of cells known in both images at
+      *             the best position
+      * @param[in] matchAcceptanceThreshold the minimum score the matched
+      *            position must have, in order for the matching to be accepted
+      * @param[in] minOverlap the minimum number of cells known in both images
+      *            a position must have to be considered
+      * @param[in] matchYaw whether to match the yaw of the template
+      * @param[in] matchYawRange scan range of yaw angle in radians for the
+      *            template matching
+      * @param[in] matchYawStep scan step of yaw angle in radians for the
+      *            template matching
+      * @param[in] threadPool the pool used to evaluate the yaw hypotheses
+      *            (if null, they are evaluated by the calling thread)
+      * @return true if a match was found
+      */
+    static bool findBestMatchMasked(
+            const MaskedMatchingImage& sourceImage,
+            const Image& templateImage,
+            cv::Point3d& matchedPosition,
+            double& matchScore,
+            int& matchOverlap,
+            double matchAcceptanceThreshold,
+            int minOverlap,
+            bool matchYaw = false,
+            double matchYawRange = 0.,
+            double matchYawStep = 0.,
+            ThreadPool* threadPool = nullptr);
+
+    /** Prepares a source image for the masked template matching
+      * @param[in] inputImage the image with NaN for unknown cells
+      * @param[out] matchingImage the prepared image
+      */
+    static void prepareMaskedMatchingImage(
+            const Image& inputImage,
+            MaskedMatchingImage& matchingImage);
+
+    /** Computes the normalized cross-correlation of a template for all the
+      * positions of a source image using only the cells that are known (not
+      * NaN) in both images. The template is first cropped to the bounding box
+      * of its known cells, so sparse templates are correlated faster
+      * @param[in] sourceImage the source image with NaN for unknown cells
+      * @param[in] templateImage the template image with NaN for unknown cells
+      * @param[out] resultMatrix the score of each position (top left corner
+      *             of the template)
+      * @param[out] overlapMatrix the number of cells known in both images at
+      *             each position
+      * @param[in] minOverlap the minimum number of cells known in both images
+      *            a position must have, otherwise its score is set to 0
+      */
+    static void matchTemplateMasked(
+            const Image& sourceImage,
+            const Image& templateImage,
+            Image& resultMatrix,
+            Image& overlapMatrix,
+            int minOverlap = 1);
+
+    /** Computes the masked normalized cross-correlation of a template for
+      * all the positions of a prepared source image (see above)
+      * @param[in] sourceImage the prepared source image
+      * @param[in] templateImage the template image with NaN for unknown cells
+      * @param[out] resultMatrix the score of each position (top left corner
+      *             of the template)
+      * @param[out] overlapMatrix the number of cells known in both images at
+      *             each position
+      * @param[in] minOverlap the minimum number of cells known in both images
+      *            a position must have, otherwise its score is set to 0
+      */
+    static void matchTemplateMasked(
+            const MaskedMatchingImage& sourceImage,
+            const Image& templateImage,
+            Image& resultMatrix,
+            Image& overlapMatrix,
+            int minOverlap = 1);
+
+    /** Finds the best match of a template image in a source image using
+      * coarse-to-fine template matching on image pyramids. The yaw hypotheses
+      * are searched exhaustively at the coarsest level and the best candidates
+      * are then refined within a small window at each finer level, so that
+      * only the coarsest search depends on the size of the source image.
+      * The final position is refined to sub-pixel accuracy
+      * @param[in] sourceImage the source image (search space)
+      * @param[in] templateImage the image to be matched
+      * @param[out] matchedPosition the position and orientation of the match
+      * @param[in] matchAcceptanceThreshold the minimum score the matched
+      *            position must have, in order for the matching to be accepted
+      * @param[in] numLevels the maximum number of pyramid levels above the
+      *            native resolution (limited so that the template keeps a
+      *            minimum size)
+      * @param[in] numCandidates the number of best candidates of the coarsest
+      *            level that are refined
+      * @param[in] matchYaw whether to match the yaw of the template
+      * @param[in] matchYawRange scan range of yaw angle in radians for the
+      *            template matching
+      * @param[in] matchYawStep scan step of yaw angle in radians for the
+      *            template matching
+      * @param[in] matchImageGradients whether to match the images' gradients
+      * @param[in] threadPool the pool used to evaluate the yaw hypotheses and
+      *            the candidates (if null, they are evaluated by the calling
+      *            thread)
+      * @return true if a match was found
+      */
+    static bool findBestMatchPyramid(
+            const Image& sourceImage,
+            const Image& templateImage,
+            cv::Point3d& matchedPosition,
+            double matchAcceptanceThreshold,
+            int numLevels,
+            int numCandidates,
+            bool matchYaw = false,
+            double matchYawRange = 0.,
+            double matchYawStep = 0.,
+            bool matchImageGradients = true,
+            ThreadPool* threadPool = nullptr);
+
+    /** Find the best match given an source and a template image by estimating
+      * the yaw of the template first and then matching its rotated version
+      * once, instead of searching the translation for every yaw hypothesis.
+      * The template is matched unrotated to locate the overlapping region of
+      * the source, from which the yaw is estimated in the frequency domain
+      * @param[in] sourceImage the source image (search space)
+      * @param[in] templateImage the image to be matched
+      * @param[out] matchedPosition the position and orientation of the match
+      * @param[in] matchAcceptanceThreshold the minimum score the matched
+      *            position must have, in order for the matching to be accepted
+      * @param[in] matchYawRange range of yaw angle in radians the estimated
+      *            yaw is limited to
+      * @param[in] matchImageGradients whether to match the images' gradients
+      * @return true if a match was found
+      */
+    static bool findBestMatchFourierMellin(
+            const Image& sourceImage,
+            const Image& templateImage,
+            cv::Point3d& matchedPosition,
+            double matchAcceptanceThreshold,
+            double matchYawRange,
+            bool matchImageGradients = true);
+
+    /** Estimates the rotation between two images of the same size using the
+      * Fourier-Mellin approach. The magnitudes of their spectra, which do not
+      * depend on the translation between the images, are resampled to polar
+      * coordinates where the rotation becomes a cyclic shift along the angle
+      * axis that is recovered by circular cross-correlation
+      * @param[in] sourceImage the reference image
+      * @param[in] templateImage the rotated image
+      * @return the yaw in radians in [-pi/2, pi/2) by which the template must
+      *         be rotated (see warpImage) to be aligned with the source
+      */
+    static double estimateRotation(
+            const Image& sourceImage,
+            const Image& templateImage);
+
+    /** Prepares an image for template matching by optionally computing its
+      * gradient and replacing its NaN values with 0
+      * @param[in] inputImage the image to be prepared (it is not modified)
+      * @param[out] outputImage the prepared image
+      * @param[in] useGradient whether to compute the gradient of the image
+      */
+    static void prepareMatchingImage(
+            const Image& inputImage,
+            Image& outputImage,
+            bool useGradient);
+
+    /** Prepares an image for template matching and computes the integral of
+      * its squared values
+      * @param[in] inputImage the image to be prepared (it is not modified)
+      * @param[out] matchingImage the prepared image and its integral
+      * @param[in] useGradient whether to compute the gradient of the image
+      */
+    static void prepareMatchingImage(
+            const Image& inputImage,
+            MatchingImage& matchingImage,
+            bool useGradient);
+
+    /** Finds the best match of a template image within a window of a source
+      * image that has already been prepared, so that only the positions
+      * around a prior are searched and the norms of the source are taken
+      * from its precomputed integral
+      * @param[in] sourceImage the prepared source image (search space)
+      * @param[in] templateImage the image to be matched
+      * @param[in] window the range of the searched template positions (top
+      *            left corner) in the source image
+      * @param[out] matchedPosition the position (in the source image) and
+      *             orientation of the match
+      * @param[in] matchAcceptanceThreshold the minimum score the matched
+      *            position must have, in order for the matching to be accepted
+      * @param[in] matchYaw whether to match the yaw of the template
+      * @param[in] matchYawRange scan range of yaw angle in radians for the
+      *            template matching
+      * @param[in] matchYawStep scan step of yaw angle in radians for the
+      *            template matching
+      * @param[in] matchImageGradients whether to match the template's
+      *            gradient (must agree with the prepared source image)
+      * @param[in] threadPool the pool used to evaluate the yaw hypotheses
+      *            (if null, they are evaluated by the calling thread)
+      * @return true if a match was found
+      */
+    static bool findBestMatchInWindow(
+            const MatchingImage& sourceImage,
+            const Image& templateImage,
+            const cv::Rect& window,
+            cv::Point3d& matchedPosition,
+            double matchAcceptanceThreshold,
+            bool matchYaw = false,
+            double matchYawRange = 0.,
+            double matchYawStep = 0.,
+            bool matchImageGradients = true,
+            ThreadPool* threadPool = nullptr);
+
+    /** Computes the normalized cross-correlation of a template for a window
+      * of positions of a prepared source image
+      * @param[in] sourceImage the prepared source image
+      * @param[in] window the range of the template positions (top left
+      *            corner), which must lie inside the source image
+      * @param[in] templateImage the template image
+      * @param[out] resultMatrix the score of each position of the window
+      */
+    static void matchTemplateInWindow(
+            const MatchingImage& sourceImage,
+            const cv::Rect& window,
+            const Image& templateImage,
+            Image& resultMatrix);
+
+    /** Refines the position of a peak in a result image of template matching
+      * to sub-pixel accuracy by fitting a parabola in each axis through the
+      * peak and its neighbors
+      * @param[in] resultImage the result image of the template matching
+      * @param[in] peak the position of the peak in the result image
+      * @return the refined position of the peak
+      */
+    static cv::Point2d refinePeakSubPixel(
+            const Image& resultImage,
+            const cv::Point2i& peak);
+
+    /** Fits a two-dimensional quadratic to the 3x3 neighborhood of a peak in
+      * a result image of template matching using least squares
+      * @param[in] resultImage the result image of the template matching
+      * @param[in] peak the position of the peak, which must not lie on the
+      *            border of the result image
+      * @param[out] offset the offset of the quadratic's maximum from the peak
+      *             (limited to half a pixel in each axis)
+      * @param[out] hessian the hessian matrix of the quadratic
+      * @return true if the quadratic has a maximum (negative definite hessian)
+      */
+    static bool fitPeakQuadratic(
+            const Image& resultImage,
+            const cv::Point2i& peak,
+            cv::Point2d& offset,
+            cv::Matx22d& hessian);
+
+    /** Refines a match to sub-pixel and sub-step accuracy and estimates its
+      * covariance. The scores of the 3x3 positions around the match are
+      * fitted with a two-dimensional quadratic and the best scores of the
+      * neighboring yaw hypotheses with a parabola. The covariance is the
+      * inverse of the negative curvature of the fits, scaled by the deficit
+      * of the match's score from a perfect score
+      * @param[in] sourceImage the prepared source image (search space)
+      * @param[in] templateImage the prepared template image
+      * @param[in/out] matchedPosition the position (top left corner of the
+      *                template) and yaw of the match to be refined
+      * @param[out] covariance the covariance of the position in pixels and
+      *             the yaw in radians
+      * @param[in] matchYaw whether the yaw is refined
+      * @param[in] matchYawStep the step of the yaw hypotheses in radians
+      * @return true if the match lies far enough from the border of the
+      *         source image to be refined
+      */
+    static bool refineMatch(
+            const Image& sourceImage,
+            const Image& templateImage,
+            cv::Point3d& matchedPosition,
+            cv::Matx33d& covariance,
+            bool matchYaw = false,
+            double matchYawStep = 0.);
 
     /** Displays result of the template matching by drawing rectangles at the
       * matched position in the source and the result images
@@ -163,12 +538,66 @@ class ImageProcessing {
     /** Rotates an image around its center
       * @param[in] inputImage the image source
       * @param[out] outputImage the image destination
-      * @param[in] angle the yaw value of rotation
+      * @param[in] angle the yaw value of rotation in radians
+      * @param[in] borderValue the value of the cells outside the input image
       */
     static void warpImage(
             const Image& inputImage,
             Image& outputImage,
-            double angle);
+            double angle,
+            double borderValue = 0.);
+
+  protected:
+    /** Calculates the log-magnitude spectrum of an image resampled to polar
+      * coordinates, with the angles in [0, pi) along the rows and the radii
+      * along the columns. The image is weighted by a radially symmetric Hann
+      * window and zero padded to a square size first, so that a rotation of
+      * the image is a cyclic shift of the rows. The spectrum is high-pass
+      * filtered and its lowest frequencies are skipped, since they carry
+      * little information about the rotation
+      * @param[in] inputImage the input image
+      * @param[out] polarSpectrum the spectrum in polar coordinates
+      * @param[in] size the square size the image is padded to
+      * @param[in] numAngles the number of sampled angles
+      */
+    static void calculatePolarSpectrum(
+            const Image& inputImage,
+            Image& polarSpectrum,
+            int size,
+            int numAngles);
+
+    /** Returns the number of yaw hypotheses of a template matching
+      * @param[in] matchYaw whether the yaw is matched
+      * @param[in] matchYawRange scan range of yaw angle in radians
+      * @param[in] matchYawStep scan step of yaw angle in radians
+      * @return the number of yaw hypotheses (one if the yaw is not matched)
+      */
+    static int getNumYaws(
+            bool matchYaw,
+            double matchYawRange,
+            double matchYawStep);
+
+    /** Matches a template around the position of a candidate within a window
+      * and updates the candidate's position and score
+      * @param[in] sourceImage the source image (search space)
+      * @param[in] templateImage the image to be matched
+      * @param[in] yaw the yaw of the candidate
+      * @param[in] warpTemplate whether to rotate the template by the yaw
+      * @param[in] radius the radius of the window in pixels
+      * @param[in/out] candidate the candidate to be refined
+      * @param[out] warpedTemplate the buffer of the rotated template
+      * @param[out] resultMatrix the result of the matching within the window
+      * @return the position of the window's origin in the source image
+      */
+    static cv::Point2i refineCandidate(
+            const Image& sourceImage,
+            const Image& templateImage,
+            double yaw,
+            bool warpTemplate,
+            int radius,
+            MatchCandidate& candidate,
+            Image& warpedTemplate,
+            Image& resultMatrix);
 };
 
 }  // namespace ga_slam
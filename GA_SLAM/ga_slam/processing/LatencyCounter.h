@@ -0,0 +1,108 @@
+/*
+ * This file is part of GA SLAM.
+ * Copyright (C) 2018 Dimitris Geromichalos,
+ * Planetary Robotics Lab (PRL), European Space Agency (ESA)
+ *
+ * GA SLAM is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GA SLAM is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GA SLAM. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+// STL
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+namespace ga_slam {
+
+/** Thread-safe counter of the latencies of a processing stage, which keeps
+  * the number of samples and their total and maximum duration
+  */
+class LatencyCounter {
+  public:
+    /// Clock used to measure the latencies
+    using Clock = std::chrono::steady_clock;
+
+    /// Creates a counter without samples
+    LatencyCounter(void) : count_(0), totalNanoseconds_(0),
+            maxNanoseconds_(0) {}
+
+    /// Delete the default copy/move constructors and operators
+    LatencyCounter(const LatencyCounter&) = delete;
+    LatencyCounter& operator=(const LatencyCounter&) = delete;
+    LatencyCounter(LatencyCounter&&) = delete;
+    LatencyCounter& operator=(LatencyCounter&&) = delete;
+
+    /** Adds the latency of a stage that started at a time point and has
+      * just finished
+      * @param[in] start the time point the stage started
+      */
+    void addSince(const Clock::time_point& start) {
+        add(Clock::now() - start);
+    }
+
+    /** Adds a latency sample
+      * @param[in] latency the duration of the sample
+      */
+    void add(const Clock::duration& latency) {
+        const uint64_t nanoseconds = std::chrono::duration_cast<
+                std::chrono::nanoseconds>(latency).count();
+
+        count_.fetch_add(1, std::memory_order_relaxed);
+        totalNanoseconds_.fetch_add(nanoseconds, std::memory_order_relaxed);
+
+        uint64_t maxNanoseconds =
+                maxNanoseconds_.load(std::memory_order_relaxed);
+        while (nanoseconds > maxNanoseconds &&
+                !maxNanoseconds_.compare_exchange_weak(maxNanoseconds,
+                nanoseconds, std::memory_order_relaxed)) {}
+    }
+
+    /// Returns the number of samples
+    uint64_t getCount(void) const {
+        return count_.load(std::memory_order_relaxed);
+    }
+
+    /// Returns the mean latency in seconds (zero if there are no samples)
+    double getMeanLatency(void) const {
+        const uint64_t count = getCount();
+        if (!count) return 0.;
+
+        return totalNanoseconds_.load(std::memory_order_relaxed) * 1e-9 /
+                count;
+    }
+
+    /// Returns the maximum latency in seconds
+    double getMaxLatency(void) const {
+        return maxNanoseconds_.load(std::memory_order_relaxed) * 1e-9;
+    }
+
+    /// Removes the samples
+    void reset(void) {
+        count_.store(0, std::memory_order_relaxed);
+        totalNanoseconds_.store(0, std::memory_order_relaxed);
+        maxNanoseconds_.store(0, std::memory_order_relaxed);
+    }
+
+  protected:
+    /// Number of samples
+    std::atomic<uint64_t> count_;
+
+    /// Total and maximum duration of the samples in nanoseconds
+    std::atomic<uint64_t> totalNanoseconds_;
+    std::atomic<uint64_t> maxNanoseconds_;
+};
+
+}  // namespace ga_slam
+
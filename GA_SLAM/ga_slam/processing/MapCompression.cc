@@ -0,0 +1,206 @@
+/*
+ * This file is part of GA SLAM.
+ * Copyright (C) 2018 Dimitris Geromichalos,
+ * Planetary Robotics Lab (PRL), European Space Agency (ESA)
+ *
+ * GA SLAM is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GA SLAM is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GA SLAM. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "ga_slam/processing/MapCompression.h"
+
+// GA SLAM
+#include "ga_slam/TypeDefs.h"
+#include "ga_slam/mapping/Map.h"
+
+// STL
+#include <algorithm>
+#include <limits>
+#include <cstddef>
+#include <cstdint>
+#include <cmath>
+
+namespace ga_slam {
+
+constexpr float MapCompression::minVariance;
+constexpr float MapCompression::maxVariance;
+constexpr float MapCompression::minValidElevationStep;
+
+void MapCompression::calculateElevationQuantization(
+        const float* values,
+        size_t numValues,
+        double minElevationStep,
+        float& elevationOffset,
+        float& elevationStep) {
+    constexpr double maxNumSteps = 2. * std::numeric_limits<int16_t>::max();
+    minElevationStep = std::max<double>(minElevationStep,
+            minValidElevationStep);
+
+    float minValue = std::numeric_limits<float>::max();
+    float maxValue = std::numeric_limits<float>::lowest();
+
+    for (size_t i = 0; i < numValues; ++i) {
+        if (std::isnan(values[i])) continue;
+
+        minValue = std::min(minValue, values[i]);
+        maxValue = std::max(maxValue, values[i]);
+    }
+
+    if (minValue > maxValue) {
+        elevationOffset = 0.f;
+        elevationStep = minElevationStep;
+        return;
+    }
+
+    const double range = static_cast<double>(maxValue) - minValue;
+
+    elevationOffset = (static_cast<double>(minValue) + maxValue) / 2.;
+    elevationStep = std::max(minElevationStep, range / maxNumSteps);
+}
+
+void MapCompression::packElevation(
+        const float* values,
+        size_t numValues,
+        float elevationOffset,
+        float elevationStep,
+        int16_t* packedValues,
+        uint64_t* knownMask) {
+    constexpr float maxValue = std::numeric_limits<int16_t>::max();
+    const float scale = elevationStep > 0.f ? 1.f / elevationStep : 0.f;
+
+    for (size_t i = 0; i < numValues; ++i) {
+        const bool known = !std::isnan(values[i]);
+        const float difference = known ? values[i] - elevationOffset : 0.f;
+        const float value = std::round(difference * scale);
+
+        packedValues[i] = std::max(-maxValue, std::min(maxValue, value));
+    }
+
+    const size_t numWords = (numValues + 63) / 64;
+
+    for (size_t word = 0; word < numWords; ++word) {
+        const size_t begin = word * 64;
+        const size_t end = std::min(begin + 64, numValues);
+        uint64_t mask = 0;
+
+        for (size_t i = begin; i < end; ++i)
+            mask |= static_cast<uint64_t>(!std::isnan(values[i])) <<
+                    (i - begin);
+
+        knownMask[word] = mask;
+    }
+}
+
+void MapCompression::unpackElevation(
+        const int16_t* packedValues,
+        const uint64_t* knownMask,
+        size_t numValues,
+        float elevationOffset,
+        float elevationStep,
+        float* values) {
+    constexpr float unknownValue = std::numeric_limits<float>::quiet_NaN();
+
+    for (size_t i = 0; i < numValues; ++i) {
+        const bool known = (knownMask[i / 64] >> (i % 64)) & 1;
+        const float value = elevationOffset + packedValues[i] * elevationStep;
+
+        values[i] = known ? value : unknownValue;
+    }
+}
+
+void MapCompression::packVariance(
+        const float* variances,
+        size_t numValues,
+        uint8_t* packedVariances) {
+    constexpr float maxValue = std::numeric_limits<uint8_t>::max();
+    const float logMinVariance = std::log(minVariance);
+    const float scale = maxValue / (std::log(maxVariance) - logMinVariance);
+
+    for (size_t i = 0; i < numValues; ++i) {
+        const float variance = std::isnan(variances[i]) ? minVariance :
+                std::min(std::max(variances[i], minVariance), maxVariance);
+        const float value = std::round((std::log(variance) - logMinVariance) *
+                scale);
+
+        packedVariances[i] = std::min(std::max(value, 0.f), maxValue);
+    }
+}
+
+void MapCompression::unpackVariance(
+        const uint8_t* packedVariances,
+        size_t numValues,
+        float* variances) {
+    constexpr float maxValue = std::numeric_limits<uint8_t>::max();
+    const float logMinVariance = std::log(minVariance);
+    const float step = (std::log(maxVariance) - logMinVariance) / maxValue;
+
+    for (size_t i = 0; i < numValues; ++i)
+        variances[i] = std::exp(logMinVariance + packedVariances[i] * step);
+}
+
+void MapCompression::packSnapshot(
+        const MapSnapshot& snapshot,
+        CompactMapSnapshot& compactSnapshot,
+        double minElevationStep) {
+    const size_t numCells = snapshot.meanZ.size();
+
+    compactSnapshot.parameters = snapshot.parameters;
+    compactSnapshot.startIndexX = snapshot.startIndexX;
+    compactSnapshot.startIndexY = snapshot.startIndexY;
+    compactSnapshot.valid = snapshot.valid;
+    compactSnapshot.timestamp = snapshot.timestamp;
+    compactSnapshot.version = snapshot.version;
+
+    compactSnapshot.meanZ.resize(numCells);
+    compactSnapshot.knownCells.resize((numCells + 63) / 64);
+    compactSnapshot.varianceZ.resize(numCells);
+
+    calculateElevationQuantization(snapshot.meanZ.data(), numCells,
+            minElevationStep, compactSnapshot.elevationOffset,
+            compactSnapshot.elevationStep);
+    packElevation(snapshot.meanZ.data(), numCells,
+            compactSnapshot.elevationOffset, compactSnapshot.elevationStep,
+            compactSnapshot.meanZ.data(), compactSnapshot.knownCells.data());
+    packVariance(snapshot.varianceZ.data(), numCells,
+            compactSnapshot.varianceZ.data());
+}
+
+void MapCompression::unpackSnapshot(
+        const CompactMapSnapshot& compactSnapshot,
+        MapSnapshot& snapshot) {
+    const int size = compactSnapshot.parameters.size;
+    const size_t numCells = compactSnapshot.meanZ.size();
+
+    snapshot.parameters = compactSnapshot.parameters;
+    snapshot.startIndexX = compactSnapshot.startIndexX;
+    snapshot.startIndexY = compactSnapshot.startIndexY;
+    snapshot.valid = compactSnapshot.valid;
+    snapshot.timestamp = compactSnapshot.timestamp;
+    snapshot.version = compactSnapshot.version;
+
+    snapshot.meanZ.resize(size, size);
+    snapshot.varianceZ.resize(size, size);
+
+    unpackElevation(compactSnapshot.meanZ.data(),
+            compactSnapshot.knownCells.data(), numCells,
+            compactSnapshot.elevationOffset, compactSnapshot.elevationStep,
+            snapshot.meanZ.data());
+    unpackVariance(compactSnapshot.varianceZ.data(), numCells,
+            snapshot.varianceZ.data());
+
+    for (size_t i = 0; i < numCells; ++i)
+        if (std::isnan(snapshot.meanZ(i)))
+            snapshot.varianceZ(i) = std::numeric_limits<float>::quiet_NaN();
+}
+
+}  // namespace ga_slam
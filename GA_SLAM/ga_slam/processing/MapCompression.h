@@ -0,0 +1,145 @@
+/*
+ * This file is part of GA SLAM.
+ * Copyright (C) 2018 Dimitris Geromichalos,
+ * Planetary Robotics Lab (PRL), European Space Agency (ESA)
+ *
+ * GA SLAM is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GA SLAM is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GA SLAM. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+// GA SLAM
+#include "ga_slam/TypeDefs.h"
+#include "ga_slam/mapping/Map.h"
+
+// STL
+#include <cstddef>
+#include <cstdint>
+
+namespace ga_slam {
+
+/** Static class with the conversions between the float layers of the map and
+  * their compact representation. The elevation is stored as 16-bit
+  * fixed-point values with the known cells in a bitmask, and the variance as
+  * 8-bit logarithmically quantized values. The conversion loops are branchless
+  * and work on contiguous arrays, so that the compiler vectorizes them.
+  */
+class MapCompression {
+  public:
+    /// Delete the default constructor
+    MapCompression(void) = delete;
+
+    /** Finds the offset and step of the fixed-point elevation that cover the
+      * range of the known values with at least the requested precision
+      * @param[in] values the elevation values (NaN if unknown)
+      * @param[in] numValues the number of values
+      * @param[in] minElevationStep the requested elevation step in meters,
+      *            which is increased if the range cannot be covered or if it
+      *            is smaller than the minimum valid step
+      * @param[out] elevationOffset the elevation of the fixed-point value 0
+      * @param[out] elevationStep the elevation of one fixed-point step
+      */
+    static void calculateElevationQuantization(
+            const float* values,
+            size_t numValues,
+            double minElevationStep,
+            float& elevationOffset,
+            float& elevationStep);
+
+    /** Converts elevation values to fixed-point values and a bitmask of the
+      * known values
+      * @param[in] values the elevation values (NaN if unknown)
+      * @param[in] numValues the number of values
+      * @param[in] elevationOffset the elevation of the fixed-point value 0
+      * @param[in] elevationStep the elevation of one fixed-point step (all
+      *            values are packed as the offset if it is not positive)
+      * @param[out] packedValues the fixed-point values (numValues elements)
+      * @param[out] knownMask the bitmask of the known values
+      *             ((numValues + 63) / 64 elements)
+      */
+    static void packElevation(
+            const float* values,
+            size_t numValues,
+            float elevationOffset,
+            float elevationStep,
+            int16_t* packedValues,
+            uint64_t* knownMask);
+
+    /** Converts fixed-point values back to elevation values, with NaN for
+      * the values missing from the bitmask
+      * @param[in] packedValues the fixed-point values
+      * @param[in] knownMask the bitmask of the known values
+      * @param[in] numValues the number of values
+      * @param[in] elevationOffset the elevation of the fixed-point value 0
+      * @param[in] elevationStep the elevation of one fixed-point step
+      * @param[out] values the elevation values (numValues elements)
+      */
+    static void unpackElevation(
+            const int16_t* packedValues,
+            const uint64_t* knownMask,
+            size_t numValues,
+            float elevationOffset,
+            float elevationStep,
+            float* values);
+
+    /** Quantizes variances logarithmically between the minimum and maximum
+      * variance, so that the relative error is the same for all variances
+      * @param[in] variances the variance values
+      * @param[in] numValues the number of values
+      * @param[out] packedVariances the quantized variances
+      */
+    static void packVariance(
+            const float* variances,
+            size_t numValues,
+            uint8_t* packedVariances);
+
+    /** Converts quantized variances back to variance values
+      * @param[in] packedVariances the quantized variances
+      * @param[in] numValues the number of values
+      * @param[out] variances the variance values
+      */
+    static void unpackVariance(
+            const uint8_t* packedVariances,
+            size_t numValues,
+            float* variances);
+
+    /** Converts a snapshot of the map to its compact representation
+      * @param[in] snapshot the snapshot to be converted
+      * @param[out] compactSnapshot the compact snapshot
+      * @param[in] minElevationStep the requested elevation step in meters
+      */
+    static void packSnapshot(
+            const MapSnapshot& snapshot,
+            CompactMapSnapshot& compactSnapshot,
+            double minElevationStep = 0.001);
+
+    /** Converts a compact snapshot back to a snapshot of the map. The
+      * variances of the unknown cells are restored as NaN
+      * @param[in] compactSnapshot the compact snapshot to be converted
+      * @param[out] snapshot the restored snapshot
+      */
+    static void unpackSnapshot(
+            const CompactMapSnapshot& compactSnapshot,
+            MapSnapshot& snapshot);
+
+  public:
+    /// Range of the variances that are quantized without clamping
+    static constexpr float minVariance = 1e-6f;
+    static constexpr float maxVariance = 1e3f;
+
+    /// Smallest elevation step, which keeps the step of a constant map positive
+    static constexpr float minValidElevationStep = 1e-6f;
+};
+
+}  // namespace ga_slam
@@ -0,0 +1,99 @@
+/*
+ * This file is part of GA SLAM.
+ * Copyright (C) 2018 Dimitris Geromichalos,
+ * Planetary Robotics Lab (PRL), European Space Agency (ESA)
+ *
+ * GA SLAM is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GA SLAM is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GA SLAM. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+// STL
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+
+namespace ga_slam {
+
+/** Sequence lock publishing a value from a writer to multiple readers without
+  * blocking them. The value is stored as atomic words and a counter is
+  * incremented before and after each write, so a reader retries its copy if
+  * a write happened meanwhile.
+  * @note the value type must be safe to copy byte by byte and the writes must
+  *       be serialized by the caller
+  */
+template<typename T>
+class SeqLock {
+  public:
+    /// Initializes the lock with a value
+    explicit SeqLock(const T& value) : sequence_(0) { store(value); }
+
+    /// Delete the default copy/move constructors and operators
+    SeqLock(const SeqLock&) = delete;
+    SeqLock& operator=(const SeqLock&) = delete;
+    SeqLock(SeqLock&&) = delete;
+    SeqLock& operator=(SeqLock&&) = delete;
+
+    /** Publishes a new value
+      * @param[in] value the value to be published
+      */
+    void store(const T& value) {
+        uint64_t words[numWords_] = {};
+        std::memcpy(words, &value, sizeof(T));
+
+        const uint64_t sequence = sequence_.load(std::memory_order_relaxed);
+        sequence_.store(sequence + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        for (size_t i = 0; i < numWords_; ++i)
+            words_[i].store(words[i], std::memory_order_relaxed);
+
+        sequence_.store(sequence + 2, std::memory_order_release);
+    }
+
+    /** Returns a consistent copy of the last published value
+      * @return the copy of the value
+      */
+    T load(void) const {
+        uint64_t words[numWords_];
+        uint64_t sequenceBefore, sequenceAfter;
+
+        do {
+            sequenceBefore = sequence_.load(std::memory_order_acquire);
+
+            for (size_t i = 0; i < numWords_; ++i)
+                words[i] = words_[i].load(std::memory_order_relaxed);
+
+            std::atomic_thread_fence(std::memory_order_acquire);
+            sequenceAfter = sequence_.load(std::memory_order_relaxed);
+        } while ((sequenceBefore & 1) || sequenceBefore != sequenceAfter);
+
+        T value;
+        std::memcpy(static_cast<void*>(&value), words, sizeof(T));
+
+        return value;
+    }
+
+  protected:
+    /// Number of 64-bit words needed to hold the value
+    static constexpr size_t numWords_ = (sizeof(T) + 7) / 8;
+
+    /// Counter of the writes (odd while a write is in progress)
+    std::atomic<uint64_t> sequence_;
+
+    /// Words holding the published value
+    std::atomic<uint64_t> words_[numWords_];
+};
+
+}  // namespace ga_slam
@@ -0,0 +1,102 @@
+/*
+ * This file is part of GA SLAM.
+ * Copyright (C) 2018 Dimitris Geromichalos,
+ * Planetary Robotics Lab (PRL), European Space Agency (ESA)
+ *
+ * GA SLAM is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GA SLAM is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GA SLAM. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "ga_slam/processing/TaskThread.h"
+
+// STL
+#include <functional>
+#include <utility>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+namespace ga_slam {
+
+void TaskThread::start(std::function<void(void)> task) {
+    stop();
+
+    task_ = std::move(task);
+    stop_ = false;
+    thread_ = std::thread(&TaskThread::runThread, this);
+}
+
+void TaskThread::run(const PrepareFunction& prepare) {
+    std::unique_lock<std::mutex> guard(mutex_);
+    finished_.wait(guard, [this] { return !busy_; });
+
+    if (stop_ || !thread_.joinable()) {
+        prepare();
+        guard.unlock();
+        if (task_) task_();
+        return;
+    }
+
+    prepare();
+    busy_ = true;
+    guard.unlock();
+
+    triggered_.notify_one();
+}
+
+bool TaskThread::tryRun(const PrepareFunction& prepare) {
+    std::unique_lock<std::mutex> guard(mutex_);
+    if (busy_ || stop_ || !thread_.joinable()) return false;
+
+    prepare();
+    busy_ = true;
+    guard.unlock();
+
+    triggered_.notify_one();
+
+    return true;
+}
+
+void TaskThread::wait(void) {
+    std::unique_lock<std::mutex> guard(mutex_);
+    finished_.wait(guard, [this] { return !busy_; });
+}
+
+void TaskThread::stop(void) {
+    if (!thread_.joinable()) return;
+
+    std::unique_lock<std::mutex> guard(mutex_);
+    stop_ = true;
+    guard.unlock();
+
+    triggered_.notify_one();
+    thread_.join();
+}
+
+void TaskThread::runThread(void) {
+    std::unique_lock<std::mutex> guard(mutex_);
+
+    while (true) {
+        triggered_.wait(guard, [this] { return busy_ || stop_; });
+        if (!busy_) return;
+
+        guard.unlock();
+        task_();
+        guard.lock();
+
+        busy_ = false;
+        finished_.notify_all();
+    }
+}
+
+}  // namespace ga_slam
@@ -0,0 +1,100 @@
+/*
+ * This file is part of GA SLAM.
+ * Copyright (C) 2018 Dimitris Geromichalos,
+ * Planetary Robotics Lab (PRL), European Space Agency (ESA)
+ *
+ * GA SLAM is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GA SLAM is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GA SLAM. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+// GA SLAM
+#include "ga_slam/processing/FunctionRef.h"
+
+// STL
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+namespace ga_slam {
+
+/** Persistent thread running a task each time it is triggered, so that a
+  * stage of a pipeline reuses one thread instead of starting a new one for
+  * each input. The inputs of a run are passed by a function called under
+  * the thread's lock, while no run is pending.
+  */
+class TaskThread {
+  public:
+    /// Function passing the inputs of a run to the task
+    using PrepareFunction = FunctionRef<void(void)>;
+
+    /// Creates a stopped thread
+    TaskThread(void) = default;
+
+    /// Stops and joins the thread
+    ~TaskThread(void) { stop(); }
+
+    /// Delete the default copy/move constructors and operators
+    TaskThread(const TaskThread&) = delete;
+    TaskThread& operator=(const TaskThread&) = delete;
+    TaskThread(TaskThread&&) = delete;
+    TaskThread& operator=(TaskThread&&) = delete;
+
+    /** Starts the thread, stopping the previous one first
+      * @param[in] task the task run each time the thread is triggered
+      */
+    void start(std::function<void(void)> task);
+
+    /** Triggers a run of the task, waiting for the previous run to finish
+      * @note if the thread is stopped, the task is run by the calling thread
+      * @param[in] prepare the function passing the inputs of the run
+      */
+    void run(const PrepareFunction& prepare);
+
+    /** Triggers a run of the task if the thread is started and idle
+      * @param[in] prepare the function passing the inputs of the run (only
+      *            called if the run is triggered)
+      * @return true if the run was triggered
+      */
+    bool tryRun(const PrepareFunction& prepare);
+
+    /// Waits until the last triggered run has finished
+    void wait(void);
+
+    /// Finishes the triggered run (if any) and joins the thread
+    void stop(void);
+
+  protected:
+    /// Waits for the triggers and runs the task until stopped
+    void runThread(void);
+
+  protected:
+    /// Thread running the task and the task itself
+    std::thread thread_;
+    std::function<void(void)> task_;
+
+    /// Mutex and conditions protecting the state shared with the thread
+    std::mutex mutex_;
+    std::condition_variable triggered_;
+    std::condition_variable finished_;
+
+    /// Whether a run has been triggered and has not finished yet
+    bool busy_ = false;
+
+    /// Whether the thread should exit
+    bool stop_ = false;
+};
+
+}  // namespace ga_slam
@@ -0,0 +1,155 @@
+/*
+ * This file is part of GA SLAM.
+ * Copyright (C) 2018 Dimitris Geromichalos,
+ * Planetary Robotics Lab (PRL), European Space Agency (ESA)
+ *
+ * GA SLAM is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GA SLAM is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GA SLAM. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "ga_slam/processing/ThreadPool.h"
+
+// STL
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+
+namespace ga_slam {
+
+namespace {
+
+/// Pool of the calling thread if it is a worker and its index in the pool
+thread_local const ThreadPool* workerPool = nullptr;
+thread_local int workerIndex = 0;
+
+}  // namespace
+
+void ThreadPool::configure(int numThreads) {
+    std::lock_guard<std::mutex> configureGuard(configureMutex_);
+
+    stopWorkers();
+
+    if (numThreads <= 0)
+        numThreads = std::max(1u, std::thread::hardware_concurrency());
+
+    std::lock_guard<std::mutex> stateGuard(stateMutex_);
+    numThreads_ = numThreads;
+    stop_ = false;
+
+    for (int i = 1; i < numThreads_; ++i)
+        workers_.emplace_back(&ThreadPool::runWorker, this, i);
+}
+
+void ThreadPool::parallelFor(
+        size_t size,
+        size_t chunkSize,
+        const RangeFunction& function) {
+    if (!size) return;
+
+    chunkSize = std::max<size_t>(chunkSize, 1);
+    const int threadIndex = getCallingThreadIndex();
+
+    std::unique_lock<std::mutex> stateGuard(stateMutex_);
+
+    if (stop_ || workers_.empty() || size <= chunkSize) {
+        stateGuard.unlock();
+        function(0, size, threadIndex);
+        return;
+    }
+
+    Loop loop;
+    loop.function = &function;
+    loop.size = size;
+    loop.chunkSize = chunkSize;
+    loop.nextChunk = 0;
+    loop.busyWorkers = 0;
+    loop.next = nullptr;
+
+    Loop** link = &loops_;
+    while (*link) link = &(*link)->next;
+    *link = &loop;
+    stateGuard.unlock();
+
+    loopStarted_.notify_all();
+    processChunks(loop, threadIndex);
+
+    stateGuard.lock();
+    loopFinished_.wait(stateGuard, [&loop] { return !loop.busyWorkers; });
+
+    link = &loops_;
+    while (*link != &loop) link = &(*link)->next;
+    *link = loop.next;
+}
+
+void ThreadPool::runWorker(int threadIndex) {
+    workerPool = this;
+    workerIndex = threadIndex;
+
+    std::unique_lock<std::mutex> stateGuard(stateMutex_);
+
+    while (true) {
+        Loop* loop = nullptr;
+        loopStarted_.wait(stateGuard, [this, &loop] {
+                loop = findPendingLoop();
+                return stop_ || loop; });
+
+        if (stop_) return;
+
+        loop->busyWorkers++;
+        stateGuard.unlock();
+
+        processChunks(*loop, threadIndex);
+
+        stateGuard.lock();
+        if (--loop->busyWorkers == 0) loopFinished_.notify_all();
+    }
+}
+
+ThreadPool::Loop* ThreadPool::findPendingLoop(void) const {
+    for (Loop* loop = loops_; loop; loop = loop->next)
+        if (loop->nextChunk < loop->size) return loop;
+
+    return nullptr;
+}
+
+void ThreadPool::processChunks(Loop& loop, int threadIndex) {
+    while (true) {
+        const size_t begin = loop.nextChunk.fetch_add(loop.chunkSize);
+        if (begin >= loop.size) return;
+
+        const size_t end = std::min(begin + loop.chunkSize, loop.size);
+        (*loop.function)(begin, end, threadIndex);
+    }
+}
+
+void ThreadPool::stopWorkers(void) {
+    std::vector<std::thread> workers;
+
+    std::unique_lock<std::mutex> stateGuard(stateMutex_);
+    stop_ = true;
+    workers.swap(workers_);
+    numThreads_ = 1;
+    stateGuard.unlock();
+
+    loopStarted_.notify_all();
+
+    for (auto& worker : workers) worker.join();
+}
+
+int ThreadPool::getCallingThreadIndex(void) const {
+    return (workerPool == this) ? workerIndex : 0;
+}
+
+}  // namespace ga_slam
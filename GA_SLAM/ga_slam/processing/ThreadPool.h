@@ -0,0 +1,156 @@
+/*
+ * This file is part of GA SLAM.
+ * Copyright (C) 2018 Dimitris Geromichalos,
+ * Planetary Robotics Lab (PRL), European Space Agency (ESA)
+ *
+ * GA SLAM is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GA SLAM is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GA SLAM. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+// GA SLAM
+#include "ga_slam/processing/FunctionRef.h"
+
+// STL
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+namespace ga_slam {
+
+/** Persistent pool of worker threads used to split data-parallel loops into
+  * chunks. The chunks of a loop are claimed dynamically by the workers and
+  * the calling thread, so faster threads take over the remaining work.
+  * Loops started concurrently by different threads are queued, and the
+  * workers move on to the next queued loop once the chunks of the current
+  * one are claimed.
+  */
+class ThreadPool {
+  public:
+    /// Function processing the range [begin, end) of a loop on a thread
+    /// (referenced without being copied, so starting a loop never allocates)
+    using RangeFunction = FunctionRef<void(size_t begin, size_t end,
+            int threadIndex)>;
+
+    /// Creates a pool without workers, which runs loops serially
+    ThreadPool(void) : numThreads_(1) {}
+
+    /// Stops and joins the workers
+    ~ThreadPool(void) { stopWorkers(); }
+
+    /// Delete the default copy/move constructors and operators
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+    ThreadPool(ThreadPool&&) = delete;
+    ThreadPool& operator=(ThreadPool&&) = delete;
+
+    /// Returns the number of threads (including the calling one) that can
+    /// process a loop, which is also the bound of the thread indices
+    int getNumThreads(void) const { return numThreads_; }
+
+    /** Restarts the pool with a new number of threads
+      * @param[in] numThreads the number of threads processing a loop
+      *            including the calling thread (a non-positive value selects
+      *            the number of hardware threads)
+      */
+    void configure(int numThreads);
+
+    /** Splits the range [0, size) in chunks and processes them using the
+      * workers and the calling thread. Returns when all chunks are processed.
+      * @note if the pool is already processing other loops, the loop is
+      *       queued behind them. The calling thread starts processing its
+      *       chunks right away and the workers join it when the earlier
+      *       loops have no chunks left, so a loop never waits for another
+      *       one and it can also be started from within a chunk
+      * @note the calling thread processes its chunks with its own index if it
+      *       is a worker of the pool (as in a loop started from within a
+      *       chunk) and with index 0 otherwise, so the threads processing
+      *       chunks at the same time have distinct indices, unless several
+      *       threads outside the pool start loops concurrently
+      * @param[in] size the size of the range
+      * @param[in] chunkSize the number of elements in each chunk
+      * @param[in] function the function processing each chunk
+      */
+    void parallelFor(
+            size_t size,
+            size_t chunkSize,
+            const RangeFunction& function);
+
+  protected:
+    /// Loop being processed by the pool, which lives on the stack of the
+    /// thread that started it
+    struct Loop {
+        /// Function, size and chunk size of the loop
+        const RangeFunction* function;
+        size_t size;
+        size_t chunkSize;
+
+        /// Beginning of the next chunk to be claimed
+        std::atomic<size_t> nextChunk;
+
+        /// Number of workers processing chunks of the loop
+        size_t busyWorkers;
+
+        /// Next loop in the queue
+        Loop* next;
+    };
+
+    /** Waits for queued loops and processes their chunks until stopped
+      * @param[in] threadIndex the index of the worker's thread
+      */
+    void runWorker(int threadIndex);
+
+    /** Returns the oldest queued loop that still has chunks to be claimed
+      * @note the state mutex must be held
+      * @return the loop or null if none
+      */
+    Loop* findPendingLoop(void) const;
+
+    /** Claims and processes chunks of a loop until none is left
+      * @param[in] loop the loop to be processed
+      * @param[in] threadIndex the index of the processing thread
+      */
+    static void processChunks(Loop& loop, int threadIndex);
+
+    /// Stops and joins the workers
+    void stopWorkers(void);
+
+    /// Returns the index of the calling thread (0 if not a worker of the pool)
+    int getCallingThreadIndex(void) const;
+
+  protected:
+    /// Worker threads (the calling thread of a loop is not included)
+    std::vector<std::thread> workers_;
+
+    /// Number of threads processing a loop
+    int numThreads_;
+
+    /// Mutex serializing the configurations
+    std::mutex configureMutex_;
+
+    /// Mutex and conditions protecting the state shared with the workers
+    std::mutex stateMutex_;
+    std::condition_variable loopStarted_;
+    std::condition_variable loopFinished_;
+
+    /// Queue of the loops being processed (linked through their next loop)
+    Loop* loops_ = nullptr;
+
+    /// Whether the workers should exit
+    bool stop_ = false;
+};
+
+}  // namespace ga_slam
@@ -0,0 +1,172 @@
+/*
+ * This file is part of GA SLAM.
+ * Copyright (C) 2018 Dimitris Geromichalos,
+ * Planetary Robotics Lab (PRL), European Space Agency (ESA)
+ *
+ * GA SLAM is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GA SLAM is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GA SLAM. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// GA SLAM
+#include "ga_slam/TypeDefs.h"
+#include "ga_slam/mapping/DataRegistration.h"
+#include "ga_slam/localization/ParticleFilter.h"
+#include "ga_slam/processing/CloudProcessing.h"
+
+// PCL
+#include <pcl/point_types.h>
+#include <pcl/point_cloud.h>
+
+// STL
+#include <vector>
+#include <atomic>
+#include <cstddef>
+#include <cmath>
+
+// GMock
+#include "gmock/gmock.h"
+
+#ifdef __GLIBC__
+
+/// Allocator functions of glibc, which the replacements below forward to
+extern "C" {
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t count, size_t size);
+void* __libc_realloc(void* pointer, size_t size);
+void __libc_free(void* pointer);
+}
+
+namespace {
+
+/// Whether the allocations are counted and their number
+std::atomic<bool> countAllocations(false);
+std::atomic<size_t> numAllocations(0);
+
+void countAllocation(void) {
+    if (countAllocations) numAllocations++;
+}
+
+}  // namespace
+
+/// Replacements of the allocator functions counting the allocations (the
+/// operator new and the Eigen allocations end up in malloc as well)
+extern "C" {
+void* malloc(size_t size) {
+    countAllocation();
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t count, size_t size) {
+    countAllocation();
+    return __libc_calloc(count, size);
+}
+
+void* realloc(void* pointer, size_t size) {
+    countAllocation();
+    return __libc_realloc(pointer, size);
+}
+
+void free(void* pointer) {
+    __libc_free(pointer);
+}
+}
+
+#endif
+
+namespace ga_slam {
+
+class AllocationTest : public ::testing::Test {
+  protected:
+    AllocationTest(void) {
+        dataRegistration_.configure(20., 0.25, -10., 10., 0.1, true, 2);
+        particleFilter_.configure(50, 0.1, 0.1, 0.05, 0.05, 0.05, 0.01);
+        particleFilter_.initialize();
+    }
+
+    /// Creates the sensor scan of a frame, whose density varies per frame
+    static Cloud::Ptr createScan(int frame) {
+        Cloud::Ptr scan(new Cloud);
+        const double step = 0.1 + 0.002 * (frame % 7);
+
+        for (double x = -6.; x < 6.; x += step)
+            for (double y = -6.; y < 6.; y += step)
+                scan->push_back(pcl::PointXYZ(x, y,
+                        std::sin(0.5 * x) * std::cos(0.3 * y)));
+
+        return scan;
+    }
+
+    /// Processes and registers the scan of a frame and updates the filter
+    void processFrame(int frame, const Cloud::Ptr& scan) {
+        Pose pose = Pose::Identity();
+        pose.translation() << 0.3 * frame, -0.2 * frame, 0.;
+
+        dataRegistration_.translateMap(pose);
+        CloudProcessing::processCloud(scan, processedCloud_, cloudVariances_,
+                voxelBuffers_, pose, pose,
+                dataRegistration_.getMapParameters(), 0.1, 0., 0., 0.05);
+        dataRegistration_.updateMap(processedCloud_, cloudVariances_);
+
+        const auto mapSnapshot = dataRegistration_.getSnapshot();
+
+        particleFilter_.predict(0.3, -0.2, 0.);
+        particleFilter_.update(pose, processedCloud_, *mapSnapshot);
+        particleFilter_.resample();
+
+        // The map cloud held by the filter since the last update is not the
+        // one overwritten, like in the scan-to-map matching of GaSlam
+        auto& mapCloud = mapClouds_[frame % 2];
+        CloudProcessing::convertMapToCloud(*mapSnapshot, mapCloud);
+
+        particleFilter_.predict(0.3, -0.2, 0.);
+        particleFilter_.update(pose, processedCloud_, mapCloud);
+        particleFilter_.resample();
+    }
+
+  protected:
+    DataRegistration dataRegistration_;
+    ParticleFilter particleFilter_;
+
+    VoxelBuffers voxelBuffers_;
+    Cloud::Ptr processedCloud_ = Cloud::Ptr(new Cloud);
+    std::vector<float> cloudVariances_;
+    Cloud::Ptr mapClouds_[2] = {Cloud::Ptr(new Cloud), Cloud::Ptr(new Cloud)};
+};
+
+TEST_F(AllocationTest, SteadyStateFrame) {
+#ifdef __GLIBC__
+    // Long enough for every entry of the change history to be reused, so
+    // that all the buffers have reached their steady state capacity
+    constexpr int numWarmUpFrames = 140;
+    constexpr int numFrames = 180;
+
+    std::vector<Cloud::Ptr> scans;
+    for (int frame = 0; frame < numFrames; ++frame)
+        scans.push_back(createScan(frame));
+
+    for (int frame = 0; frame < numWarmUpFrames; ++frame)
+        processFrame(frame, scans[frame]);
+
+    numAllocations = 0;
+    countAllocations = true;
+
+    for (int frame = numWarmUpFrames; frame < numFrames; ++frame)
+        processFrame(frame, scans[frame]);
+
+    countAllocations = false;
+
+    ASSERT_EQ(numAllocations, 0u);
+#endif
+}
+
+}  // namespace ga_slam
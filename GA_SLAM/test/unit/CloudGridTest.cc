@@ -0,0 +1,121 @@
+/*
+ * This file is part of GA SLAM.
+ * Copyright (C) 2018 Dimitris Geromichalos,
+ * Planetary Robotics Lab (PRL), European Space Agency (ESA)
+ *
+ * GA SLAM is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GA SLAM is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GA SLAM. If not, see <http://www.gnu.org/licenses/>.
+ */
+// GA SLAM
+#include "ga_slam/TypeDefs.h"
+#include "ga_slam/processing/CloudGrid.h"
+#include "ga_slam/processing/CloudProcessing.h"
+
+// PCL
+#include <pcl/point_types.h>
+#include <pcl/point_cloud.h>
+
+// STL
+#include <vector>
+#include <limits>
+#include <cmath>
+
+// GMock
+#include "gmock/gmock.h"
+
+namespace ga_slam {
+
+TEST(CloudGridTest, NearestSearchMatchesKdTree) {
+    Cloud::Ptr targetCloud(new Cloud);
+    for (double x = -5.; x < 5.; x += 0.25)
+        for (double y = -3.; y < 4.; y += 0.25)
+            targetCloud->push_back(pcl::PointXYZ(x, y,
+                    std::sin(x) * std::cos(2. * y)));
+    targetCloud->push_back(pcl::PointXYZ(
+            std::numeric_limits<float>::quiet_NaN(), 0.f, 0.f));
+
+    CloudGrid targetGrid;
+    targetGrid.setInputCloud(targetCloud);
+
+    Cloud::Ptr finiteCloud(new Cloud(*targetCloud));
+    finiteCloud->points.pop_back();
+    KdTree targetTree;
+    targetTree.setInputCloud(finiteCloud);
+
+    std::vector<int> neighborIndices(1);
+    std::vector<float> neighborSquaredDistances(1);
+    float squaredDistance;
+
+    for (double x = -8.; x < 8.; x += 0.37) {
+        for (double y = -7.; y < 7.; y += 0.41) {
+            const pcl::PointXYZ point(x, y, std::cos(x + y) * 2.);
+
+            ASSERT_GE(targetGrid.nearestSearch(point, squaredDistance), 0);
+            targetTree.nearestKSearch(point, 1, neighborIndices,
+                    neighborSquaredDistances);
+            ASSERT_FLOAT_EQ(squaredDistance, neighborSquaredDistances[0]);
+        }
+    }
+
+    const pcl::PointXYZ nanPoint(std::numeric_limits<float>::quiet_NaN(),
+            0.f, 0.f);
+    ASSERT_EQ(targetGrid.nearestSearch(nanPoint, squaredDistance), -1);
+
+    targetGrid.setInputCloud(Cloud::Ptr(new Cloud));
+    ASSERT_EQ(targetGrid.nearestSearch(pcl::PointXYZ(0.f, 0.f, 0.f),
+            squaredDistance), -1);
+}
+
+TEST(CloudGridTest, SinglePointAndLine) {
+    Cloud::Ptr targetCloud(new Cloud);
+    targetCloud->push_back(pcl::PointXYZ(1.f, 2.f, 3.f));
+
+    CloudGrid targetGrid;
+    targetGrid.setInputCloud(targetCloud);
+
+    float squaredDistance;
+    ASSERT_EQ(targetGrid.nearestSearch(pcl::PointXYZ(4.f, 6.f, 3.f),
+            squaredDistance), 0);
+    ASSERT_FLOAT_EQ(squaredDistance, 25.f);
+
+    targetCloud->clear();
+    for (int i = 0; i < 20; ++i)
+        targetCloud->push_back(pcl::PointXYZ(i, 0.f, 0.f));
+    targetGrid.setInputCloud(targetCloud);
+
+    ASSERT_EQ(targetGrid.nearestSearch(pcl::PointXYZ(12.4f, 5.f, 0.f),
+            squaredDistance), 12);
+    ASSERT_NEAR(squaredDistance, 0.16f + 25.f, 1e-4);
+}
+
+TEST(CloudGridTest, TransformedFitnessScore) {
+    Cloud::Ptr targetCloud(new Cloud);
+    for (int i = 0; i < 10; ++i)
+        for (int j = 0; j < 10; ++j)
+            targetCloud->push_back(pcl::PointXYZ(i, j, 0.f));
+
+    CloudGrid targetGrid;
+    targetGrid.setInputCloud(targetCloud);
+
+    Cloud cloud;
+    cloud.push_back(pcl::PointXYZ(1.f, 2.f, 0.5f));
+    cloud.push_back(pcl::PointXYZ(4.f, 4.f, -1.f));
+
+    Pose tf = Pose::Identity();
+    tf.translation() << 1., 1., 0.;
+
+    ASSERT_NEAR(CloudProcessing::calculateFitnessScore(cloud, tf,
+            targetGrid), (0.25 + 1.) / 2., 1e-6);
+}
+
+} // namespace ga_slam
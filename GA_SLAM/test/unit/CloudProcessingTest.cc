@@ -0,0 +1,201 @@
+/*
+ * This file is part of GA SLAM.
+ * Copyright (C) 2018 Dimitris Geromichalos,
+ * Planetary Robotics Lab (PRL), European Space Agency (ESA)
+ *
+ * GA SLAM is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GA SLAM is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GA SLAM. If not, see <http://www.gnu.org/licenses/>.
+ */
+// GA SLAM
+#include "ga_slam/TypeDefs.h"
+#include "ga_slam/processing/CloudProcessing.h"
+
+// PCL
+#include <pcl/point_types.h>
+#include <pcl/point_cloud.h>
+
+// STL
+#include <vector>
+#include <limits>
+#include <cmath>
+
+// GMock
+#include "gmock/gmock.h"
+
+namespace ga_slam {
+
+TEST(CloudProcessingTest, FitnessScore) {
+    Cloud::Ptr targetCloud(new Cloud);
+    for (int i = 0; i < 10; ++i)
+        for (int j = 0; j < 10; ++j)
+            targetCloud->push_back(pcl::PointXYZ(i, j, 0.f));
+
+    KdTree targetTree;
+    targetTree.setInputCloud(targetCloud);
+
+    ASSERT_DOUBLE_EQ(CloudProcessing::calculateFitnessScore(*targetCloud,
+            targetTree), 0.);
+
+    Cloud cloud;
+    cloud.push_back(pcl::PointXYZ(2.f, 3.f, 0.5f));
+    cloud.push_back(pcl::PointXYZ(5.f, 5.f, -1.f));
+
+    ASSERT_DOUBLE_EQ(CloudProcessing::calculateFitnessScore(cloud,
+            targetTree), (0.25 + 1.) / 2.);
+}
+
+TEST(CloudProcessingTest, SinglePassProcessing) {
+    Cloud::Ptr inputCloud(new Cloud);
+    inputCloud->push_back(pcl::PointXYZ(0.2f, 0.2f, 0.2f));
+    inputCloud->push_back(pcl::PointXYZ(1.5f, 1.5f, 0.5f));
+    inputCloud->push_back(pcl::PointXYZ(0.4f, 0.6f, 0.8f));
+    inputCloud->push_back(pcl::PointXYZ(100.f, 0.f, 0.f));
+    inputCloud->push_back(pcl::PointXYZ(0.5f, 0.5f, 5.f));
+    inputCloud->push_back(pcl::PointXYZ(
+            std::numeric_limits<float>::quiet_NaN(), 0.f, 0.f));
+
+    MapParameters mapParameters;
+    mapParameters.length = 10.;
+    mapParameters.positionX = 0.;
+    mapParameters.positionY = 0.;
+    mapParameters.minElevation = -1.;
+    mapParameters.maxElevation = 1.;
+
+    Pose mapToSensorTF = Pose::Identity();
+    mapToSensorTF.translation().x() = 1.;
+
+    Cloud::Ptr outputCloud(new Cloud);
+    std::vector<float> cloudVariances;
+    VoxelBuffers buffers;
+
+    for (int i = 0; i < 2; ++i) {
+        CloudProcessing::processCloud(inputCloud, outputCloud,
+                cloudVariances, buffers, Pose::Identity(), mapToSensorTF,
+                mapParameters, 1., 0., 1., 0.);
+
+        ASSERT_EQ(outputCloud->size(), 2u);
+        ASSERT_EQ(cloudVariances.size(), 2u);
+
+        const auto& point1 = outputCloud->points[0];
+        ASSERT_NEAR(point1.x, 1.3f, 1e-6);
+        ASSERT_NEAR(point1.y, 0.4f, 1e-6);
+        ASSERT_NEAR(point1.z, 0.5f, 1e-6);
+        ASSERT_NEAR(cloudVariances[0], 1.3 * 1.3 + 0.4 * 0.4 + 0.5 * 0.5,
+                1e-5);
+
+        const auto& point2 = outputCloud->points[1];
+        ASSERT_NEAR(point2.x, 2.5f, 1e-6);
+        ASSERT_NEAR(point2.y, 1.5f, 1e-6);
+        ASSERT_NEAR(point2.z, 0.5f, 1e-6);
+    }
+}
+
+TEST(CloudProcessingTest, ElevationLogLikelihood) {
+    MapSnapshot mapSnapshot;
+    mapSnapshot.parameters.length = 2.;
+    mapSnapshot.parameters.size = 2;
+    mapSnapshot.parameters.resolution = 1.;
+    mapSnapshot.parameters.positionX = 0.;
+    mapSnapshot.parameters.positionY = 0.;
+    mapSnapshot.valid = true;
+
+    mapSnapshot.meanZ.resize(2, 2);
+    mapSnapshot.meanZ << 0.f, 2.f,
+                         1.f, std::numeric_limits<float>::quiet_NaN();
+    mapSnapshot.varianceZ.resize(2, 2);
+    mapSnapshot.varianceZ << 0.25f, 1.f,
+                             0.25f, 1.f;
+
+    Cloud cloud;
+    cloud.push_back(pcl::PointXYZ(0.5f, 0.5f, 0.5f));
+    cloud.push_back(pcl::PointXYZ(-0.5f, 0.5f, 1.f));
+    cloud.push_back(pcl::PointXYZ(0.5f, -0.5f, 1.f));
+    cloud.push_back(pcl::PointXYZ(-0.5f, -0.5f, 0.f));
+    cloud.push_back(pcl::PointXYZ(5.f, 5.f, 0.f));
+
+    const double expectedLogLikelihood = (
+            -0.5 * (0.25 / 0.25 + std::log(0.25)) +
+            -0.5 * std::log(0.25) +
+            -0.5 * (1. / 1. + std::log(1.)) +
+            2. * -4.5) / 5.;
+
+    ASSERT_NEAR(CloudProcessing::calculateElevationLogLikelihood(cloud,
+            Pose::Identity(), mapSnapshot), expectedLogLikelihood, 1e-6);
+
+    Cloud outsideCloud;
+    outsideCloud.push_back(pcl::PointXYZ(-0.5f, -0.5f, 0.f));
+    outsideCloud.push_back(pcl::PointXYZ(5.f, 5.f, 0.f));
+
+    ASSERT_NEAR(CloudProcessing::calculateElevationLogLikelihood(outsideCloud,
+            Pose::Identity(), mapSnapshot, -10.), -10., 1e-9);
+
+    ASSERT_EQ(CloudProcessing::calculateElevationLogLikelihood(Cloud(),
+            Pose::Identity(), mapSnapshot),
+            std::numeric_limits<double>::lowest());
+}
+
+TEST(CloudProcessingTest, ElevationLogLikelihoodAlignment) {
+    MapSnapshot mapSnapshot;
+    mapSnapshot.parameters.length = 10.;
+    mapSnapshot.parameters.size = 10;
+    mapSnapshot.parameters.resolution = 1.;
+    mapSnapshot.parameters.positionX = 0.;
+    mapSnapshot.parameters.positionY = 0.;
+    mapSnapshot.valid = true;
+    mapSnapshot.meanZ.resize(10, 10);
+    mapSnapshot.varianceZ.setConstant(10, 10, 0.01f);
+
+    Cloud cloud;
+    for (float x = -4.5f; x < 5.f; x += 1.f) {
+        for (float y = -4.5f; y < 5.f; y += 1.f) {
+            const float z = 0.3f * x + 0.1f * y * y;
+            size_t index;
+
+            ASSERT_TRUE(mapSnapshot.getIndexFromPosition(x, y, index));
+            mapSnapshot.meanZ(index) = z;
+            cloud.push_back(pcl::PointXYZ(x, y, z));
+        }
+    }
+
+    Pose shiftedPose = Pose::Identity();
+    shiftedPose.translation().x() = 1.;
+
+    const double alignedLogLikelihood =
+            CloudProcessing::calculateElevationLogLikelihood(cloud,
+            Pose::Identity(), mapSnapshot);
+    const double shiftedLogLikelihood =
+            CloudProcessing::calculateElevationLogLikelihood(cloud,
+            shiftedPose, mapSnapshot);
+
+    ASSERT_NEAR(alignedLogLikelihood, -0.5 * std::log(0.01), 1e-4);
+    ASSERT_GT(alignedLogLikelihood, shiftedLogLikelihood);
+
+    // Once the elevation only varies along y, a pose moving most of the cloud
+    // off the map leaves points that fit as well, but loses the overlap
+    for (auto& point : cloud.points) {
+        size_t index;
+        point.z = 0.1f * point.y * point.y;
+        ASSERT_TRUE(mapSnapshot.getIndexFromPosition(point.x, point.y, index));
+        mapSnapshot.meanZ(index) = point.z;
+    }
+
+    Pose offMapPose = Pose::Identity();
+    offMapPose.translation().x() = 7.;
+
+    ASSERT_GT(CloudProcessing::calculateElevationLogLikelihood(cloud,
+            Pose::Identity(), mapSnapshot),
+            CloudProcessing::calculateElevationLogLikelihood(cloud,
+            offMapPose, mapSnapshot));
+}
+
+} // namespace ga_slam
@@ -0,0 +1,113 @@
+/*
+ * This file is part of GA SLAM.
+ * Copyright (C) 2018 Dimitris Geromichalos,
+ * Planetary Robotics Lab (PRL), European Space Agency (ESA)
+ *
+ * GA SLAM is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GA SLAM is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GA SLAM. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// GA SLAM
+#include "ga_slam/TypeDefs.h"
+#include "ga_slam/processing/CloudQueue.h"
+
+// PCL
+#include <pcl/point_types.h>
+#include <pcl/point_cloud.h>
+
+// STL
+#include <string>
+#include <thread>
+
+// GMock
+#include "gmock/gmock.h"
+
+namespace ga_slam {
+
+class CloudQueueTest : public ::testing::Test {
+  protected:
+    bool pushCloud(const std::string& frameId, uint64_t stamp) {
+        Cloud::Ptr cloud(new Cloud);
+        cloud->header.frame_id = frameId;
+        cloud->header.stamp = stamp;
+
+        return cloudQueue_.push(cloud, Pose::Identity(), Pose::Identity());
+    }
+
+  protected:
+    CloudQueue cloudQueue_;
+    QueuedClouds queuedClouds_;
+};
+
+TEST_F(CloudQueueTest, DropOldest) {
+    cloudQueue_.configure(2, CloudQueuePolicy::DropOldest);
+
+    ASSERT_TRUE(pushCloud("stereo", 1));
+    ASSERT_TRUE(pushCloud("tof", 2));
+    ASSERT_TRUE(pushCloud("stereo", 3));
+
+    ASSERT_EQ(cloudQueue_.getDepth(), 2);
+    ASSERT_EQ(cloudQueue_.getNumDropped(), 1);
+
+    ASSERT_TRUE(cloudQueue_.pop(queuedClouds_));
+    ASSERT_EQ(queuedClouds_.size(), 1);
+    ASSERT_EQ(queuedClouds_[0].cloud->header.stamp, 2);
+
+    ASSERT_TRUE(cloudQueue_.pop(queuedClouds_));
+    ASSERT_EQ(queuedClouds_[0].cloud->header.stamp, 3);
+    ASSERT_EQ(cloudQueue_.getDepth(), 0);
+}
+
+TEST_F(CloudQueueTest, Merge) {
+    cloudQueue_.configure(2, CloudQueuePolicy::Merge);
+
+    pushCloud("stereo", 1);
+    pushCloud("tof", 2);
+    pushCloud("stereo", 3);
+    pushCloud("tof", 4);
+    pushCloud("camera", 5);
+
+    ASSERT_EQ(cloudQueue_.getNumMerged(), 2);
+    ASSERT_EQ(cloudQueue_.getNumDropped(), 2);
+
+    ASSERT_TRUE(cloudQueue_.pop(queuedClouds_));
+    ASSERT_EQ(queuedClouds_.size(), 2);
+    ASSERT_EQ(queuedClouds_[0].cloud->header.stamp, 2);
+    ASSERT_EQ(queuedClouds_[1].cloud->header.stamp, 4);
+
+    ASSERT_TRUE(cloudQueue_.pop(queuedClouds_));
+    ASSERT_EQ(queuedClouds_.size(), 1);
+    ASSERT_EQ(queuedClouds_[0].cloud->header.frame_id, "camera");
+}
+
+TEST_F(CloudQueueTest, BlockAndClose) {
+    cloudQueue_.configure(1, CloudQueuePolicy::Block);
+
+    pushCloud("stereo", 1);
+    std::thread producer([this] { pushCloud("stereo", 2); });
+
+    ASSERT_TRUE(cloudQueue_.pop(queuedClouds_));
+    ASSERT_EQ(queuedClouds_[0].cloud->header.stamp, 1);
+    ASSERT_TRUE(cloudQueue_.pop(queuedClouds_));
+    ASSERT_EQ(queuedClouds_[0].cloud->header.stamp, 2);
+    producer.join();
+
+    ASSERT_EQ(cloudQueue_.getNumDropped(), 0);
+
+    cloudQueue_.close();
+    ASSERT_FALSE(cloudQueue_.pop(queuedClouds_));
+    ASSERT_FALSE(pushCloud("stereo", 3));
+}
+
+} // namespace ga_slam
+
@@ -0,0 +1,76 @@
+/*
+ * This file is part of GA SLAM.
+ * Copyright (C) 2018 Dimitris Geromichalos,
+ * Planetary Robotics Lab (PRL), European Space Agency (ESA)
+ *
+ * GA SLAM is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GA SLAM is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GA SLAM. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// GA SLAM
+#include "ga_slam/TypeDefs.h"
+#include "ga_slam/mapping/Map.h"
+#include "ga_slam/mapping/DataRegistration.h"
+
+// PCL
+#include <pcl/point_types.h>
+#include <pcl/point_cloud.h>
+
+// STL
+#include <vector>
+#include <cmath>
+
+// GMock
+#include "gmock/gmock.h"
+
+namespace ga_slam {
+
+TEST(DataRegistrationTest, BatchedGaussianFusion) {
+    DataRegistration dataRegistration;
+    dataRegistration.configure(10., 1., -1., 1.);
+
+    Cloud::Ptr cloud(new Cloud);
+    cloud->push_back(pcl::PointXYZ(0.2f, 0.2f, 1.f));
+    cloud->push_back(pcl::PointXYZ(2.5f, 2.5f, 3.f));
+    cloud->push_back(pcl::PointXYZ(0.4f, 0.7f, 2.f));
+    cloud->push_back(pcl::PointXYZ(20.f, 0.f, 5.f));
+    cloud->push_back(pcl::PointXYZ(0.9f, 0.1f, 4.f));
+    std::vector<float> cloudVariances = {1.f, 1.f, 1.f, 1.f, 2.f};
+
+    dataRegistration.updateMap(cloud, cloudVariances);
+
+    const auto& map = dataRegistration.getMap();
+    size_t index;
+    ASSERT_TRUE(map.getIndexFromPosition(0.5, 0.5, index));
+    ASSERT_FLOAT_EQ(map.getMeanZ()(index), 2.f);
+    ASSERT_FLOAT_EQ(map.getVarianceZ()(index), 0.4f);
+
+    ASSERT_TRUE(map.getIndexFromPosition(2.5, 2.5, index));
+    ASSERT_FLOAT_EQ(map.getMeanZ()(index), 3.f);
+    ASSERT_FLOAT_EQ(map.getVarianceZ()(index), 1.f);
+
+    ASSERT_TRUE(map.getIndexFromPosition(-2.5, 2.5, index));
+    ASSERT_FALSE(std::isfinite(map.getMeanZ()(index)));
+
+    cloud->clear();
+    cloud->push_back(pcl::PointXYZ(0.5f, 0.5f, 2.f));
+    cloudVariances = {0.4f};
+
+    dataRegistration.updateMap(cloud, cloudVariances);
+
+    ASSERT_TRUE(map.getIndexFromPosition(0.5, 0.5, index));
+    ASSERT_FLOAT_EQ(map.getMeanZ()(index), 2.f);
+    ASSERT_FLOAT_EQ(map.getVarianceZ()(index), 0.2f);
+}
+
+} // namespace ga_slam
@@ -0,0 +1,295 @@
+/*
+ * This file is part of GA SLAM.
+ * Copyright (C) 2018 Dimitris Geromichalos,
+ * Planetary Robotics Lab (PRL), European Space Agency (ESA)
+ *
+ * GA SLAM is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GA SLAM is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GA SLAM. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// GA SLAM
+#include "ga_slam/TypeDefs.h"
+#include "ga_slam/processing/ImageProcessing.h"
+
+// OpenCV
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+
+// STL
+#include <cmath>
+
+// GMock
+#include "gmock/gmock.h"
+
+namespace ga_slam {
+
+class ImageProcessingTest : public ::testing::Test {
+  protected:
+    ImageProcessingTest(void) {
+        sourceImage_ = Image::zeros(200, 200, CV_32F);
+
+        for (int row = 0; row < sourceImage_.rows; ++row) {
+            for (int col = 0; col < sourceImage_.cols; ++col) {
+                sourceImage_.at<float>(row, col) =
+                        std::sin(0.11 * col) * std::cos(0.07 * row) +
+                        0.5 * std::sin(0.05 * (row + 2 * col)) +
+                        0.3 * std::cos(0.19 * row - 0.13 * col);
+            }
+        }
+
+        templateImage_ = sourceImage_(cv::Rect(templateX_, templateY_, 60,
+                60)).clone();
+    }
+
+  protected:
+    Image sourceImage_;
+    Image templateImage_;
+
+    const int templateX_ = 63;
+    const int templateY_ = 87;
+};
+
+TEST_F(ImageProcessingTest, PyramidMatchingFindsTemplate) {
+    cv::Point3d matchedPosition;
+
+    ASSERT_TRUE(ImageProcessing::findBestMatchPyramid(sourceImage_,
+            templateImage_, matchedPosition, 0.9, 2, 3));
+
+    ASSERT_NEAR(matchedPosition.x, templateX_, 0.5);
+    ASSERT_NEAR(matchedPosition.y, templateY_, 0.5);
+    ASSERT_EQ(matchedPosition.z, 0.);
+}
+
+TEST_F(ImageProcessingTest, PyramidMatchingAgreesWithExhaustiveMatching) {
+    cv::Point3d pyramidPosition, exhaustivePosition;
+
+    ASSERT_TRUE(ImageProcessing::findBestMatchPyramid(sourceImage_,
+            templateImage_, pyramidPosition, 0.9, 2, 3, true, 0.2, 0.05));
+    ASSERT_TRUE(ImageProcessing::findBestMatch(sourceImage_,
+            templateImage_, exhaustivePosition, 0.9, true, 0.2, 0.05, true,
+            false));
+
+    ASSERT_NEAR(pyramidPosition.x, exhaustivePosition.x, 0.5);
+    ASSERT_NEAR(pyramidPosition.y, exhaustivePosition.y, 0.5);
+}
+
+TEST_F(ImageProcessingTest, WindowedMatchingUsesPreparedSource) {
+    MatchingImage matchingImage;
+    ImageProcessing::prepareMatchingImage(sourceImage_, matchingImage, true);
+
+    cv::Point3d matchedPosition;
+    ASSERT_TRUE(ImageProcessing::findBestMatchInWindow(matchingImage,
+            templateImage_, cv::Rect(55, 80, 15, 15), matchedPosition, 0.9));
+    ASSERT_NEAR(matchedPosition.x, templateX_, 0.5);
+    ASSERT_NEAR(matchedPosition.y, templateY_, 0.5);
+
+    ASSERT_FALSE(ImageProcessing::findBestMatchInWindow(matchingImage,
+            templateImage_, cv::Rect(300, 300, 15, 15), matchedPosition, 0.9));
+
+    Image preparedTemplate, windowResult, expectedResult;
+    ImageProcessing::calculateGradientImage(templateImage_, preparedTemplate);
+
+    const cv::Rect window(20, 30, 40, 25);
+    ImageProcessing::matchTemplateInWindow(matchingImage, window,
+            preparedTemplate, windowResult);
+
+    const cv::Rect region(window.x, window.y,
+            window.width + preparedTemplate.cols - 1,
+            window.height + preparedTemplate.rows - 1);
+    cv::matchTemplate(matchingImage.image(region), preparedTemplate,
+            expectedResult, CV_TM_CCORR_NORMED);
+
+    ASSERT_EQ(windowResult.size(), expectedResult.size());
+    ASSERT_LT(cv::norm(windowResult, expectedResult, cv::NORM_INF), 1e-4);
+}
+
+TEST_F(ImageProcessingTest, ValidMask) {
+    Image elevationImage = sourceImage_.clone(), mask;
+    elevationImage.at<float>(5, 7) = NAN;
+    ImageProcessing::calculateValidMask(elevationImage, mask);
+
+    ASSERT_EQ(mask.at<uchar>(5, 7), 0);
+    ASSERT_EQ(cv::countNonZero(mask), mask.rows * mask.cols - 1);
+}
+
+TEST_F(ImageProcessingTest, FourierMellinAgreesWithBruteForceYaw) {
+    const double angle = 0.12;
+    const cv::Point2f templateCenter(templateX_ + 30.f, templateY_ + 30.f);
+
+    Image textureImage(sourceImage_.size(), CV_32F);
+    cv::RNG rng(42);
+    rng.fill(textureImage, cv::RNG::NORMAL, 0., 1.);
+    cv::GaussianBlur(textureImage, textureImage, cv::Size(0, 0), 2.);
+
+    Image rotationMatrix = cv::getRotationMatrix2D(templateCenter,
+            angle * 180. / M_PI, 1.);
+    Image rotatedImage;
+    cv::warpAffine(textureImage, rotatedImage, rotationMatrix,
+            textureImage.size());
+    const Image rotatedTemplate = rotatedImage(cv::Rect(templateX_,
+            templateY_, 60, 60)).clone();
+
+    cv::Point3d spectralPosition, bruteForcePosition;
+    ASSERT_TRUE(ImageProcessing::findBestMatchFourierMellin(textureImage,
+            rotatedTemplate, spectralPosition, 0.5, 0.4));
+    ASSERT_TRUE(ImageProcessing::findBestMatch(textureImage,
+            rotatedTemplate, bruteForcePosition, 0.5, true, 0.4, 0.01, true,
+            false));
+
+    ASSERT_NEAR(spectralPosition.z, bruteForcePosition.z, 0.02);
+    ASSERT_NEAR(spectralPosition.z, - angle, 0.02);
+    ASSERT_NEAR(spectralPosition.x, bruteForcePosition.x, 1.);
+    ASSERT_NEAR(spectralPosition.y, bruteForcePosition.y, 1.);
+    ASSERT_NEAR(spectralPosition.x, templateX_, 1.);
+    ASSERT_NEAR(spectralPosition.y, templateY_, 1.);
+}
+
+TEST_F(ImageProcessingTest, MaskedMatchingIgnoresUnknownCells) {
+    Image sparseSource = sourceImage_.clone();
+    sparseSource(cv::Rect(0, 0, 200, 40)).setTo(NAN);
+
+    Image sparseTemplate = templateImage_.clone();
+    sparseTemplate(cv::Rect(0, 0, 60, 25)).setTo(NAN);
+    sparseTemplate(cv::Rect(40, 25, 20, 35)).setTo(NAN);
+
+    Image resultMatrix, overlapMatrix;
+    ImageProcessing::matchTemplateMasked(sparseSource, sparseTemplate,
+            resultMatrix, overlapMatrix, 10);
+
+    ASSERT_EQ(resultMatrix.cols, sourceImage_.cols - 60 + 1);
+    ASSERT_EQ(resultMatrix.rows, sourceImage_.rows - 60 + 1);
+
+    for (const auto& position : {cv::Point2i(templateX_, templateY_),
+            cv::Point2i(3, 5), cv::Point2i(120, 17), cv::Point2i(140, 140)}) {
+        double crossCorrelation = 0., sourceEnergy = 0., templateEnergy = 0.;
+        int overlap = 0;
+
+        for (int row = 0; row < 60; ++row) {
+            for (int col = 0; col < 60; ++col) {
+                const float sourceValue = sparseSource.at<float>(
+                        position.y + row, position.x + col);
+                const float templateValue = sparseTemplate.at<float>(row, col);
+                if (std::isnan(sourceValue) || std::isnan(templateValue))
+                    continue;
+
+                crossCorrelation += sourceValue * templateValue;
+                sourceEnergy += sourceValue * sourceValue;
+                templateEnergy += templateValue * templateValue;
+                overlap++;
+            }
+        }
+
+        const double expectedScore = overlap < 10 ? 0. :
+                crossCorrelation / std::sqrt(sourceEnergy * templateEnergy);
+
+        ASSERT_NEAR(overlapMatrix.at<float>(position), overlap, 1e-2);
+        ASSERT_NEAR(resultMatrix.at<float>(position), expectedScore, 1e-3);
+    }
+
+    cv::Point3d matchedPosition;
+    double matchScore;
+    int matchOverlap;
+    ASSERT_TRUE(ImageProcessing::findBestMatchMasked(sparseSource,
+            sparseTemplate, matchedPosition, matchScore, matchOverlap, 0.9,
+            100));
+
+    ASSERT_EQ(matchedPosition.x, templateX_);
+    ASSERT_EQ(matchedPosition.y, templateY_);
+    ASSERT_GT(matchScore, 0.99);
+    ASSERT_GT(matchOverlap, 100);
+}
+
+TEST_F(ImageProcessingTest, PreparedMaskedMatching) {
+    Image sparseSource = sourceImage_.clone();
+    sparseSource(cv::Rect(0, 0, 200, 40)).setTo(NAN);
+
+    Image sparseTemplate = templateImage_.clone();
+    sparseTemplate(cv::Rect(0, 0, 60, 25)).setTo(NAN);
+
+    MaskedMatchingImage preparedSource;
+    ImageProcessing::prepareMaskedMatchingImage(sparseSource, preparedSource);
+
+    ASSERT_EQ(preparedSource.mask.at<float>(10, 10), 0.f);
+    ASSERT_EQ(preparedSource.mask.at<float>(50, 10), 1.f);
+    ASSERT_EQ(preparedSource.values.at<float>(10, 10), 0.f);
+    ASSERT_EQ(preparedSource.squaredValues.at<float>(50, 10),
+            sparseSource.at<float>(50, 10) * sparseSource.at<float>(50, 10));
+
+    Image resultMatrix, overlapMatrix;
+    Image preparedResultMatrix, preparedOverlapMatrix;
+    ImageProcessing::matchTemplateMasked(sparseSource, sparseTemplate,
+            resultMatrix, overlapMatrix, 10);
+    ImageProcessing::matchTemplateMasked(preparedSource, sparseTemplate,
+            preparedResultMatrix, preparedOverlapMatrix, 10);
+
+    ASSERT_EQ(cv::norm(resultMatrix, preparedResultMatrix, cv::NORM_INF), 0.);
+    ASSERT_EQ(cv::norm(overlapMatrix, preparedOverlapMatrix, cv::NORM_INF),
+            0.);
+
+    cv::Point3d matchedPosition, preparedPosition;
+    double matchScore, preparedScore;
+    int matchOverlap, preparedOverlap;
+
+    ASSERT_TRUE(ImageProcessing::findBestMatchMasked(sparseSource,
+            sparseTemplate, matchedPosition, matchScore, matchOverlap, 0.9,
+            100, true, 0.2, 0.05, false));
+    ASSERT_TRUE(ImageProcessing::findBestMatchMasked(preparedSource,
+            sparseTemplate, preparedPosition, preparedScore, preparedOverlap,
+            0.9, 100, true, 0.2, 0.05));
+
+    ASSERT_EQ(preparedPosition, matchedPosition);
+    ASSERT_EQ(preparedScore, matchScore);
+    ASSERT_EQ(preparedOverlap, matchOverlap);
+    ASSERT_EQ(preparedPosition.x, templateX_);
+    ASSERT_EQ(preparedPosition.y, templateY_);
+}
+
+TEST_F(ImageProcessingTest, RefineMatchToSubPixel) {
+    const double offsetX = -0.3;
+    const double offsetY = 0.2;
+
+    Image shiftedTemplate(60, 60, CV_32F);
+    for (int row = 0; row < shiftedTemplate.rows; ++row) {
+        for (int col = 0; col < shiftedTemplate.cols; ++col) {
+            const double x = templateX_ + offsetX + col;
+            const double y = templateY_ + offsetY + row;
+
+            shiftedTemplate.at<float>(row, col) =
+                    std::sin(0.11 * x) * std::cos(0.07 * y) +
+                    0.5 * std::sin(0.05 * (y + 2 * x)) +
+                    0.3 * std::cos(0.19 * y - 0.13 * x);
+        }
+    }
+
+    cv::Point3d matchedPosition(templateX_, templateY_, 0.);
+    cv::Matx33d covariance;
+    ASSERT_TRUE(ImageProcessing::refineMatch(sourceImage_, shiftedTemplate,
+            matchedPosition, covariance, true, 0.05));
+
+    ASSERT_NEAR(matchedPosition.x, templateX_ + offsetX, 0.05);
+    ASSERT_NEAR(matchedPosition.y, templateY_ + offsetY, 0.05);
+    ASSERT_NEAR(matchedPosition.z, 0., 0.025);
+
+    ASSERT_GT(covariance(0, 0), 0.);
+    ASSERT_GT(covariance(1, 1), 0.);
+    ASSERT_GT(covariance(2, 2), 0.);
+    ASSERT_GT(cv::determinant(cv::Matx22d(covariance(0, 0), covariance(0, 1),
+            covariance(1, 0), covariance(1, 1))), 0.);
+
+    cv::Point3d borderPosition(0., 0., 0.);
+    ASSERT_FALSE(ImageProcessing::refineMatch(sourceImage_, shiftedTemplate,
+            borderPosition, covariance));
+}
+
+} // namespace ga_slam
+
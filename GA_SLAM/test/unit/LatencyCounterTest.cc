@@ -0,0 +1,56 @@
+/*
+ * This file is part of GA SLAM.
+ * Copyright (C) 2018 Dimitris Geromichalos,
+ * Planetary Robotics Lab (PRL), European Space Agency (ESA)
+ *
+ * GA SLAM is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GA SLAM is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GA SLAM. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// GA SLAM
+#include "ga_slam/processing/LatencyCounter.h"
+
+// STL
+#include <chrono>
+#include <thread>
+#include <vector>
+
+// GMock
+#include "gmock/gmock.h"
+
+namespace ga_slam {
+
+TEST(LatencyCounterTest, MeanAndMaxLatency) {
+    LatencyCounter latencyCounter;
+    ASSERT_EQ(latencyCounter.getMeanLatency(), 0.);
+
+    std::vector<std::thread> threads;
+    for (int i = 1; i <= 4; ++i) {
+        threads.emplace_back([&latencyCounter, i] {
+            for (int j = 0; j < 1000; ++j)
+                latencyCounter.add(std::chrono::milliseconds(i));
+        });
+    }
+    for (auto& thread : threads) thread.join();
+
+    ASSERT_EQ(latencyCounter.getCount(), 4000u);
+    ASSERT_NEAR(latencyCounter.getMeanLatency(), 0.0025, 1e-9);
+    ASSERT_NEAR(latencyCounter.getMaxLatency(), 0.004, 1e-9);
+
+    latencyCounter.reset();
+    ASSERT_EQ(latencyCounter.getCount(), 0u);
+    ASSERT_EQ(latencyCounter.getMaxLatency(), 0.);
+}
+
+} // namespace ga_slam
+
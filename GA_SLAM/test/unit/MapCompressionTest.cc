@@ -0,0 +1,181 @@
+/*
+ * This file is part of GA SLAM.
+ * Copyright (C) 2018 Dimitris Geromichalos,
+ * Planetary Robotics Lab (PRL), European Space Agency (ESA)
+ *
+ * GA SLAM is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GA SLAM is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GA SLAM. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// GA SLAM
+#include "ga_slam/TypeDefs.h"
+#include "ga_slam/mapping/Map.h"
+#include "ga_slam/processing/MapCompression.h"
+
+// STL
+#include <vector>
+#include <limits>
+#include <cstdint>
+#include <cmath>
+
+// GMock
+#include "gmock/gmock.h"
+
+namespace ga_slam {
+
+class MapCompressionTest : public ::testing::Test {
+  protected:
+    MapCompressionTest(void) {
+        snapshot_.parameters.length = 10.;
+        snapshot_.parameters.resolution = 0.1;
+        snapshot_.parameters.size = 100;
+        snapshot_.startIndexX = 12;
+        snapshot_.startIndexY = 34;
+        snapshot_.valid = true;
+        snapshot_.timestamp = 42;
+        snapshot_.version = 7;
+
+        snapshot_.meanZ.resize(100, 100);
+        snapshot_.varianceZ.resize(100, 100);
+
+        for (int i = 0; i < 100; ++i) {
+            for (int j = 0; j < 100; ++j) {
+                const bool known = (i + 3 * j) % 7 != 0;
+
+                snapshot_.meanZ(i, j) = known ? -20. + 0.37 * i - 0.11 * j :
+                        std::numeric_limits<float>::quiet_NaN();
+                snapshot_.varianceZ(i, j) = known ? 1e-4 * (1 + i * j) :
+                        std::numeric_limits<float>::quiet_NaN();
+            }
+        }
+    }
+
+  protected:
+    MapSnapshot snapshot_;
+};
+
+TEST_F(MapCompressionTest, ElevationRoundTrip) {
+    const float* values = snapshot_.meanZ.data();
+    const size_t numValues = snapshot_.meanZ.size();
+    float elevationOffset, elevationStep;
+
+    MapCompression::calculateElevationQuantization(values, numValues, 0.001,
+            elevationOffset, elevationStep);
+
+    ASSERT_FLOAT_EQ(elevationStep, 0.001);
+
+    std::vector<int16_t> packedValues(numValues);
+    std::vector<uint64_t> knownMask((numValues + 63) / 64);
+    std::vector<float> unpackedValues(numValues);
+
+    MapCompression::packElevation(values, numValues, elevationOffset,
+            elevationStep, packedValues.data(), knownMask.data());
+    MapCompression::unpackElevation(packedValues.data(), knownMask.data(),
+            numValues, elevationOffset, elevationStep, unpackedValues.data());
+
+    for (size_t i = 0; i < numValues; ++i) {
+        if (std::isnan(values[i]))
+            ASSERT_TRUE(std::isnan(unpackedValues[i]));
+        else
+            ASSERT_NEAR(unpackedValues[i], values[i], elevationStep * 0.51);
+    }
+}
+
+TEST_F(MapCompressionTest, ElevationStepCoversRange) {
+    const float values[] = {-1000.f, 2000.f, NAN, 0.5f};
+    float elevationOffset, elevationStep;
+    int16_t packedValues[4];
+    uint64_t knownMask;
+    float unpackedValues[4];
+
+    MapCompression::calculateElevationQuantization(values, 4, 0.001,
+            elevationOffset, elevationStep);
+
+    ASSERT_GT(elevationStep, 0.001);
+
+    MapCompression::packElevation(values, 4, elevationOffset, elevationStep,
+            packedValues, &knownMask);
+    MapCompression::unpackElevation(packedValues, &knownMask, 4,
+            elevationOffset, elevationStep, unpackedValues);
+
+    ASSERT_EQ(knownMask, 0xBu);
+    ASSERT_NEAR(unpackedValues[0], values[0], elevationStep);
+    ASSERT_NEAR(unpackedValues[1], values[1], elevationStep);
+    ASSERT_TRUE(std::isnan(unpackedValues[2]));
+    ASSERT_NEAR(unpackedValues[3], values[3], elevationStep);
+}
+
+TEST_F(MapCompressionTest, SnapshotRoundTrip) {
+    CompactMapSnapshot compactSnapshot;
+    MapSnapshot unpackedSnapshot;
+
+    MapCompression::packSnapshot(snapshot_, compactSnapshot);
+    MapCompression::unpackSnapshot(compactSnapshot, unpackedSnapshot);
+
+    ASSERT_EQ(unpackedSnapshot.parameters.size, 100);
+    ASSERT_EQ(unpackedSnapshot.startIndexX, 12);
+    ASSERT_EQ(unpackedSnapshot.startIndexY, 34);
+    ASSERT_TRUE(unpackedSnapshot.valid);
+    ASSERT_EQ(unpackedSnapshot.timestamp, 42);
+    ASSERT_EQ(unpackedSnapshot.version, 7u);
+
+    for (int i = 0; i < snapshot_.meanZ.size(); ++i) {
+        const float mean = snapshot_.meanZ(i);
+        const float variance = snapshot_.varianceZ(i);
+
+        if (std::isnan(mean)) {
+            ASSERT_TRUE(std::isnan(unpackedSnapshot.meanZ(i)));
+            ASSERT_TRUE(std::isnan(unpackedSnapshot.varianceZ(i)));
+        } else {
+            ASSERT_NEAR(unpackedSnapshot.meanZ(i), mean, 0.001);
+            ASSERT_NEAR(unpackedSnapshot.varianceZ(i), variance,
+                    variance * 0.05);
+        }
+    }
+}
+
+TEST_F(MapCompressionTest, ConstantMapRoundTrip) {
+    snapshot_.meanZ.setConstant(3.25f);
+    snapshot_.meanZ(5, 7) = std::numeric_limits<float>::quiet_NaN();
+
+    CompactMapSnapshot compactSnapshot;
+    MapSnapshot unpackedSnapshot;
+
+    MapCompression::packSnapshot(snapshot_, compactSnapshot, 0.);
+    MapCompression::unpackSnapshot(compactSnapshot, unpackedSnapshot);
+
+    ASSERT_GT(compactSnapshot.elevationStep, 0.f);
+    ASSERT_TRUE(std::isfinite(compactSnapshot.elevationStep));
+
+    for (int i = 0; i < snapshot_.meanZ.size(); ++i) {
+        if (std::isnan(snapshot_.meanZ(i))) {
+            ASSERT_TRUE(std::isnan(unpackedSnapshot.meanZ(i)));
+        } else {
+            ASSERT_EQ(compactSnapshot.meanZ[i], 0);
+            ASSERT_FLOAT_EQ(unpackedSnapshot.meanZ(i), 3.25f);
+        }
+    }
+
+    const float values[] = {1.5f, NAN, -2.f};
+    int16_t packedValues[3];
+    uint64_t knownMask;
+
+    MapCompression::packElevation(values, 3, 1.5f, 0.f, packedValues,
+            &knownMask);
+
+    ASSERT_EQ(knownMask, 0x5u);
+    ASSERT_EQ(packedValues[0], 0);
+    ASSERT_EQ(packedValues[2], 0);
+}
+
+}  // namespace ga_slam
@@ -0,0 +1,424 @@
+/*
+ * This file is part of GA SLAM.
+ * Copyright (C) 2018 Dimitris Geromichalos,
+ * Planetary Robotics Lab (PRL), European Space Agency (ESA)
+ *
+ * GA SLAM is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GA SLAM is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GA SLAM. If not, see <http://www.gnu.org/licenses/>.
+ */
+// GA SLAM
+#include "ga_slam/TypeDefs.h"
+#include "ga_slam/mapping/Map.h"
+#include "ga_slam/mapping/DataRegistration.h"
+#include "ga_slam/processing/ImageProcessing.h"
+
+// Eigen
+#include <Eigen/Core>
+
+// PCL
+#include <pcl/point_types.h>
+#include <pcl/point_cloud.h>
+
+// STL
+#include <vector>
+#include <cmath>
+
+// GMock
+#include "gmock/gmock.h"
+
+namespace ga_slam {
+
+TEST(MapTest, SnapshotIndexFromPosition) {
+    Map map;
+    map.setParameters(10., 0.5, -1., 1.);
+
+    const std::vector<Eigen::Vector3d> translations = {
+            Eigen::Vector3d(0., 0., 0.),
+            Eigen::Vector3d(1.3, -2.1, 0.),
+            Eigen::Vector3d(-4.7, 3.2, 0.)};
+
+    for (const auto& translation : translations) {
+        map.translate(translation, false);
+
+        MapSnapshot snapshot;
+        map.getSnapshot(snapshot);
+
+        for (double x = -12.; x <= 12.; x += 0.37) {
+            for (double y = -12.; y <= 12.; y += 0.41) {
+                size_t mapIndex, snapshotIndex;
+                const bool mapFound = map.getIndexFromPosition(x, y, mapIndex);
+                const bool snapshotFound = snapshot.getIndexFromPosition(x, y,
+                        snapshotIndex);
+
+                ASSERT_EQ(mapFound, snapshotFound);
+                if (mapFound) {
+                    ASSERT_EQ(mapIndex, snapshotIndex);
+                }
+            }
+        }
+    }
+}
+
+TEST(MapTest, IndicesFromPositions) {
+    Map map;
+    map.setParameters(10., 0.5, -1., 1.);
+    map.translate(Eigen::Vector3d(1.3, -2.1, 0.), false);
+    map.translate(Eigen::Vector3d(-0.6, 3.4, 0.), false);
+
+    std::vector<Eigen::Vector2f> positionList;
+    for (float x = -12.f; x <= 12.f; x += 0.37f)
+        for (float y = -12.f; y <= 12.f; y += 0.41f)
+            positionList.emplace_back(x, y);
+
+    Eigen::MatrixXf positions(3, positionList.size());
+    for (size_t i = 0; i < positionList.size(); ++i)
+        positions.col(i) << positionList[i], 0.f;
+
+    Eigen::ArrayXi indices;
+    map.getIndicesFromPositions(positions, indices);
+    ASSERT_EQ(indices.size(), positions.cols());
+
+    for (size_t i = 0; i < positionList.size(); ++i) {
+        size_t mapIndex;
+        const bool mapFound = map.getIndexFromPosition(positionList[i].x(),
+                positionList[i].y(), mapIndex);
+
+        if (mapFound) {
+            ASSERT_EQ(indices(i), static_cast<int>(mapIndex));
+        } else {
+            ASSERT_EQ(indices(i), -1);
+        }
+    }
+}
+
+TEST(MapTest, IncrementalSlopeSum) {
+    const double minSlopeThreshold = 0.5;
+
+    DataRegistration dataRegistration;
+    dataRegistration.configure(20., 1., -100., 100., minSlopeThreshold);
+    ASSERT_EQ(dataRegistration.getSlopeSum(), 0.);
+
+    const std::vector<Eigen::Vector3d> translations = {
+            Eigen::Vector3d(0., 0., 0.),
+            Eigen::Vector3d(2.3, -1.2, 0.),
+            Eigen::Vector3d(2.6, 4.1, 0.),
+            Eigen::Vector3d(-7.8, 5.5, 0.),
+            Eigen::Vector3d(-40., 5.5, 0.)};
+
+    for (const auto& translation : translations) {
+        Pose pose = Pose::Identity();
+        pose.translation() = translation;
+        dataRegistration.translateMap(pose);
+
+        Cloud::Ptr cloud(new Cloud);
+        for (double x = -6.; x < 6.; x += 0.7)
+            for (double y = -4.; y < 8.; y += 0.9)
+                cloud->push_back(pcl::PointXYZ(translation.x() + x,
+                        translation.y() + y, std::sin(x) * std::cos(y) * x));
+        std::vector<float> cloudVariances(cloud->size(), 1.f);
+        dataRegistration.updateMap(cloud, cloudVariances);
+
+        Image image;
+        ImageProcessing::convertMapToImage(dataRegistration.getMap(), image);
+
+        double expectedSlopeSum = 0.;
+        for (int row = 1; row < image.rows - 1; ++row) {
+            for (int col = 1; col < image.cols - 1; ++col) {
+                const auto z = [&](int i, int j) {
+                    return image.at<float>(row + i, col + j); };
+
+                const float gradientX = z(-1, 1) + 2.f * z(0, 1) + z(1, 1) -
+                        z(-1, -1) - 2.f * z(0, -1) - z(1, -1);
+                const float gradientY = z(1, -1) + 2.f * z(1, 0) + z(1, 1) -
+                        z(-1, -1) - 2.f * z(-1, 0) - z(-1, 1);
+                const float slope = std::sqrt(gradientX * gradientX +
+                        gradientY * gradientY);
+
+                if (std::isfinite(slope) && std::isfinite(z(0, 0)) &&
+                        slope > minSlopeThreshold)
+                    expectedSlopeSum += slope;
+            }
+        }
+
+        ASSERT_GT(expectedSlopeSum, 0.);
+        ASSERT_NEAR(dataRegistration.getSlopeSum(), expectedSlopeSum,
+                1e-3 * expectedSlopeSum);
+    }
+}
+
+TEST(MapTest, PublishedSnapshots) {
+    DataRegistration dataRegistration;
+    dataRegistration.configure(20., 1., -100., 100., 0., true);
+
+    Pose pose = Pose::Identity();
+    pose.translation() = Eigen::Vector3d(2.3, -1.2, 0.);
+    dataRegistration.translateMap(pose);
+
+    Cloud::Ptr cloud(new Cloud);
+    for (double x = -6.; x < 6.; x += 0.7)
+        for (double y = -4.; y < 8.; y += 0.9)
+            cloud->push_back(pcl::PointXYZ(pose.translation().x() + x,
+                    pose.translation().y() + y, std::sin(x) * std::cos(y)));
+    cloud->header.stamp = 42;
+    std::vector<float> cloudVariances(cloud->size(), 1.f);
+    dataRegistration.updateMap(cloud, cloudVariances);
+
+    const auto snapshot = dataRegistration.getSnapshot();
+    ASSERT_TRUE(snapshot);
+    ASSERT_TRUE(snapshot->valid);
+    ASSERT_EQ(snapshot->timestamp, 42u);
+
+    Image mapImage, snapshotImage;
+    ImageProcessing::convertMapToImage(dataRegistration.getMap(), mapImage);
+    ImageProcessing::convertMapToImage(*snapshot, snapshotImage);
+    ASSERT_EQ(cv::countNonZero(mapImage != snapshotImage),
+            cv::countNonZero(mapImage != mapImage));
+
+    const auto& map = dataRegistration.getMap();
+    for (auto&& it = map.begin(); !it.isPastEnd(); ++it) {
+        const grid_map::Index index(*it);
+        Eigen::Vector3d point;
+        double positionX, positionY;
+
+        map.getPointFromArrayIndex(index, map.getMeanZ(), point);
+        snapshot->getPositionFromIndex(index.x(), index.y(), positionX,
+                positionY);
+
+        ASSERT_NEAR(positionX, point.x(), 1e-9);
+        ASSERT_NEAR(positionY, point.y(), 1e-9);
+    }
+
+    const Matrix meanZ = snapshot->meanZ;
+    pose.translation() = Eigen::Vector3d(5.1, 2.2, 0.);
+    dataRegistration.translateMap(pose);
+    dataRegistration.updateMap(cloud, cloudVariances);
+
+    ASSERT_NE(dataRegistration.getSnapshot(), snapshot);
+    ASSERT_EQ(snapshot->parameters.positionX, 2.);
+    ASSERT_TRUE(snapshot->meanZ.cwiseEqual(meanZ).count() +
+            snapshot->meanZ.array().isNaN().count() == meanZ.size());
+}
+
+TEST(MapTest, PyramidLevelsFuseWorldAlignedCells) {
+    DataRegistration dataRegistration;
+    dataRegistration.configure(24., 1., -100., 100., 0., true, 4);
+
+    const std::vector<Eigen::Vector3d> translations = {
+            Eigen::Vector3d(0., 0., 0.),
+            Eigen::Vector3d(1.2, -3.1, 0.),
+            Eigen::Vector3d(4.4, 2.3, 0.),
+            Eigen::Vector3d(-1.5, 0.6, 0.),
+            Eigen::Vector3d(-7.3, -4.8, 0.)};
+
+    for (const auto& translation : translations) {
+        Pose pose = Pose::Identity();
+        pose.translation() = translation;
+        dataRegistration.translateMap(pose);
+
+        Cloud::Ptr cloud(new Cloud);
+        std::vector<float> cloudVariances;
+        for (double x = -8.; x < 8.; x += 0.7) {
+            for (double y = -6.; y < 9.; y += 0.9) {
+                cloud->push_back(pcl::PointXYZ(translation.x() + x,
+                        translation.y() + y, std::sin(x) * std::cos(y)));
+                cloudVariances.push_back(0.5 + 0.1 * (cloud->size() % 7));
+            }
+        }
+        dataRegistration.updateMap(cloud, cloudVariances);
+
+        const auto snapshot = dataRegistration.getSnapshot();
+        ASSERT_TRUE(snapshot);
+        ASSERT_EQ(snapshot->pyramid.size(), 3u);
+
+        for (const auto& level : snapshot->pyramid) {
+            const int size = level.parameters.size;
+            Eigen::MatrixXd precision = Eigen::MatrixXd::Zero(size, size);
+            Eigen::MatrixXd weightedMean = Eigen::MatrixXd::Zero(size, size);
+
+            ASSERT_EQ(size * level.parameters.resolution,
+                    snapshot->parameters.length);
+
+            for (int x = 0; x < snapshot->parameters.size; ++x) {
+                for (int y = 0; y < snapshot->parameters.size; ++y) {
+                    double positionX, positionY;
+                    size_t index;
+
+                    if (std::isnan(snapshot->meanZ(x, y))) continue;
+
+                    snapshot->getPositionFromIndex(x, y, positionX, positionY);
+                    if (!level.getIndexFromPosition(positionX, positionY,
+                            index))
+                        continue;
+
+                    precision(index) += 1. / snapshot->varianceZ(x, y);
+                    weightedMean(index) += snapshot->meanZ(x, y) /
+                            snapshot->varianceZ(x, y);
+                }
+            }
+
+            for (int i = 0; i < size * size; ++i) {
+                if (precision(i) > 0.) {
+                    ASSERT_NEAR(level.meanZ(i), weightedMean(i) / precision(i),
+                            1e-5);
+                    ASSERT_NEAR(level.varianceZ(i), 1. / precision(i), 1e-5);
+                } else {
+                    ASSERT_TRUE(std::isnan(level.meanZ(i)));
+                }
+            }
+        }
+    }
+}
+
+TEST(MapTest, ChangeSetsUpdateCopyOfMap) {
+    DataRegistration dataRegistration;
+    dataRegistration.configure(20., 1., -100., 100., 0., true);
+
+    MapChangeSet changeSet;
+    dataRegistration.getChanges(0, changeSet);
+    ASSERT_TRUE(changeSet.full);
+    ASSERT_EQ(changeSet.cellIndices.size(), 20u * 20u);
+
+    Matrix meanZ = dataRegistration.getSnapshot()->meanZ;
+    uint64_t version = changeSet.version;
+
+    const std::vector<Eigen::Vector3d> translations = {
+            Eigen::Vector3d(0.4, 0.2, 0.),
+            Eigen::Vector3d(3.6, -2.3, 0.),
+            Eigen::Vector3d(-1.2, 7.9, 0.)};
+
+    for (const auto& translation : translations) {
+        Pose pose = Pose::Identity();
+        pose.translation() = translation;
+        dataRegistration.translateMap(pose);
+
+        Cloud::Ptr cloud(new Cloud);
+        for (double x = -2.; x < 3.; x += 0.5)
+            for (double y = -1.; y < 2.; y += 0.5)
+                cloud->push_back(pcl::PointXYZ(translation.x() + x,
+                        translation.y() + y, x - y));
+        std::vector<float> cloudVariances(cloud->size(), 1.f);
+        dataRegistration.updateMap(cloud, cloudVariances);
+
+        dataRegistration.getChanges(version, changeSet);
+        ASSERT_FALSE(changeSet.full);
+        ASSERT_EQ(changeSet.version, dataRegistration.getVersion());
+        ASSERT_LT(changeSet.cellIndices.size(), 20u * 20u);
+
+        for (size_t i = 0; i < changeSet.cellIndices.size(); ++i)
+            meanZ(changeSet.cellIndices[i]) = changeSet.meanZ[i];
+        version = changeSet.version;
+
+        const auto& mapMeanZ = dataRegistration.getMap().getMeanZ();
+        for (int i = 0; i < mapMeanZ.size(); ++i) {
+            if (std::isnan(mapMeanZ(i)))
+                ASSERT_TRUE(std::isnan(meanZ(i)));
+            else
+                ASSERT_EQ(meanZ(i), mapMeanZ(i));
+        }
+
+        Image image;
+        ImageProcessing::convertMapToImage(dataRegistration.getMap(), image);
+        const cv::Rect region(changeSet.regionIndexY, changeSet.regionIndexX,
+                changeSet.regionSizeY, changeSet.regionSizeX);
+        const int numKnownCells = cv::countNonZero(image == image);
+        ASSERT_EQ(cv::countNonZero(image(region) == image(region)),
+                numKnownCells);
+    }
+
+    dataRegistration.getChanges(version, changeSet);
+    ASSERT_FALSE(changeSet.full);
+    ASSERT_TRUE(changeSet.cellIndices.empty());
+    ASSERT_EQ(dataRegistration.getSnapshot()->version, version);
+}
+
+TEST(MapTest, UntrackedChangesReportAllCells) {
+    DataRegistration dataRegistration;
+    dataRegistration.configure(20., 1., -100., 100., 0.5, false, 0, false);
+
+    MapChangeSet changeSet;
+    dataRegistration.getChanges(0, changeSet);
+    uint64_t version = changeSet.version;
+
+    Pose pose = Pose::Identity();
+    pose.translation() = Eigen::Vector3d(3.6, -2.3, 0.);
+    dataRegistration.translateMap(pose);
+
+    Cloud::Ptr cloud(new Cloud);
+    for (double x = -6.; x < 6.; x += 0.7)
+        for (double y = -4.; y < 8.; y += 0.9)
+            cloud->push_back(pcl::PointXYZ(pose.translation().x() + x,
+                    pose.translation().y() + y, std::sin(x) * std::cos(y) * x));
+    std::vector<float> cloudVariances(cloud->size(), 1.f);
+    dataRegistration.updateMap(cloud, cloudVariances);
+
+    ASSERT_EQ(dataRegistration.getSlopeSum(), 0.);
+
+    dataRegistration.getChanges(version, changeSet);
+    ASSERT_TRUE(changeSet.full);
+    ASSERT_GT(changeSet.version, version);
+    ASSERT_EQ(changeSet.cellIndices.size(), 20u * 20u);
+
+    version = changeSet.version;
+    dataRegistration.getChanges(version, changeSet);
+    ASSERT_FALSE(changeSet.full);
+    ASSERT_TRUE(changeSet.cellIndices.empty());
+}
+
+TEST(MapTest, UntrackedPyramidLevels) {
+    DataRegistration trackedRegistration, untrackedRegistration;
+    trackedRegistration.configure(24., 1., -100., 100., 0.5, true, 3);
+    untrackedRegistration.configure(24., 1., -100., 100., 0.5, true, 3,
+            false);
+
+    Pose pose = Pose::Identity();
+    pose.translation() = Eigen::Vector3d(2.7, -1.4, 0.);
+
+    Cloud::Ptr cloud(new Cloud);
+    for (double x = -8.; x < 8.; x += 0.7)
+        for (double y = -6.; y < 9.; y += 0.9)
+            cloud->push_back(pcl::PointXYZ(pose.translation().x() + x,
+                    pose.translation().y() + y, std::sin(x) * std::cos(y)));
+    std::vector<float> cloudVariances(cloud->size(), 0.5f);
+
+    for (auto registration : {&trackedRegistration, &untrackedRegistration}) {
+        registration->translateMap(pose);
+        registration->updateMap(cloud, cloudVariances);
+    }
+
+    const auto trackedSnapshot = trackedRegistration.getSnapshot();
+    const auto untrackedSnapshot = untrackedRegistration.getSnapshot();
+    ASSERT_EQ(untrackedSnapshot->pyramid.size(), 3u);
+
+    for (size_t level = 0; level < untrackedSnapshot->pyramid.size();
+            ++level) {
+        const auto& trackedLevel = trackedSnapshot->pyramid[level];
+        const auto& untrackedLevel = untrackedSnapshot->pyramid[level];
+        const int size = untrackedLevel.parameters.size;
+
+        ASSERT_EQ(size, trackedLevel.parameters.size);
+        ASSERT_EQ(untrackedLevel.meanZ.rows(), size);
+        ASSERT_EQ(untrackedLevel.meanZ.cols(), size);
+
+        for (int i = 0; i < size * size; ++i) {
+            if (std::isnan(trackedLevel.meanZ(i))) {
+                ASSERT_TRUE(std::isnan(untrackedLevel.meanZ(i)));
+            } else {
+                ASSERT_EQ(untrackedLevel.meanZ(i), trackedLevel.meanZ(i));
+                ASSERT_EQ(untrackedLevel.varianceZ(i),
+                        trackedLevel.varianceZ(i));
+            }
+        }
+    }
+}
+
+} // namespace ga_slam
@@ -18,13 +18,52 @@
  */
 
 // GA SLAM
+#include "ga_slam/TypeDefs.h"
 #include "ga_slam/localization/ParticleFilter.h"
+#include "ga_slam/mapping/Map.h"
+#include "ga_slam/processing/ThreadPool.h"
+
+// PCL
+#include <pcl/point_types.h>
+#include <pcl/point_cloud.h>
+
+// STL
+#include <cmath>
 
 // GMock
 #include "gmock/gmock.h"
 
 namespace ga_slam {
 
+namespace {
+
+/// Creates a curved snapshot and a cloud sampled from its surface, so that
+/// particles displaced from the origin are less likely
+void createCurvedMap(MapSnapshot& mapSnapshot, Cloud::Ptr& cloud) {
+    mapSnapshot.parameters.length = 10.;
+    mapSnapshot.parameters.size = 10;
+    mapSnapshot.parameters.resolution = 1.;
+    mapSnapshot.parameters.positionX = 0.;
+    mapSnapshot.parameters.positionY = 0.;
+    mapSnapshot.valid = true;
+    mapSnapshot.meanZ.resize(10, 10);
+    mapSnapshot.varianceZ.setConstant(10, 10, 0.1f);
+
+    cloud.reset(new Cloud);
+    for (float x = -4.5f; x < 5.f; x += 1.f) {
+        for (float y = -4.5f; y < 5.f; y += 1.f) {
+            const float z = 0.2f * (x * x + y * y);
+            size_t index;
+
+            mapSnapshot.getIndexFromPosition(x, y, index);
+            mapSnapshot.meanZ(index) = z;
+            cloud->push_back(pcl::PointXYZ(x, y, z));
+        }
+    }
+}
+
+}  // namespace
+
 TEST(ParticleFilterTest, Initialization) {
     ParticleFilter particleFilter;
     particleFilter.configure(1, 0., 0., 0., 0., 0., 0.);
@@ -40,5 +79,193 @@ TEST(ParticleFilterTest, Initialization) {
     ASSERT_EQ(estimateYaw, initialYaw);
 }
 
+TEST(ParticleFilterTest, ParticleArrays) {
+    ParticleArrays particles;
+    particles.resize(4);
+
+    ASSERT_EQ(particles.size(), 4u);
+    for (Eigen::Index i = 0; i < 4; ++i) {
+        ASSERT_EQ(particles.x(i), 0.);
+        ASSERT_EQ(particles.y(i), 0.);
+        ASSERT_EQ(particles.yaw(i), 0.);
+        ASSERT_EQ(particles.weight(i), 0.25);
+    }
+
+    particles.x << 1., 2., 3., 4.;
+    particles.y << 5., 6., 7., 8.;
+    particles.yaw << 0.1, 0.2, 0.3, 0.4;
+    particles.weight << 0.4, 0.3, 0.2, 0.1;
+
+    const auto particle = particles.get(2);
+    ASSERT_EQ(particle.x, 3.);
+    ASSERT_EQ(particle.y, 7.);
+    ASSERT_EQ(particle.yaw, 0.3);
+    ASSERT_EQ(particle.weight, 0.2);
+
+    particles.resize(0);
+    ASSERT_EQ(particles.size(), 0u);
+    ASSERT_EQ(particles.weight.size(), 0);
+}
+
+TEST(ParticleFilterTest, ParticlesArray) {
+    const int numParticles = 7;
+    ParticleFilter particleFilter;
+    particleFilter.configure(numParticles, 1., 2., 0.5, 0., 0., 0.);
+    particleFilter.initialize(3., -1., 0.2);
+
+    const Eigen::ArrayXXd particlesArray = particleFilter.getParticlesArray();
+    ASSERT_EQ(particlesArray.rows(), numParticles);
+    ASSERT_EQ(particlesArray.cols(), 4);
+
+    for (Eigen::Index i = 0; i < numParticles; ++i)
+        ASSERT_DOUBLE_EQ(particlesArray(i, 3), 1. / numParticles);
+
+    // The noise of each state variable is sampled separately
+    ASSERT_FALSE((particlesArray.col(0) - 3. ==
+            particlesArray.col(1) + 1.).all());
+}
+
+TEST(ParticleFilterTest, GaussianSampling) {
+    // An odd number of particles so that the last Box-Muller pair is split
+    const int numParticles = 20001;
+    const double sigmas[3] = {0.5, 2., 0.1};
+    const double means[3] = {1., -3., 0.5};
+
+    ParticleFilter particleFilter;
+    particleFilter.configure(numParticles, sigmas[0], sigmas[1], sigmas[2],
+            0., 0., 0.);
+    particleFilter.initialize(means[0], means[1], means[2]);
+
+    const Eigen::ArrayXXd particlesArray = particleFilter.getParticlesArray();
+
+    for (int i = 0; i < 3; ++i) {
+        const Eigen::ArrayXd values = particlesArray.col(i);
+        const double mean = values.mean();
+        const double sigma = std::sqrt((values - mean).square().mean());
+        const double withinSigma = ((values - means[i]).abs() <
+                sigmas[i]).cast<double>().mean();
+
+        ASSERT_TRUE(values.allFinite());
+        ASSERT_NEAR(mean, means[i], 4. * sigmas[i] / std::sqrt(numParticles));
+        ASSERT_NEAR(sigma, sigmas[i], 0.03 * sigmas[i]);
+        ASSERT_NEAR(withinSigma, 0.6827, 0.015);
+    }
+}
+
+TEST(ParticleFilterTest, EffectiveSampleSize) {
+    ParticleFilter particleFilter;
+    particleFilter.configure(10, 0., 0., 0., 0., 0., 0.);
+    particleFilter.initialize();
+
+    ASSERT_DOUBLE_EQ(particleFilter.getEffectiveSampleSize(), 10.);
+    ASSERT_FALSE(particleFilter.needsResampling());
+}
+
+TEST(ParticleFilterTest, AdaptiveResampling) {
+    ParticleFilter particleFilter;
+    const int numParticles = 1000, minNumParticles = 50;
+
+    particleFilter.configure(numParticles, 0., 0., 0., 0., 0., 0., 0.5,
+            minNumParticles);
+    particleFilter.initialize(1., 2., 0.);
+    particleFilter.resample();
+    ASSERT_EQ(particleFilter.getNumParticles(), minNumParticles);
+
+    double estimateX, estimateY, estimateYaw;
+    particleFilter.getEstimate(estimateX, estimateY, estimateYaw);
+    ASSERT_EQ(estimateX, 1.);
+    ASSERT_EQ(estimateY, 2.);
+    ASSERT_EQ(estimateYaw, 0.);
+
+    particleFilter.configure(numParticles, 5., 5., 1., 0., 0., 0., 0.5,
+            minNumParticles);
+    particleFilter.initialize();
+    particleFilter.resample();
+    ASSERT_EQ(particleFilter.getNumParticles(), numParticles);
+}
+
+TEST(ParticleFilterTest, AccumulatedWeights) {
+    MapSnapshot mapSnapshot;
+    Cloud::Ptr cloud;
+    createCurvedMap(mapSnapshot, cloud);
+
+    ParticleFilter particleFilter;
+    particleFilter.configure(100, 1., 1., 0., 0., 0., 0.);
+    particleFilter.initialize();
+
+    particleFilter.update(Pose::Identity(), cloud, mapSnapshot);
+    const Eigen::ArrayXd firstWeights =
+            particleFilter.getParticlesArray().col(3);
+
+    particleFilter.update(Pose::Identity(), cloud, mapSnapshot);
+    const Eigen::ArrayXd secondWeights =
+            particleFilter.getParticlesArray().col(3);
+
+    const Eigen::ArrayXd squaredWeights = firstWeights.square() /
+            firstWeights.square().sum();
+
+    for (Eigen::Index i = 0; i < secondWeights.size(); ++i)
+        ASSERT_NEAR(secondWeights(i), squaredWeights(i), 1e-9);
+}
+
+TEST(ParticleFilterTest, UniformWeightsAfterResampling) {
+    MapSnapshot mapSnapshot;
+    Cloud::Ptr cloud;
+    createCurvedMap(mapSnapshot, cloud);
+
+    const int numParticles = 100;
+    ParticleFilter particleFilter;
+    particleFilter.configure(numParticles, 1., 1., 0., 0., 0., 0.);
+    particleFilter.initialize();
+    particleFilter.update(Pose::Identity(), cloud, mapSnapshot);
+
+    ASSERT_LT(particleFilter.getEffectiveSampleSize(), numParticles / 2.);
+
+    double bestX, bestY, bestYaw;
+    particleFilter.getEstimate(bestX, bestY, bestYaw);
+
+    particleFilter.resample();
+
+    const Eigen::ArrayXd weights = particleFilter.getParticlesArray().col(3);
+    ASSERT_EQ(weights.size(), numParticles);
+    for (Eigen::Index i = 0; i < weights.size(); ++i)
+        ASSERT_DOUBLE_EQ(weights(i), 1. / numParticles);
+
+    ASSERT_NEAR(particleFilter.getEffectiveSampleSize(), numParticles, 1e-9);
+
+    double estimateX, estimateY, estimateYaw;
+    particleFilter.getEstimate(estimateX, estimateY, estimateYaw);
+    ASSERT_EQ(estimateX, bestX);
+    ASSERT_EQ(estimateY, bestY);
+    ASSERT_EQ(estimateYaw, bestYaw);
+}
+
+TEST(ParticleFilterTest, HeldMapCloud) {
+    MapSnapshot mapSnapshot;
+    Cloud::Ptr cloud;
+    createCurvedMap(mapSnapshot, cloud);
+
+    const int numParticles = 100;
+    ThreadPool threadPool;
+    threadPool.configure(3);
+
+    ParticleFilter particleFilter(&threadPool);
+    particleFilter.configure(numParticles, 1., 1., 0., 0., 0., 0.);
+    particleFilter.initialize();
+
+    Cloud::Ptr mapCloud(new Cloud(*cloud));
+    particleFilter.update(Pose::Identity(), cloud, mapCloud);
+
+    // The map cloud is indexed without a copy and held until the next update
+    ASSERT_EQ(mapCloud.use_count(), 2);
+    ASSERT_LT(particleFilter.getEffectiveSampleSize(), numParticles);
+
+    Cloud::Ptr nextMapCloud(new Cloud(*cloud));
+    particleFilter.update(Pose::Identity(), cloud, nextMapCloud);
+
+    ASSERT_EQ(mapCloud.use_count(), 1);
+    ASSERT_EQ(nextMapCloud.use_count(), 2);
+}
+
 } // namespace ga_slam
 
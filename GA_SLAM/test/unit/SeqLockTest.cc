@@ -0,0 +1,67 @@
+/*
+ * This file is part of GA SLAM.
+ * Copyright (C) 2018 Dimitris Geromichalos,
+ * Planetary Robotics Lab (PRL), European Space Agency (ESA)
+ *
+ * GA SLAM is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GA SLAM is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GA SLAM. If not, see <http://www.gnu.org/licenses/>.
+ */
+// GA SLAM
+#include "ga_slam/processing/SeqLock.h"
+
+// STL
+#include <thread>
+#include <atomic>
+#include <vector>
+
+// GMock
+#include "gmock/gmock.h"
+
+namespace ga_slam {
+
+struct Values {
+    double data[16];
+};
+
+TEST(SeqLockTest, ConsistentSnapshots) {
+    Values values;
+    for (auto& value : values.data) value = 0.;
+
+    SeqLock<Values> seqLock(values);
+    std::atomic<bool> writing(true);
+    std::atomic<bool> consistent(true);
+
+    std::vector<std::thread> readers;
+    for (int i = 0; i < 3; ++i) {
+        readers.emplace_back([&] {
+            while (writing) {
+                const Values snapshot = seqLock.load();
+                for (const auto& value : snapshot.data)
+                    if (value != snapshot.data[0]) consistent = false;
+            }
+        });
+    }
+
+    for (int i = 1; i <= 100000; ++i) {
+        for (auto& value : values.data) value = i;
+        seqLock.store(values);
+    }
+
+    writing = false;
+    for (auto& reader : readers) reader.join();
+
+    ASSERT_TRUE(consistent);
+    ASSERT_EQ(seqLock.load().data[15], 100000.);
+}
+
+} // namespace ga_slam
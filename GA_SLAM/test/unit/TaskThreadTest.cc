@@ -0,0 +1,91 @@
+/*
+ * This file is part of GA SLAM.
+ * Copyright (C) 2018 Dimitris Geromichalos,
+ * Planetary Robotics Lab (PRL), European Space Agency (ESA)
+ *
+ * GA SLAM is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GA SLAM is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GA SLAM. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// GA SLAM
+#include "ga_slam/processing/TaskThread.h"
+
+// STL
+#include <thread>
+#include <atomic>
+
+// GMock
+#include "gmock/gmock.h"
+
+namespace ga_slam {
+
+TEST(TaskThreadTest, Run) {
+    TaskThread taskThread;
+    int input = 0, sum = 0;
+    std::thread::id taskThreadId;
+
+    taskThread.start([&] {
+        sum += input;
+        taskThreadId = std::this_thread::get_id();
+    });
+
+    for (int i = 1; i <= 100; ++i)
+        taskThread.run([&] { input = i; });
+
+    taskThread.wait();
+    ASSERT_EQ(sum, 5050);
+    ASSERT_NE(taskThreadId, std::this_thread::get_id());
+}
+
+TEST(TaskThreadTest, TryRunWhileBusy) {
+    TaskThread taskThread;
+    std::atomic<bool> release(false);
+    std::atomic<int> numRuns(0);
+    int numPrepared = 0;
+
+    taskThread.start([&] {
+        while (!release) std::this_thread::yield();
+        numRuns++;
+    });
+
+    ASSERT_TRUE(taskThread.tryRun([&] { numPrepared++; }));
+    ASSERT_FALSE(taskThread.tryRun([&] { numPrepared++; }));
+    ASSERT_EQ(numPrepared, 1);
+
+    release = true;
+    taskThread.wait();
+    ASSERT_EQ(numRuns, 1);
+
+    ASSERT_TRUE(taskThread.tryRun([&] { numPrepared++; }));
+    taskThread.wait();
+    ASSERT_EQ(numRuns, 2);
+    ASSERT_EQ(numPrepared, 2);
+}
+
+TEST(TaskThreadTest, Stop) {
+    TaskThread taskThread;
+    std::thread::id taskThreadId;
+
+    ASSERT_FALSE(taskThread.tryRun([] {}));
+
+    taskThread.start([&] { taskThreadId = std::this_thread::get_id(); });
+    taskThread.run([] {});
+    taskThread.stop();
+    ASSERT_NE(taskThreadId, std::this_thread::get_id());
+
+    ASSERT_FALSE(taskThread.tryRun([] {}));
+    taskThread.run([] {});
+    ASSERT_EQ(taskThreadId, std::this_thread::get_id());
+}
+
+} // namespace ga_slam
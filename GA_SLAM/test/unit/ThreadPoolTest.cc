@@ -0,0 +1,148 @@
+/*
+ * This file is part of GA SLAM.
+ * Copyright (C) 2018 Dimitris Geromichalos,
+ * Planetary Robotics Lab (PRL), European Space Agency (ESA)
+ *
+ * GA SLAM is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GA SLAM is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GA SLAM. If not, see <http://www.gnu.org/licenses/>.
+ */
+// GA SLAM
+#include "ga_slam/processing/ThreadPool.h"
+
+// STL
+#include <vector>
+#include <set>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <atomic>
+
+// GMock
+#include "gmock/gmock.h"
+
+namespace ga_slam {
+
+TEST(ThreadPoolTest, ParallelFor) {
+    ThreadPool threadPool;
+    threadPool.configure(4);
+    ASSERT_EQ(threadPool.getNumThreads(), 4);
+
+    for (size_t size : {1, 7, 100, 1001}) {
+        std::vector<int> visits(size, 0);
+        std::atomic<bool> validThreadIndex(true);
+
+        threadPool.parallelFor(size, 3,
+                [&] (size_t begin, size_t end, int threadIndex) {
+            if (threadIndex < 0 || threadIndex >= 4) validThreadIndex = false;
+            for (size_t i = begin; i < end; ++i) visits[i]++;
+        });
+
+        ASSERT_TRUE(validThreadIndex);
+        for (const auto& visit : visits) ASSERT_EQ(visit, 1);
+    }
+}
+
+TEST(ThreadPoolTest, Reconfigure) {
+    ThreadPool threadPool;
+    std::atomic<size_t> sum(0);
+
+    for (int numThreads : {1, 3, 2}) {
+        threadPool.configure(numThreads);
+        ASSERT_EQ(threadPool.getNumThreads(), numThreads);
+
+        sum = 0;
+        threadPool.parallelFor(100, 1, [&] (size_t begin, size_t end, int) {
+            for (size_t i = begin; i < end; ++i) sum += i;
+        });
+
+        ASSERT_EQ(sum, 4950u);
+    }
+}
+
+TEST(ThreadPoolTest, ConcurrentLoops) {
+    ThreadPool threadPool;
+    threadPool.configure(4);
+
+    std::vector<int> visits[2];
+    std::set<int> threadIndices[2];
+    std::mutex threadIndicesMutex;
+
+    const auto runLoop = [&] (int loopIndex) {
+        visits[loopIndex].assign(40, 0);
+
+        threadPool.parallelFor(40, 1,
+                [&] (size_t begin, size_t end, int threadIndex) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            for (size_t i = begin; i < end; ++i) visits[loopIndex][i]++;
+
+            std::lock_guard<std::mutex> guard(threadIndicesMutex);
+            threadIndices[loopIndex].insert(threadIndex);
+        });
+    };
+
+    std::thread otherThread(runLoop, 1);
+    runLoop(0);
+    otherThread.join();
+
+    // Neither loop is processed serially by its calling thread only
+    for (int loopIndex = 0; loopIndex < 2; ++loopIndex) {
+        for (const auto& visit : visits[loopIndex]) ASSERT_EQ(visit, 1);
+        ASSERT_GT(threadIndices[loopIndex].size(), 1u);
+        ASSERT_EQ(threadIndices[loopIndex].count(0), 1u);
+    }
+}
+
+TEST(ThreadPoolTest, NestedLoop) {
+    ThreadPool threadPool;
+    threadPool.configure(3);
+
+    std::atomic<size_t> sum(0);
+    std::atomic<bool> sharedIndex(false);
+    std::vector<std::atomic<bool>> busyIndices(threadPool.getNumThreads());
+    for (auto& busyIndex : busyIndices) busyIndex = false;
+
+    threadPool.parallelFor(4, 1, [&] (size_t begin, size_t end, int) {
+        for (size_t i = begin; i < end; ++i) {
+            threadPool.parallelFor(10, 2, [&] (size_t b, size_t e, int index) {
+                // The threads of the inner loops may share scratch buffers
+                // indexed by their thread index
+                if (busyIndices[index].exchange(true)) sharedIndex = true;
+                for (size_t j = b; j < e; ++j) sum += i * 10 + j;
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                busyIndices[index] = false;
+            });
+        }
+    });
+
+    ASSERT_EQ(sum, 780u);
+    ASSERT_FALSE(sharedIndex);
+}
+
+TEST(ThreadPoolTest, WorkerIndexInOtherPool) {
+    ThreadPool outerPool, innerPool;
+    outerPool.configure(4);
+    innerPool.configure(2);
+
+    std::atomic<bool> outOfBounds(false);
+
+    outerPool.parallelFor(8, 1, [&] (size_t, size_t, int) {
+        innerPool.parallelFor(4, 1, [&] (size_t, size_t, int index) {
+            if (index < 0 || index >= innerPool.getNumThreads())
+                outOfBounds = true;
+        });
+    });
+
+    ASSERT_FALSE(outOfBounds);
+}
+
+} // namespace ga_slam
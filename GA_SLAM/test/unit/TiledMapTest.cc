@@ -0,0 +1,231 @@
+/*
+ * This file is part of GA SLAM.
+ * Copyright (C) 2018 Dimitris Geromichalos,
+ * Planetary Robotics Lab (PRL), European Space Agency (ESA)
+ *
+ * GA SLAM is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GA SLAM is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GA SLAM. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// GA SLAM
+#include "ga_slam/TypeDefs.h"
+#include "ga_slam/mapping/TiledMap.h"
+#include "ga_slam/mapping/TiledMapBuilder.h"
+
+// PCL
+#include <pcl/point_types.h>
+#include <pcl/point_cloud.h>
+
+// OpenCV
+#include <opencv2/core/core.hpp>
+
+// STL
+#include <string>
+#include <fstream>
+#include <cstring>
+#include <cstdint>
+#include <cstdio>
+#include <algorithm>
+#include <cmath>
+
+// GMock
+#include "gmock/gmock.h"
+
+namespace ga_slam {
+
+class TiledMapTest : public ::testing::Test {
+  protected:
+    TiledMapTest(void) {
+        for (double x = 0.5; x < 40.; x += 1.)
+            for (double y = 0.5; y < 40.; y += 1.)
+                if (!isMissing(x, y))
+                    cloud_.push_back(pcl::PointXYZ(x, y, getElevation(x, y)));
+    }
+
+    ~TiledMapTest(void) { std::remove(filename_.c_str()); }
+
+    static float getElevation(double x, double y) {
+        return 0.1 * x + 0.01 * y * y;
+    }
+
+    static bool isMissing(double x, double y) {
+        return x > 8. && x < 16. && y < 8.;
+    }
+
+  protected:
+    Cloud cloud_;
+
+    const std::string filename_ = "TiledMapTest.bin";
+};
+
+TEST_F(TiledMapTest, ExtractImageFromResidentTiles) {
+    ASSERT_TRUE(TiledMapBuilder::writeCloud(filename_, cloud_, 1., 8));
+
+    TiledMap tiledMap;
+    ASSERT_TRUE(tiledMap.open(filename_, 2));
+    ASSERT_EQ(tiledMap.getHeader().numTilesX, 5u);
+    ASSERT_EQ(tiledMap.getHeader().numTilesY, 5u);
+    ASSERT_EQ(tiledMap.getNumResidentTiles(), 0u);
+
+    Image image;
+    double centerX, centerY;
+    tiledMap.extractImage(20.2, 20.7, 10, image, centerX, centerY);
+
+    ASSERT_EQ(image.rows, 10);
+    ASSERT_EQ(image.cols, 10);
+    ASSERT_DOUBLE_EQ(centerX, 20.);
+    ASSERT_DOUBLE_EQ(centerY, 21.);
+    ASSERT_EQ(tiledMap.getNumResidentTiles(), 2u);
+    ASSERT_EQ(tiledMap.getNumTileLoads(), 6u);
+
+    for (int row = 0; row < image.rows; ++row) {
+        for (int col = 0; col < image.cols; ++col) {
+            const double x = centerX + image.rows / 2 - row - 0.5;
+            const double y = centerY + image.cols / 2 - col - 0.5;
+
+            ASSERT_NEAR(image.at<float>(row, col), getElevation(x, y), 1e-4);
+        }
+    }
+
+    tiledMap.extractImage(12., 4., 12, image, centerX, centerY);
+
+    for (int row = 0; row < image.rows; ++row) {
+        for (int col = 0; col < image.cols; ++col) {
+            const double x = centerX + image.rows / 2 - row - 0.5;
+            const double y = centerY + image.cols / 2 - col - 0.5;
+
+            if (y > 0. && !isMissing(x, y))
+                ASSERT_NEAR(image.at<float>(row, col), getElevation(x, y),
+                        1e-4);
+            else
+                ASSERT_TRUE(std::isnan(image.at<float>(row, col)));
+        }
+    }
+
+    ASSERT_LE(tiledMap.getNumResidentTiles(), 2u);
+}
+
+TEST_F(TiledMapTest, BuildFromCloudChunks) {
+    ASSERT_TRUE(TiledMapBuilder::writeCloud(filename_, cloud_, 1., 8));
+
+    TiledMap tiledMap;
+    ASSERT_TRUE(tiledMap.open(filename_, 4));
+
+    Image image;
+    double centerX, centerY;
+    tiledMap.extractImage(20., 20., 40, image, centerX, centerY);
+
+    TiledMapBuilder builder;
+    builder.configure(0.5, 39.5, 0.5, 39.5, 1., 8);
+
+    for (size_t begin = 0; begin < cloud_.size(); begin += 500) {
+        Cloud chunk;
+        const size_t end = std::min(begin + 500, cloud_.size());
+        chunk.insert(chunk.end(), cloud_.begin() + begin,
+                cloud_.begin() + end);
+
+        builder.addCloud(chunk);
+    }
+
+    const std::string chunkedFilename = filename_ + ".chunked";
+    ASSERT_TRUE(builder.write(chunkedFilename));
+    ASSERT_FALSE(builder.write(chunkedFilename));
+
+    TiledMap chunkedTiledMap;
+    ASSERT_TRUE(chunkedTiledMap.open(chunkedFilename, 4));
+    std::remove(chunkedFilename.c_str());
+
+    Image chunkedImage;
+    double chunkedCenterX, chunkedCenterY;
+    chunkedTiledMap.extractImage(20., 20., 40, chunkedImage, chunkedCenterX,
+            chunkedCenterY);
+
+    ASSERT_DOUBLE_EQ(chunkedCenterX, centerX);
+    ASSERT_DOUBLE_EQ(chunkedCenterY, centerY);
+    ASSERT_EQ(cv::countNonZero(image == chunkedImage), image.rows * image.cols -
+            8 * 8);
+}
+
+TEST_F(TiledMapTest, ExtractImageFromCompactTiles) {
+    ASSERT_TRUE(TiledMapBuilder::writeCloud(filename_, cloud_, 1., 7, 0.001));
+
+    TiledMap tiledMap;
+    ASSERT_TRUE(tiledMap.open(filename_, 4));
+    ASSERT_TRUE(tiledMap.getHeader().isCompact());
+
+    Image image;
+    double centerX, centerY;
+    tiledMap.extractImage(12., 20., 24, image, centerX, centerY);
+
+    for (int row = 0; row < image.rows; ++row) {
+        for (int col = 0; col < image.cols; ++col) {
+            const double x = centerX + image.rows / 2 - row - 0.5;
+            const double y = centerY + image.cols / 2 - col - 0.5;
+
+            if (!isMissing(x, y))
+                ASSERT_NEAR(image.at<float>(row, col), getElevation(x, y),
+                        0.0006);
+            else
+                ASSERT_TRUE(std::isnan(image.at<float>(row, col)));
+        }
+    }
+}
+
+TEST_F(TiledMapTest, RejectInvalidFiles) {
+    TiledMap tiledMap;
+    ASSERT_FALSE(tiledMap.open(filename_, 2));
+    ASSERT_FALSE(tiledMap.isOpen());
+
+    std::ofstream(filename_) << "not a tiled map";
+    ASSERT_FALSE(tiledMap.open(filename_, 2));
+    ASSERT_FALSE(tiledMap.isOpen());
+
+    ASSERT_FALSE(TiledMapBuilder::writeCloud(filename_, Cloud(), 1., 8));
+
+    const auto writeHeader = [this] (uint32_t tileSize, uint32_t numTilesX,
+            uint32_t numTilesY) {
+        TiledMapHeader header;
+        std::memcpy(header.magic, tiledMapMagic, sizeof(header.magic));
+        header.version = tiledMapVersion;
+        header.tileSize = tileSize;
+        header.numTilesX = numTilesX;
+        header.numTilesY = numTilesY;
+        header.resolution = 1.;
+        header.cornerX = 0.;
+        header.cornerY = 0.;
+
+        std::ofstream file(filename_, std::ios::binary);
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        const uint64_t tileOffset = 0;
+        file.write(reinterpret_cast<const char*>(&tileOffset),
+                sizeof(tileOffset));
+    };
+
+    writeHeader(2, 1, 1);
+    ASSERT_TRUE(tiledMap.open(filename_, 2));
+
+    // The number of tiles wraps to zero if multiplied in 32 bits
+    writeHeader(1, 65536, 65536);
+    ASSERT_FALSE(tiledMap.open(filename_, 2));
+
+    // The map's dimensions in cells overflow an int
+    writeHeader(65536, 65536, 1);
+    ASSERT_FALSE(tiledMap.open(filename_, 2));
+
+    // The tile table is longer than the file
+    writeHeader(1, 40000, 40000);
+    ASSERT_FALSE(tiledMap.open(filename_, 2));
+    ASSERT_FALSE(tiledMap.isOpen());
+}
+
+} // namespace ga_slam